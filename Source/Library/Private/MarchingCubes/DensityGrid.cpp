@@ -0,0 +1,230 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "DensityGrid.h"
+
+
+
+void FDensityGrid::Quantize()
+{
+	if (IsQuantized() || IsOccupancy()) return;
+
+	ByteDensities.SetNumUninitialized(Densities.Num());
+	for (int32 Index = 0; Index < Densities.Num(); Index++)
+	{
+		ByteDensities[Index] = (uint8)FMath::RoundToInt(FMath::Clamp(Densities[Index], 0.f, 1.f) * 255.f);
+	}
+	Densities.Empty();
+}
+
+bool FDensityGrid::FromPoints(const TArray<FVector4>& Points, const FIntVector& Dimensions, FDensityGrid& OutGrid)
+{
+	OutGrid = FDensityGrid();
+
+	const int32 PointsNum = Dimensions.X * Dimensions.Y * Dimensions.Z;
+	if (Dimensions.GetMin() <= 0 || Points.Num() < PointsNum)
+	{
+		return false;
+	}
+
+	OutGrid.Dimensions = Dimensions;
+	OutGrid.Origin = FVector(Points[0]);
+
+	// Spacing along each axis from first point to its neighbour
+	const int32 NeighbourOffsets[3] = { 1, Dimensions.X, Dimensions.X * Dimensions.Y };
+	for (int32 Axis = 0; Axis < 3; Axis++)
+	{
+		if (Dimensions[Axis] > 1)
+		{
+			OutGrid.VoxelSize[Axis] = Points[NeighbourOffsets[Axis]][Axis] - Points[0][Axis];
+		}
+	}
+
+	OutGrid.Densities.SetNumUninitialized(PointsNum);
+	for (int32 Index = 0; Index < PointsNum; Index++)
+	{
+		OutGrid.Densities[Index] = Points[Index].W;
+	}
+	return true;
+}
+
+
+
+bool FDensityGrid::Downsample(const FDensityGridView& Source, int32 Stride, FDensityGrid& OutGrid)
+{
+	OutGrid = FDensityGrid();
+
+	if (!Source.IsValid() || Stride < 1) return false;
+
+	const FIntVector SourceCubes = Source.Dimensions - FIntVector(1);
+	if (SourceCubes.X % Stride != 0 || SourceCubes.Y % Stride != 0 || SourceCubes.Z % Stride != 0)
+	{
+		return false;
+	}
+
+	OutGrid.Origin = Source.Origin;
+	OutGrid.VoxelSize = Source.VoxelSize * Stride;
+	OutGrid.Dimensions = SourceCubes / Stride + FIntVector(1);
+
+	const int32 PointsNum = OutGrid.Dimensions.X * OutGrid.Dimensions.Y * OutGrid.Dimensions.Z;
+	if (Source.ByteDensities)
+	{
+		OutGrid.ByteDensities.SetNumUninitialized(PointsNum);
+	}
+	else
+	{
+		OutGrid.Densities.SetNumUninitialized(PointsNum);
+	}
+
+	int32 Index = 0;
+	for (int32 Z = 0; Z < OutGrid.Dimensions.Z; Z++)
+	{
+		for (int32 Y = 0; Y < OutGrid.Dimensions.Y; Y++)
+		{
+			for (int32 X = 0; X < OutGrid.Dimensions.X; X++, Index++)
+			{
+				const int32 SourceIndex = Source.GetPointIndex(X * Stride, Y * Stride, Z * Stride);
+				if (Source.ByteDensities)
+				{
+					OutGrid.ByteDensities[Index] = Source.ByteDensities[SourceIndex];
+				}
+				else
+				{
+					OutGrid.Densities[Index] = Source.GetDensity(SourceIndex);
+				}
+			}
+		}
+	}
+	return true;
+}
+
+
+
+void FDensityBlockPyramid::Build(const FDensityGridView& Grid)
+{
+	Levels.Empty();
+	if (!Grid.IsValid()) return;
+
+	const FIntVector CubesNum = Grid.Dimensions - FIntVector(1);
+	if (CubesNum.GetMin() <= 0) return;
+
+	FLevel& Finest = Levels.AddDefaulted_GetRef();
+	Finest.Dimensions = FIntVector(
+		FMath::DivideAndRoundUp(CubesNum.X, BlockSize),
+		FMath::DivideAndRoundUp(CubesNum.Y, BlockSize),
+		FMath::DivideAndRoundUp(CubesNum.Z, BlockSize));
+
+	const int32 BlocksNum = Finest.Dimensions.X * Finest.Dimensions.Y * Finest.Dimensions.Z;
+	Finest.Min.Init(TNumericLimits<float>::Max(), BlocksNum);
+	Finest.Max.Init(TNumericLimits<float>::Lowest(), BlocksNum);
+
+	// Block covers points [Block * BlockSize, (Block + 1) * BlockSize], neighbouring blocks share a plane of points
+	for (int32 BlockZ = 0; BlockZ < Finest.Dimensions.Z; BlockZ++)
+	{
+		for (int32 BlockY = 0; BlockY < Finest.Dimensions.Y; BlockY++)
+		{
+			for (int32 BlockX = 0; BlockX < Finest.Dimensions.X; BlockX++)
+			{
+				const FIntVector First = FIntVector(BlockX, BlockY, BlockZ) * BlockSize;
+				const FIntVector Last = FIntVector(
+					FMath::Min(First.X + BlockSize, CubesNum.X),
+					FMath::Min(First.Y + BlockSize, CubesNum.Y),
+					FMath::Min(First.Z + BlockSize, CubesNum.Z));
+
+				float Min = TNumericLimits<float>::Max();
+				float Max = TNumericLimits<float>::Lowest();
+				for (int32 Z = First.Z; Z <= Last.Z; Z++)
+				{
+					for (int32 Y = First.Y; Y <= Last.Y; Y++)
+					{
+						const int32 RowStart = Grid.GetPointIndex(0, Y, Z);
+						for (int32 X = First.X; X <= Last.X; X++)
+						{
+							const float Density = Grid.GetDensity(RowStart + X);
+							Min = FMath::Min(Min, Density);
+							Max = FMath::Max(Max, Density);
+						}
+					}
+				}
+
+				const int32 BlockIndex = Finest.GetIndex(BlockX, BlockY, BlockZ);
+				Finest.Min[BlockIndex] = Min;
+				Finest.Max[BlockIndex] = Max;
+			}
+		}
+	}
+
+	// Merge 2x2x2 blocks until single block is left
+	while (Levels.Last().Dimensions.GetMax() > 1)
+	{
+		const int32 PrevIndex = Levels.Num() - 1;
+		FLevel& Level = Levels.AddDefaulted_GetRef();
+		const FLevel& Prev = Levels[PrevIndex];
+
+		Level.Dimensions = FIntVector(
+			FMath::DivideAndRoundUp(Prev.Dimensions.X, 2),
+			FMath::DivideAndRoundUp(Prev.Dimensions.Y, 2),
+			FMath::DivideAndRoundUp(Prev.Dimensions.Z, 2));
+
+		const int32 LevelBlocksNum = Level.Dimensions.X * Level.Dimensions.Y * Level.Dimensions.Z;
+		Level.Min.Init(TNumericLimits<float>::Max(), LevelBlocksNum);
+		Level.Max.Init(TNumericLimits<float>::Lowest(), LevelBlocksNum);
+
+		for (int32 Z = 0; Z < Prev.Dimensions.Z; Z++)
+		{
+			for (int32 Y = 0; Y < Prev.Dimensions.Y; Y++)
+			{
+				for (int32 X = 0; X < Prev.Dimensions.X; X++)
+				{
+					const int32 PrevBlock = Prev.GetIndex(X, Y, Z);
+					const int32 Block = Level.GetIndex(X / 2, Y / 2, Z / 2);
+					Level.Min[Block] = FMath::Min(Level.Min[Block], Prev.Min[PrevBlock]);
+					Level.Max[Block] = FMath::Max(Level.Max[Block], Prev.Max[PrevBlock]);
+				}
+			}
+		}
+	}
+}
+
+int32 FDensityBlockPyramid::GetActiveBlocks(float SurfaceLevel, TArray<uint8>& OutActive) const
+{
+	OutActive.Reset();
+	if (!IsBuilt()) return 0;
+
+	// Flags of coarser level, starts with single top block
+	TArray<uint8> ParentActive;
+	const FLevel& Top = Levels.Last();
+	ParentActive.Init(ContainsSurface(Top.Min[0], Top.Max[0], SurfaceLevel), 1);
+
+	int32 ActiveNum = ParentActive[0];
+	for (int32 LevelIndex = Levels.Num() - 2; LevelIndex >= 0; LevelIndex--)
+	{
+		const FLevel& Level = Levels[LevelIndex];
+		const FLevel& Parent = Levels[LevelIndex + 1];
+
+		TArray<uint8> LevelActive;
+		LevelActive.Init(0, Level.Min.Num());
+		ActiveNum = 0;
+
+		for (int32 Z = 0; Z < Level.Dimensions.Z; Z++)
+		{
+			for (int32 Y = 0; Y < Level.Dimensions.Y; Y++)
+			{
+				for (int32 X = 0; X < Level.Dimensions.X; X++)
+				{
+					if (ParentActive[Parent.GetIndex(X / 2, Y / 2, Z / 2)] == 0) continue;
+
+					const int32 Block = Level.GetIndex(X, Y, Z);
+					if (ContainsSurface(Level.Min[Block], Level.Max[Block], SurfaceLevel))
+					{
+						LevelActive[Block] = 1;
+						ActiveNum++;
+					}
+				}
+			}
+		}
+		ParentActive = MoveTemp(LevelActive);
+	}
+
+	OutActive = MoveTemp(ParentActive);
+	return ActiveNum;
+}
@@ -0,0 +1,171 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "DensityVolumeFile.h"
+#include "MarchingCubesBuilder.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformFilemanager.h"
+#include "Async/MappedFileHandle.h"
+#include "Misc/FileHelper.h"
+
+
+
+
+bool FDensityVolumeWriter::Write(const FString& Filename, const FDensityGridView& Grid, int32 ChunkSlices)
+{
+	if (!Grid.IsValid()) return false;
+
+	if (Grid.OccupancyWords)
+	{
+		UE_LOG(MarchingCubesBuilder, Error, TEXT("Occupancy grids can not be written to density volume %s"), *Filename);
+		return false;
+	}
+
+	FDensityVolumeHeader Header;
+	for (int32 Axis = 0; Axis < 3; Axis++)
+	{
+		Header.Dimensions[Axis] = Grid.Dimensions[Axis];
+		Header.Origin[Axis] = Grid.Origin[Axis];
+		Header.VoxelSize[Axis] = Grid.VoxelSize[Axis];
+	}
+	Header.Quantized = Grid.ByteDensities ? 1 : 0;
+	Header.ChunkSlices = FMath::Max(ChunkSlices, 0);
+
+	TUniquePtr<FArchive> Writer(IFileManager::Get().CreateFileWriter(*Filename));
+	if (!Writer.IsValid())
+	{
+		UE_LOG(MarchingCubesBuilder, Error, TEXT("Can not open %s for writing"), *Filename);
+		return false;
+	}
+
+	Writer->Serialize(&Header, sizeof(Header));
+	Writer->Serialize(Grid.ByteDensities ? (void*)Grid.ByteDensities : (void*)Grid.Densities, Header.GetPayloadSize());
+
+	return Writer->Close();
+}
+
+
+
+FDensityVolumeReader::FDensityVolumeReader() {}
+
+FDensityVolumeReader::~FDensityVolumeReader()
+{
+	Close();
+}
+
+bool FDensityVolumeReader::Open(const FString& Filename)
+{
+	Close();
+
+	const uint8* Data = nullptr;
+	int64 DataSize = 0;
+
+	MappedHandle.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*Filename));
+	if (MappedHandle.IsValid())
+	{
+		MappedRegion.Reset(MappedHandle->MapRegion());
+	}
+
+	if (MappedRegion.IsValid())
+	{
+		Data = MappedRegion->GetMappedPtr();
+		DataSize = MappedRegion->GetMappedSize();
+	}
+	else
+	{
+		MappedHandle.Reset();
+		if (!FFileHelper::LoadFileToArray(LoadedData, *Filename))
+		{
+			UE_LOG(MarchingCubesBuilder, Error, TEXT("Can not read %s"), *Filename);
+			return false;
+		}
+		Data = LoadedData.GetData();
+		DataSize = LoadedData.Num();
+	}
+
+	if (DataSize < (int64)sizeof(FDensityVolumeHeader))
+	{
+		UE_LOG(MarchingCubesBuilder, Error, TEXT("%s is too small for density volume"), *Filename);
+		Close();
+		return false;
+	}
+
+	FMemory::Memcpy(&Header, Data, sizeof(Header));
+	const bool HeaderValid = Header.Magic == FDensityVolumeHeader::FileMagic 
+		&& Header.Version == FDensityVolumeHeader::FileVersion
+		&& Header.Dimensions[0] > 0 && Header.Dimensions[1] > 0 && Header.Dimensions[2] > 0
+		&& Header.PayloadOffset >= sizeof(FDensityVolumeHeader)
+		&& Header.PayloadOffset + Header.GetPayloadSize() <= DataSize;
+	if (!HeaderValid)
+	{
+		UE_LOG(MarchingCubesBuilder, Error, TEXT("%s is not valid density volume"), *Filename);
+		Close();
+		return false;
+	}
+
+	Payload = Data + Header.PayloadOffset;
+	return true;
+}
+
+void FDensityVolumeReader::Close()
+{
+	Payload = nullptr;
+	MappedRegion.Reset();
+	MappedHandle.Reset();
+	LoadedData.Empty();
+	Header = FDensityVolumeHeader();
+}
+
+FDensityGridView FDensityVolumeReader::GetView() const
+{
+	FDensityGridView View;
+	if (!IsOpen()) return View;
+
+	View.Origin = FVector(Header.Origin[0], Header.Origin[1], Header.Origin[2]);
+	View.VoxelSize = FVector(Header.VoxelSize[0], Header.VoxelSize[1], Header.VoxelSize[2]);
+	View.Dimensions = FIntVector(Header.Dimensions[0], Header.Dimensions[1], Header.Dimensions[2]);
+	View.DensitiesNum = View.GetPointsNum();
+	if (Header.Quantized)
+	{
+		View.ByteDensities = Payload;
+	}
+	else
+	{
+		View.Densities = reinterpret_cast<const float*>(Payload);
+	}
+	return View;
+}
+
+int32 FDensityVolumeReader::GetChunksNum() const
+{
+	if (!IsOpen()) return 0;
+	if (Header.ChunkSlices <= 0 || Header.Dimensions[2] <= 1) return 1;
+
+	// Last slice belongs to previous chunk as its top
+	return FMath::DivideAndRoundUp(Header.Dimensions[2] - 1, Header.ChunkSlices);
+}
+
+FDensityGridView FDensityVolumeReader::GetChunkView(int32 ChunkIndex) const
+{
+	const int32 ChunksNum = GetChunksNum();
+	if (ChunkIndex < 0 || ChunkIndex >= ChunksNum) return FDensityGridView();
+
+	FDensityGridView View = GetView();
+	if (ChunksNum == 1) return View;
+
+	const int32 FirstSlice = ChunkIndex * Header.ChunkSlices;
+	const int32 EndSlice = FMath::Min(FirstSlice + Header.ChunkSlices + 1, View.Dimensions.Z);
+	const int32 SliceSize = View.Dimensions.X * View.Dimensions.Y;
+
+	View.Origin.Z += FirstSlice * View.VoxelSize.Z;
+	View.Dimensions.Z = EndSlice - FirstSlice;
+	View.DensitiesNum = View.GetPointsNum();
+	if (View.ByteDensities)
+	{
+		View.ByteDensities += (int64)FirstSlice * SliceSize;
+	}
+	else
+	{
+		View.Densities += (int64)FirstSlice * SliceSize;
+	}
+	return View;
+}
@@ -1,11 +1,14 @@
 
 #include "MarchingCubesBuilder.h"
+#include "Async/ParallelFor.h"
 
 DEFINE_LOG_CATEGORY(MarchingCubesBuilder);
 
 
 #pragma region MarchingCubesData
-const uint16 FMarchingCubesBuilder::EdgeTable[256] =
+namespace MarchingCubesTables
+{
+constexpr uint16 EdgeTable[256] =
 {
 0x0  , 0x109, 0x203, 0x30a, 0x406, 0x50f, 0x605, 0x70c,
 0x80c, 0x905, 0xa0f, 0xb06, 0xc0a, 0xd03, 0xe09, 0xf00,
@@ -39,7 +42,7 @@ const uint16 FMarchingCubesBuilder::EdgeTable[256] =
 0x69c, 0x795, 0x49f, 0x596, 0x29a, 0x393, 0x99 , 0x190,
 0xf00, 0xe09, 0xd03, 0xc0a, 0xb06, 0xa0f, 0x905, 0x80c,
 0x70c, 0x605, 0x50f, 0x406, 0x30a, 0x203, 0x109, 0x0 };
-const int8 FMarchingCubesBuilder::TriTable[256][16] =
+constexpr int8 TriTable[256][16] =
 {
 	{-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
 	{0, 8, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
@@ -298,7 +301,7 @@ const int8 FMarchingCubesBuilder::TriTable[256][16] =
 	{0, 3, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
 	{-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1}
 };
-const int8 FMarchingCubesBuilder::Edges[12][2] =
+constexpr int8 Edges[12][2] =
 {
 	{0,1}, // bottom edges
 	{1,2},
@@ -315,6 +318,83 @@ const int8 FMarchingCubesBuilder::Edges[12][2] =
 	{2,6},
 	{3,7}
 };
+
+/** Edge is intersected if its corners are on different sides of surface */
+constexpr bool IsEdgeTableValid()
+{
+	for (int32 Case = 0; Case < 256; Case++)
+	{
+		uint16 Expected = 0;
+		for (int32 Edge = 0; Edge < 12; Edge++)
+		{
+			if (((Case >> Edges[Edge][0]) & 1) != ((Case >> Edges[Edge][1]) & 1))
+			{
+				Expected |= 1 << Edge;
+			}
+		}
+		if (EdgeTable[Case] != Expected) return false;
+	}
+	return true;
+}
+
+/** Triangles use exactly intersected edges and are terminated by -1 */
+constexpr bool IsTriTableValid()
+{
+	for (int32 Case = 0; Case < 256; Case++)
+	{
+		int32 EdgesNum = 0;
+		while (EdgesNum < 16 && TriTable[Case][EdgesNum] != -1)
+		{
+			EdgesNum++;
+		}
+		if (EdgesNum % 3 != 0 || EdgesNum > 15) return false;
+
+		uint16 Used = 0;
+		for (int32 Index = 0; Index < 16; Index++)
+		{
+			const int8 Edge = TriTable[Case][Index];
+			if (Index < EdgesNum)
+			{
+				if (Edge < 0 || Edge >= 12) return false;
+				Used |= 1 << Edge;
+			}
+			else if (Edge != -1)
+			{
+				return false;
+			}
+		}
+		if (Used != EdgeTable[Case]) return false;
+	}
+	return true;
+}
+
+constexpr FMarchingCubesCaseTable MakeCaseTable()
+{
+	FMarchingCubesCaseTable Table;
+	for (int32 Case = 0; Case < 256; Case++)
+	{
+		int32 EdgesNum = 0;
+		for (; EdgesNum < 15 && TriTable[Case][EdgesNum] != -1; EdgesNum++)
+		{
+			Table.Cases[Case].PackedEdges |= static_cast<uint64>(TriTable[Case][EdgesNum]) << (EdgesNum * 4);
+		}
+		Table.Cases[Case].TriangleNum = static_cast<uint8>(EdgesNum / 3);
+	}
+	return Table;
+}
+
+constexpr FMarchingCubesCaseTable CaseTable = MakeCaseTable();
+}
+
+static_assert(MarchingCubesTables::IsEdgeTableValid(), "EdgeTable does not match Edges");
+static_assert(MarchingCubesTables::IsTriTableValid(), "TriTable uses edges that are not intersected");
+static_assert(MarchingCubesTables::CaseTable.Cases[1].TriangleNum == 1 && MarchingCubesTables::CaseTable.Cases[1].PackedEdges == 0x380, "Case table packing");
+
+const uint16 (&FMarchingCubesBuilder::EdgeTable)[256] = MarchingCubesTables::EdgeTable;
+const int8 (&FMarchingCubesBuilder::TriTable)[256][16] = MarchingCubesTables::TriTable;
+const int8 (&FMarchingCubesBuilder::Edges)[12][2] = MarchingCubesTables::Edges;
+const FMarchingCubesCase (&FMarchingCubesBuilder::CaseTable)[256] = MarchingCubesTables::CaseTable.Cases;
+
 const FIntVector FMarchingCubesBuilder::EdgeToCubeOffset[12] =
 {
 	//Bottom edges
@@ -333,6 +413,18 @@ const FIntVector FMarchingCubesBuilder::EdgeToCubeOffset[12] =
 	FIntVector(1, 1, 0),
 	FIntVector(0, 1, 0)
 };
+const FIntVector FMarchingCubesBuilder::CubeCorners[8] =
+{
+	FIntVector(0, 0, 0),
+	FIntVector(1, 0, 0),
+	FIntVector(1, 1, 0),
+	FIntVector(0, 1, 0),
+
+	FIntVector(0, 0, 1),
+	FIntVector(1, 0, 1),
+	FIntVector(1, 1, 1),
+	FIntVector(0, 1, 1)
+};
 #pragma endregion MarchingCubesData
 
 void FMarchingCubesBuilder::PoligonizeSingle(const FVector4 CubeVertices[8], float SurfaceLevel, TArray<FVector>& OutVertices, TArray<int32> OutIndices)
@@ -359,165 +451,1821 @@ void FMarchingCubesBuilder::PoligonizeSingle(const FVector4 CubeVertices[8], flo
 	}
 }
 
-bool FMarchingCubesBuilder::GetOuterVertices(TArray<int32>& OutIndices) const
-{	
-	if (!BoundaryEdgesCalculated) return false;
+void FMarchingCubesBuilder::BuildChunksParallel()
+{
+	const int32 CubeLayers = Dimensions.Z - 1;
+	const int32 MaxChunks = FMath::Max(1, CubeLayers / FMath::Max(1, MinLayersPerTask));
+	const int32 ChunksNum = FMath::Clamp(FPlatformMisc::NumberOfCoresIncludingHyperthreads(), 1, MaxChunks);
 
-	TSet<int32> UniqIndices;
-	for (const FIndexEdge& Edge : BoundaryEdges)
+	TArray<FMarchingCubesChunk> Chunks;
+	Chunks.SetNum(ChunksNum);
+	for (int32 ChunkIndex = 0; ChunkIndex < ChunksNum; ChunkIndex++)
 	{
-		UniqIndices.Add(Edge.A);
-		UniqIndices.Add(Edge.B);
+		Chunks[ChunkIndex].FirstLayer = CubeLayers * ChunkIndex / ChunksNum;
+		Chunks[ChunkIndex].EndLayer = CubeLayers * (ChunkIndex + 1) / ChunksNum;
 	}
-	OutIndices.Reset(UniqIndices.Num());
-	OutIndices = UniqIndices.Array();
 
-	return true;
+	ParallelFor(ChunksNum, [this, &Chunks](int32 ChunkIndex)
+	{
+		PoligonizeChunk(Chunks[ChunkIndex], RemoveDuplicateVertices);
+	});
+
+	// Vertices of every chunk follow vertices of previous chunks, same order as single threaded sweep
+	TArray<int32> VertexOffsets;
+	VertexOffsets.SetNum(ChunksNum);
+	int32 VerticesNum = 0;
+	int32 IndicesNum = 0;
+	for (int32 ChunkIndex = 0; ChunkIndex < ChunksNum; ChunkIndex++)
+	{
+		VertexOffsets[ChunkIndex] = VerticesNum;
+		VerticesNum += Chunks[ChunkIndex].Vertices.Num();
+		IndicesNum += Chunks[ChunkIndex].Indices.Num();
+	}
+
+	VertexEdges.Reset(IsRecordingIncrementalData() ? VerticesNum : 0);
+	TriangleCubes.Reset(RestoreLegacyOrder || IsRecordingIncrementalData() ? IndicesNum / 3 : 0);
+	for (const FMarchingCubesChunk& Chunk : Chunks)
+	{
+		VertexEdges.Append(Chunk.VertexEdges);
+		TriangleCubes.Append(Chunk.TriangleCubes);
+	}
+
+	Vertices.SetNumUninitialized(VerticesNum);
+	Indices.SetNumUninitialized(IndicesNum);
+
+	int32 IndexOffset = 0;
+	for (int32 ChunkIndex = 0; ChunkIndex < ChunksNum; ChunkIndex++)
+	{
+		const FMarchingCubesChunk& Chunk = Chunks[ChunkIndex];
+		FMemory::Memcpy(Vertices.GetData() + VertexOffsets[ChunkIndex], Chunk.Vertices.GetData(), Chunk.Vertices.Num() * sizeof(FVector));
+
+		const int32 VertexOffset = VertexOffsets[ChunkIndex];
+		for (int32 Index = 0; Index < Chunk.Indices.Num(); Index++)
+		{
+			int32 VertexIndex = Chunk.Indices[Index];
+			if (VertexIndex < 0)
+			{
+				// Bottom plane edge, every intersected edge of the plane was already created by top layer of previous chunk
+				const FMarchingCubesChunk& PrevChunk = Chunks[ChunkIndex - 1];
+				VertexIndex = PrevChunk.EdgeSlabs.GetSlab(PrevChunk.EndLayer)[FMarchingCubesChunk::DecodeSharedEdge(VertexIndex)];
+				check(VertexIndex >= 0);
+				VertexIndex += VertexOffsets[ChunkIndex - 1];
+			}
+			else
+			{
+				VertexIndex += VertexOffset;
+			}
+			Indices[IndexOffset + Index] = VertexIndex;
+		}
+		IndexOffset += Chunk.Indices.Num();
+	}
 }
 
-bool FMarchingCubesBuilder::GetBoundaryEdges(TArray<FIndexEdge>& OutEdges) const
+void FMarchingCubesBuilder::FindActiveBlocks()
 {
-	if (!BoundaryEdgesCalculated) return false;
-	OutEdges = BoundaryEdges;
-	return true;
+	const FIntVector CubesNum = Dimensions - FIntVector(1);
+	const FIntVector ExpectedBlocksNum = FIntVector(
+		FMath::DivideAndRoundUp(CubesNum.X, FDensityBlockPyramid::BlockSize),
+		FMath::DivideAndRoundUp(CubesNum.Y, FDensityBlockPyramid::BlockSize),
+		FMath::DivideAndRoundUp(CubesNum.Z, FDensityBlockPyramid::BlockSize));
+
+	const FDensityBlockPyramid* Pyramid = BlockPyramid;
+	if (Pyramid != nullptr && Pyramid->GetBlocksNum() != ExpectedBlocksNum)
+	{
+		UE_LOG(MarchingCubesBuilder, Warning, TEXT("Block pyramid does not match grid dimensions. Building own pyramid"));
+		Pyramid = nullptr;
+	}
+	if (Pyramid == nullptr)
+	{
+		// Densities may have changed since previous build, own pyramid is not reused
+		OwnedBlockPyramid.Build(Grid);
+		Pyramid = &OwnedBlockPyramid;
+	}
+
+	BlocksNum = Pyramid->GetBlocksNum();
+	const int32 ActiveNum = Pyramid->GetActiveBlocks(SurfaceLevel, ActiveBlocks);
+
+	UE_LOG(MarchingCubesBuilder, Verbose, TEXT("Blocks with surface: %d of %d"), ActiveNum, BlocksNum.X * BlocksNum.Y * BlocksNum.Z);
 }
 
-bool FMarchingCubesBuilder::GetInnerEdges(TArray<FIndexEdge>& OutEdges) const
+void FMarchingCubesBuilder::ClassifyPoints()
 {
-	if (!BoundaryEdgesCalculated) return false;
-	OutEdges = InnerEdges;
-	return true;
+	const int32 RowsNum = Dimensions.Y * Dimensions.Z;
+	MaskWordsPerRow = (Dimensions.X + 63) / 64;
+
+	InsideMask.SetNumUninitialized(RowsNum * MaskWordsPerRow);
+
+	// Occupancy bits are already inside mask for any level between 0 and 1
+	if (Grid.OccupancyWords && SurfaceLevel >= 0.f && SurfaceLevel < 1.f)
+	{
+		static_assert(sizeof(InsideMask[0]) == sizeof(Grid.OccupancyWords[0]), "Mask word must match occupancy word");
+		FMemory::Memcpy(InsideMask.GetData(), Grid.OccupancyWords, RowsNum * MaskWordsPerRow * sizeof(uint64));
+		return;
+	}
+
+	ParallelFor(Dimensions.Z, [this](int32 Z)
+	{
+		const VectorRegister SurfaceLevelVec = VectorSetFloat1(SurfaceLevel);
+
+		// Quantized densities are expanded row by row
+		TArray<float> RowBuffer;
+		if (Grid.Densities == nullptr)
+		{
+			RowBuffer.SetNumUninitialized(Dimensions.X);
+		}
+
+		for (int32 Y = 0; Y < Dimensions.Y; Y++)
+		{
+			const int32 Row = Y + Z * Dimensions.Y;
+			const int32 RowStart = Row * Dimensions.X;
+
+			const float* RowDensities = Grid.Densities ? Grid.Densities + RowStart : RowBuffer.GetData();
+
+			uint64* RowMask = InsideMask.GetData() + Row * MaskWordsPerRow;
+			FMemory::Memzero(RowMask, MaskWordsPerRow * sizeof(uint64));
+
+			// Classify points [XBegin, XEnd). XBegin must be multiple of 4, so groups never cross word boundary
+			auto ClassifyRange = [&](int32 XBegin, int32 XEnd)
+			{
+				if (Grid.Densities == nullptr)
+				{
+					for (int32 X = XBegin; X < XEnd; X++)
+					{
+						RowBuffer[X] = Grid.GetDensity(RowStart + X);
+					}
+				}
+
+				int32 X = XBegin;
+				for (; X + 4 <= XEnd; X += 4)
+				{
+					const uint64 Bits = VectorMaskBits(VectorCompareGT(VectorLoad(RowDensities + X), SurfaceLevelVec));
+					RowMask[X / 64] |= Bits << (X % 64);
+				}
+				for (; X < XEnd; X++)
+				{
+					RowMask[X / 64] |= uint64(RowDensities[X] > SurfaceLevel) << (X % 64);
+				}
+			};
+
+			if (ActiveBlocks.Num() == 0)
+			{
+				ClassifyRange(0, Dimensions.X);
+				continue;
+			}
+
+			// Points on block border belong to both neighbouring blocks
+			const int32 BlockSize = FDensityBlockPyramid::BlockSize;
+			const int32 BlocksY[2] = { Y / BlockSize, (Y % BlockSize == 0) ? Y / BlockSize - 1 : INDEX_NONE };
+			const int32 BlocksZ[2] = { Z / BlockSize, (Z % BlockSize == 0) ? Z / BlockSize - 1 : INDEX_NONE };
+
+			for (int32 BlockX = 0; BlockX < BlocksNum.X; BlockX++)
+			{
+				bool bActive = false;
+				for (int32 BlockY : BlocksY)
+				{
+					for (int32 BlockZ : BlocksZ)
+					{
+						if (BlockY >= 0 && BlockY < BlocksNum.Y && BlockZ >= 0 && BlockZ < BlocksNum.Z)
+						{
+							bActive |= ActiveBlocks[BlockX + BlocksNum.X * BlockY + BlocksNum.X * BlocksNum.Y * BlockZ] != 0;
+						}
+					}
+				}
+
+				if (bActive)
+				{
+					ClassifyRange(BlockX * BlockSize, FMath::Min(BlockX * BlockSize + BlockSize + 1, Dimensions.X));
+				}
+			}
+		}
+	}, !BuildInParallel);
 }
 
-void FMarchingCubesBuilder::CalcOuterEdges()
+void FMarchingCubesBuilder::GatherActiveCubes(int32 FirstLayer, int32 EndLayer, TArray<FMarchingCubesActiveCube>& OutCubes) const
 {
-	BoundaryEdges.Reset();
+	const int32 CubesX = Dimensions.X - 1;
+	const int32 BlockSize = FDensityBlockPyramid::BlockSize;
+
+	// Bits of cubes in blocks with surface, same layout as row of InsideMask
+	static_assert(64 % FDensityBlockPyramid::BlockSize == 0, "Block must not cross mask word");
+	TArray<uint64> BlocksMask;
+	BlocksMask.Init(~uint64(0), MaskWordsPerRow);
+
+	for (int32 Z = FirstLayer; Z < EndLayer; Z++)
+	{
+		for (int32 Y = 0; Y < Dimensions.Y - 1; Y++)
+		{
+			if (ActiveBlocks.Num() > 0)
+			{
+				bool bAnyActive = false;
+				FMemory::Memzero(BlocksMask.GetData(), MaskWordsPerRow * sizeof(uint64));
+				for (int32 BlockX = 0; BlockX < BlocksNum.X; BlockX++)
+				{
+					if (IsBlockActive(BlockX * BlockSize, Y, Z))
+					{
+						const int32 FirstBit = BlockX * BlockSize;
+						BlocksMask[FirstBit / 64] |= ((uint64(1) << BlockSize) - 1) << (FirstBit % 64);
+						bAnyActive = true;
+					}
+				}
+				if (!bAnyActive) continue;
+			}
+
+			// Rows of 4 cube edges parallel to X: (Y,Z), (Y+1,Z), (Y,Z+1), (Y+1,Z+1)
+			const uint64* Rows[4] =
+			{
+				InsideMask.GetData() + ((Y + 0) + (Z + 0) * Dimensions.Y) * MaskWordsPerRow,
+				InsideMask.GetData() + ((Y + 1) + (Z + 0) * Dimensions.Y) * MaskWordsPerRow,
+				InsideMask.GetData() + ((Y + 0) + (Z + 1) * Dimensions.Y) * MaskWordsPerRow,
+				InsideMask.GetData() + ((Y + 1) + (Z + 1) * Dimensions.Y) * MaskWordsPerRow
+			};
+
+			for (int32 Word = 0; Word < MaskWordsPerRow; Word++)
+			{
+				// Cube is active unless all 8 corners are inside or all are outside
+				uint64 Active = FOccupancyMask::GetMixedCubes(Rows, Word, MaskWordsPerRow) & BlocksMask[Word];
+
+				const int32 CubesInWord = CubesX - Word * 64;
+				if (CubesInWord < 64)
+				{
+					Active &= (uint64(1) << FMath::Max(CubesInWord, 0)) - 1;
+				}
+
+				if (Active == 0) continue;
+
+				// Indices of 8 cubes at once from shifted rows
+				uint64 Corners[8];
+				FOccupancyMask::GetCubeCorners(Rows, Word, MaskWordsPerRow, Corners);
+
+				for (int32 Byte = 0; Byte < 8; Byte++)
+				{
+					uint64 ActiveInByte = (Active >> (Byte * 8)) & 0xFF;
+					if (ActiveInByte == 0) continue;
+
+					const uint64 CubeIndices = FOccupancyMask::GetCubeIndices8(Corners, Byte);
+					while (ActiveInByte != 0)
+					{
+						const int32 Bit = (int32)FMath::CountTrailingZeros64(ActiveInByte);
+						ActiveInByte &= ActiveInByte - 1;
+
+						OutCubes.Emplace(FIntVector(Word * 64 + Byte * 8 + Bit, Y, Z), static_cast<uint8>(CubeIndices >> (Bit * 8)));
+					}
+				}
+			}
+		}
+	}
+}
 
-	TSet<FIndexEdge> InnerEdgesSet;
-	TSet<FIndexEdge> BoundaryEdgesSet;
+void FMarchingCubesBuilder::RestoreSweepOrder()
+{
+	const int32 TrianglesNum = TriangleCubes.Num();
+	if (TrianglesNum == 0) return;
 
-	auto CheckEdge = [&BoundaryEdgesSet, &InnerEdgesSet](const FIndexEdge& Edge)
+	// Triangles are sorted by Z, Y, X of cube. Stable counting sort by Y and then by X gives X, Y, Z order,
+	// triangles of one cube keep order of triangulation table
+	TArray<int32> Order;
+	TArray<int32> SortedOrder;
+	Order.SetNumUninitialized(TrianglesNum);
+	SortedOrder.SetNumUninitialized(TrianglesNum);
+	for (int32 Triangle = 0; Triangle < TrianglesNum; Triangle++)
 	{
-		bool IsBoundary = BoundaryEdgesSet.Contains(Edge);
-		bool IsInner = InnerEdgesSet.Contains(Edge);
+		Order[Triangle] = Triangle;
+	}
 
-		if (IsBoundary == false && IsInner == false) // this is unchecked edge
+	TArray<int32> Counts;
+	auto CountingSort = [&](int32 KeysNum, int32 Divisor)
+	{
+		Counts.Init(0, KeysNum + 1);
+		for (int32 Triangle : Order)
+		{
+			Counts[(TriangleCubes[Triangle] / Divisor) % KeysNum + 1]++;
+		}
+		for (int32 Key = 0; Key < KeysNum; Key++)
 		{
-			BoundaryEdgesSet.Add(Edge);
+			Counts[Key + 1] += Counts[Key];
 		}
-		else if (IsBoundary && IsInner == false) // edge is connected with another triangle
+		for (int32 Triangle : Order)
 		{
-			BoundaryEdgesSet.Remove(Edge);
-			InnerEdgesSet.Add(Edge);
+			SortedOrder[Counts[(TriangleCubes[Triangle] / Divisor) % KeysNum]++] = Triangle;
 		}
+		Swap(Order, SortedOrder);
 	};
+	CountingSort(Dimensions.Y, Dimensions.X);
+	CountingSort(Dimensions.X, 1);
 
-	for (int Index = 0; Index < Indices.Num(); Index += 3)
+	TArray<int32> SortedCubes;
+	SortedCubes.SetNumUninitialized(TrianglesNum);
+	for (int32 Triangle = 0; Triangle < TrianglesNum; Triangle++)
 	{
-		FIndexEdge Edge1(Indices[Index], Indices[Index + 1]);
-		FIndexEdge Edge2(Indices[Index + 1], Indices[Index + 2]);
-		FIndexEdge Edge3(Indices[Index + 2], Indices[Index]);
+		SortedCubes[Triangle] = TriangleCubes[Order[Triangle]];
+	}
+	TriangleCubes = MoveTemp(SortedCubes);
+
+	TArray<FVector> SortedVertices;
+	SortedVertices.Reserve(Vertices.Num());
 
-		CheckEdge(Edge1);
-		CheckEdge(Edge2);
-		CheckEdge(Edge3);
+	if (!RemoveDuplicateVertices)
+	{
+		// Every triangle owns its 3 vertices
+		for (int32 Triangle : Order)
+		{
+			SortedVertices.Append(&Vertices[Triangle * 3], 3);
+		}
+		Vertices = MoveTemp(SortedVertices);
+		return;
 	}
 
-	this->InnerEdges = InnerEdgesSet.Array();
-	this->BoundaryEdges = BoundaryEdgesSet.Array();
+	// Vertex was created by first triangle using it
+	const bool bRecordingEdges = VertexEdges.Num() == Vertices.Num();
+	TArray<int32> SortedVertexEdges;
+	SortedVertexEdges.Reserve(VertexEdges.Num());
 
-	BoundaryEdgesCalculated = true;
+	TArray<int32> VertexRemap;
+	VertexRemap.Init(INDEX_NONE, Vertices.Num());
+
+	TArray<int32> SortedIndices;
+	SortedIndices.SetNumUninitialized(Indices.Num());
+	int32 IndexOffset = 0;
+	for (int32 Triangle : Order)
+	{
+		for (int32 Corner = 0; Corner < 3; Corner++)
+		{
+			const int32 VertexIndex = Indices[Triangle * 3 + Corner];
+			int32& NewIndex = VertexRemap[VertexIndex];
+			if (NewIndex == INDEX_NONE)
+			{
+				NewIndex = SortedVertices.Add(Vertices[VertexIndex]);
+				if (bRecordingEdges)
+				{
+					SortedVertexEdges.Add(VertexEdges[VertexIndex]);
+				}
+			}
+			SortedIndices[IndexOffset++] = NewIndex;
+		}
+	}
+
+	Vertices = MoveTemp(SortedVertices);
+	Indices = MoveTemp(SortedIndices);
+	if (bRecordingEdges)
+	{
+		VertexEdges = MoveTemp(SortedVertexEdges);
+	}
 }
 
-void FMarchingCubesBuilder::CollapseCoplanarTriangles()
-{	
-	if (!BoundaryEdgesCalculated)
+void FMarchingCubesBuilder::InitIncrementalData()
+{
+	FreeVertices.Empty();
+	FreeTriangles.Empty();
+
+	EdgeSlotsValid = false;
+	BoundaryEdgeSlots.Empty();
+	InnerEdgeSlots.Empty();
+
+	IncrementalDataValid = IsRecordingIncrementalData();
+	if (!IncrementalDataValid)
 	{
-		CalcOuterEdges();
+		VertexEdges.Empty();
+		TriangleCubes.Empty();
+		VertexUseCount.Empty();
+		BlockTriangles.Empty();
+		return;
 	}
 
-	struct FTriangle
+	VertexUseCount.Init(0, Vertices.Num());
+	for (int32 VertexIndex : Indices)
 	{
-		int32 Vertices[3];
-		FTriangle(int32 A, int32 B, int32 C) 
-		{ 
-			Vertices[0] = A; 
-			Vertices[1] = B;
-			Vertices[2] = C;
-		}
+		VertexUseCount[VertexIndex]++;
+	}
 
-		int32 GetOppositeVertice(const FIndexEdge& Edge) const
-		{
-			if (Vertices[0] != Edge.A && Vertices[0] != Edge.B) return Vertices[0];
-			else if (Vertices[1] != Edge.A && Vertices[1] != Edge.B) return Vertices[1];
-			else  return Vertices[2]; 
-			//(Vertices[2] != Edge.A && Vertices[2] != Edge.B)
-		}
-	};
+	const int32 BlockSize = FDensityBlockPyramid::BlockSize;
+	TriangleBlocksNum = FIntVector(
+		FMath::Max(FMath::DivideAndRoundUp(Dimensions.X - 1, BlockSize), 1),
+		FMath::Max(FMath::DivideAndRoundUp(Dimensions.Y - 1, BlockSize), 1),
+		FMath::Max(FMath::DivideAndRoundUp(Dimensions.Z - 1, BlockSize), 1));
 
-	TArray<int32> OuterVertsArr;
-	GetOuterVertices(OuterVertsArr);
-	TSet<int32> OuterVertices(OuterVertsArr);
+	BlockTriangles.Reset();
+	BlockTriangles.SetNum(TriangleBlocksNum.X * TriangleBlocksNum.Y * TriangleBlocksNum.Z);
+	for (int32 Triangle = 0; Triangle < TriangleCubes.Num(); Triangle++)
+	{
+		BlockTriangles[GetTriangleBlock(TriangleCubes[Triangle])].Add(Triangle);
+	}
+}
 
-	TMap<FIndexEdge, TArray<int32>> EdgeToTriangleMap;
-	TArray<FTriangle> Triangles;
-	for (int Index = 0; Index < Indices.Num() ; Index+=3)
+void FMarchingCubesBuilder::MarkDirty(const FIntVector& MinPoint, const FIntVector& MaxPoint)
+{
+	if (HasDirtyRegion)
 	{
-		int32 A = Indices[Index];
-		int32 B = Indices[Index + 1];
-		int32 C = Indices[Index + 2];
-		int32 TriangleIndex = Triangles.Add(FTriangle(A, B, C));
+		DirtyMin = FIntVector(FMath::Min(DirtyMin.X, MinPoint.X), FMath::Min(DirtyMin.Y, MinPoint.Y), FMath::Min(DirtyMin.Z, MinPoint.Z));
+		DirtyMax = FIntVector(FMath::Max(DirtyMax.X, MaxPoint.X), FMath::Max(DirtyMax.Y, MaxPoint.Y), FMath::Max(DirtyMax.Z, MaxPoint.Z));
+	}
+	else
+	{
+		DirtyMin = MinPoint;
+		DirtyMax = MaxPoint;
+		HasDirtyRegion = true;
+	}
+}
 
-		EdgeToTriangleMap.FindOrAdd(FIndexEdge(A, B)).Add(TriangleIndex);
-		EdgeToTriangleMap.FindOrAdd(FIndexEdge(B, C)).Add(TriangleIndex);
-		EdgeToTriangleMap.FindOrAdd(FIndexEdge(C, A)).Add(TriangleIndex);
+void FMarchingCubesBuilder::UpdateDirtyRegion()
+{
+	if (!HasDirtyRegion || !IsValid()) return;
+
+	if (!IncrementalDataValid)
+	{
+		UE_LOG(MarchingCubesBuilder, Log, TEXT("No incremental data, rebuilding whole mesh"));
+		Build();
+		return;
 	}
+	HasDirtyRegion = false;
+
+	// Every cube that has dirty point as corner
+	const FIntVector CubeMin = FIntVector(FMath::Max(DirtyMin.X - 1, 0), FMath::Max(DirtyMin.Y - 1, 0), FMath::Max(DirtyMin.Z - 1, 0));
+	const FIntVector CubeMax = FIntVector(FMath::Min(DirtyMax.X, Dimensions.X - 2), FMath::Min(DirtyMax.Y, Dimensions.Y - 2), FMath::Min(DirtyMax.Z, Dimensions.Z - 2));
+	if (CubeMin.X > CubeMax.X || CubeMin.Y > CubeMax.Y || CubeMin.Z > CubeMax.Z) return;
 
-	TMap<int32, int32> IndexRemap;
-	for (const FIndexEdge& Edge : InnerEdges)
+	// Triangles sharing edge with triangles of dirty cubes belong to neighbouring cubes
+	const FIntVector NeighbourMin = CubeMin - FIntVector(1);
+	const FIntVector NeighbourMax = CubeMax + FIntVector(1);
+
+	auto IsInBox = [](const FIntVector& Coords, const FIntVector& Min, const FIntVector& Max)
 	{
-		if(OuterVertices.Contains(Edge.A) || OuterVertices.Contains(Edge.B)) continue;
+		return Coords.X >= Min.X && Coords.Y >= Min.Y && Coords.Z >= Min.Z && Coords.X <= Max.X && Coords.Y <= Max.Y && Coords.Z <= Max.Z;
+	};
+
+	// Retire triangles of dirty cubes. Every edge intersected by surface is used by triangles of all its cubes,
+	// so vertices of retired triangles are all the vertices dirty cubes can reference
+	TMap<int32, int32> EdgeToVertex;
+	TSet<FIndexEdge> AffectedEdges;
+	TArray<int32> NeighbourTriangles;
+
+	// Only blocks overlapping neighbour box can hold triangles of dirty or neighbouring cubes
+	const int32 BlockSize = FDensityBlockPyramid::BlockSize;
+	const FIntVector BlockMin = FIntVector(FMath::Max(NeighbourMin.X, 0), FMath::Max(NeighbourMin.Y, 0), FMath::Max(NeighbourMin.Z, 0)) / BlockSize;
+	const FIntVector BlockMax = FIntVector(
+		FMath::Min(NeighbourMax.X / BlockSize, TriangleBlocksNum.X - 1),
+		FMath::Min(NeighbourMax.Y / BlockSize, TriangleBlocksNum.Y - 1),
+		FMath::Min(NeighbourMax.Z / BlockSize, TriangleBlocksNum.Z - 1));
 
-		TArray<int32> TriangleIndices = EdgeToTriangleMap[Edge];
-		if (TriangleIndices.Num() == 2)
+	for (int32 BlockZ = BlockMin.Z; BlockZ <= BlockMax.Z; BlockZ++)
+	{
+		for (int32 BlockY = BlockMin.Y; BlockY <= BlockMax.Y; BlockY++)
 		{
-			FTriangle Triangle1 = Triangles[TriangleIndices[0]];
-			FTriangle Triangle2 = Triangles[TriangleIndices[1]];
+			for (int32 BlockX = BlockMin.X; BlockX <= BlockMax.X; BlockX++)
+			{
+				TArray<int32>& Triangles = BlockTriangles[BlockX + TriangleBlocksNum.X * (BlockY + TriangleBlocksNum.Y * BlockZ)];
+				for (int32 Slot = Triangles.Num() - 1; Slot >= 0; Slot--)
+				{
+					const int32 Triangle = Triangles[Slot];
+					const int32 CubePointIndex = TriangleCubes[Triangle];
+
+					const FIntVector Coords(CubePointIndex % Dimensions.X, (CubePointIndex / Dimensions.X) % Dimensions.Y, CubePointIndex / (Dimensions.X * Dimensions.Y));
+					if (IsInBox(Coords, CubeMin, CubeMax))
+					{
+						int32* TriangleIndices = &Indices[Triangle * 3];
+						for (int32 Corner = 0; Corner < 3; Corner++)
+						{
+							const int32 VertexIndex = TriangleIndices[Corner];
+							EdgeToVertex.Add(VertexEdges[VertexIndex], VertexIndex);
+							VertexUseCount[VertexIndex]--;
+						}
+						if (BoundaryEdgesCalculated)
+						{
+							AffectedEdges.Add(FIndexEdge(TriangleIndices[0], TriangleIndices[1]));
+							AffectedEdges.Add(FIndexEdge(TriangleIndices[1], TriangleIndices[2]));
+							AffectedEdges.Add(FIndexEdge(TriangleIndices[2], TriangleIndices[0]));
+						}
+
+						TriangleIndices[0] = TriangleIndices[1] = TriangleIndices[2] = INDEX_NONE;
+						TriangleCubes[Triangle] = INDEX_NONE;
+						FreeTriangles.Add(Triangle);
+						Triangles.RemoveAtSwap(Slot, 1, false);
+					}
+					else if (BoundaryEdgesCalculated && IsInBox(Coords, NeighbourMin, NeighbourMax))
+					{
+						NeighbourTriangles.Add(Triangle);
+					}
+				}
+			}
+		}
+	}
 
-			FVector EdgeVertex1 = Vertices[Edge.A];
-			FVector EdgeVertex2 = Vertices[Edge.B];
+	TArray<int32> NewTriangles;
+	for (int32 Z = CubeMin.Z; Z <= CubeMax.Z; Z++)
+	{
+		for (int32 Y = CubeMin.Y; Y <= CubeMax.Y; Y++)
+		{
+			for (int32 X = CubeMin.X; X <= CubeMax.X; X++)
+			{
+				RepoligonizeCube(FIntVector(X, Y, Z), EdgeToVertex, NewTriangles);
+			}
+		}
+	}
 
-			FVector Triangle1Vertex = Vertices[Triangle1.GetOppositeVertice(Edge)];
-			FVector Triangle2Vertex = Vertices[Triangle2.GetOppositeVertice(Edge)];
+	// Vertices that lost all triangles
+	for (const TPair<int32, int32>& Pair : EdgeToVertex)
+	{
+		const int32 VertexIndex = Pair.Value;
+		if (VertexUseCount[VertexIndex] == 0 && VertexEdges[VertexIndex] != INDEX_NONE)
+		{
+			VertexEdges[VertexIndex] = INDEX_NONE;
+			FreeVertices.Add(VertexIndex);
+		}
+	}
 
-			FVector Triangle1_Normal = FVector::CrossProduct(EdgeVertex2 - EdgeVertex1, Triangle1Vertex - EdgeVertex1).GetSafeNormal();
-			FVector Triangle2_Normal = FVector::CrossProduct(EdgeVertex2 - EdgeVertex1, Triangle2Vertex - EdgeVertex1).GetSafeNormal();
+	if (BoundaryEdgesCalculated)
+	{
+		for (int32 Triangle : NewTriangles)
+		{
+			const int32* TriangleIndices = &Indices[Triangle * 3];
+			AffectedEdges.Add(FIndexEdge(TriangleIndices[0], TriangleIndices[1]));
+			AffectedEdges.Add(FIndexEdge(TriangleIndices[1], TriangleIndices[2]));
+			AffectedEdges.Add(FIndexEdge(TriangleIndices[2], TriangleIndices[0]));
+		}
 
-			if(Triangle1_Normal.IsNearlyZero() || Triangle2_Normal.IsNearlyZero()) continue;
+		// Count triangles of every affected edge, only new and neighbouring triangles can have them
+		TMap<FIndexEdge, int32> EdgeUseCount;
+		auto CountEdges = [this, &AffectedEdges, &EdgeUseCount](const TArray<int32>& Triangles)
+		{
+			for (int32 Triangle : Triangles)
+			{
+				const int32* TriangleIndices = &Indices[Triangle * 3];
+				const FIndexEdge TriangleEdges[3] = 
+				{
+					FIndexEdge(TriangleIndices[0], TriangleIndices[1]),
+					FIndexEdge(TriangleIndices[1], TriangleIndices[2]),
+					FIndexEdge(TriangleIndices[2], TriangleIndices[0])
+				};
+				for (const FIndexEdge& Edge : TriangleEdges)
+				{
+					if (AffectedEdges.Contains(Edge))
+					{
+						EdgeUseCount.FindOrAdd(Edge)++;
+					}
+				}
+			}
+		};
+		CountEdges(NewTriangles);
+		CountEdges(NeighbourTriangles);
 
-			float Dot = FVector::DotProduct(Triangle2_Normal, Triangle1_Normal);
-			
-			if (FMath::Abs(Dot) > 0.9f)
+		if (!EdgeSlotsValid)
+		{
+			BoundaryEdgeSlots.Reset();
+			InnerEdgeSlots.Reset();
+			for (int32 Slot = 0; Slot < BoundaryEdges.Num(); Slot++)
 			{
-				FVector Midpoint = EdgeVertex1 + (EdgeVertex2 - EdgeVertex1) / 2;				
+				BoundaryEdgeSlots.Add(BoundaryEdges[Slot], Slot);
+			}
+			for (int32 Slot = 0; Slot < InnerEdges.Num(); Slot++)
+			{
+				InnerEdgeSlots.Add(InnerEdges[Slot], Slot);
+			}
+			EdgeSlotsValid = true;
+		}
 
-				Vertices[Edge.A] = Midpoint;
+		auto RemoveEdge = [](const FIndexEdge& Edge, TArray<FIndexEdge>& Edges, TMap<FIndexEdge, int32>& Slots)
+		{
+			int32 Slot;
+			if (!Slots.RemoveAndCopyValue(Edge, Slot)) return;
+
+			Edges.RemoveAtSwap(Slot, 1, false);
+			if (Slot < Edges.Num())
+			{
+				Slots[Edges[Slot]] = Slot;
+			}
+		};
+		for (const FIndexEdge& Edge : AffectedEdges)
+		{
+			RemoveEdge(Edge, BoundaryEdges, BoundaryEdgeSlots);
+			RemoveEdge(Edge, InnerEdges, InnerEdgeSlots);
+		}
 
-				IndexRemap.Add(Edge.B, Edge.A);
+		for (const TPair<FIndexEdge, int32>& Pair : EdgeUseCount)
+		{
+			if (Pair.Value == 1)
+			{
+				BoundaryEdgeSlots.Add(Pair.Key, BoundaryEdges.Add(Pair.Key));
 			}
+			else
+			{
+				InnerEdgeSlots.Add(Pair.Key, InnerEdges.Add(Pair.Key));
+			}
+		}
+	}
+
+	// Only vertices of new triangles got positions from densities again, and only those on face with coarser neighbour move
+	bool TouchesTransitionFace = false;
+	for (int32 Face = 0; Face < 6; Face++)
+	{
+		const int32 Axis = Face / 2;
+		const bool CubesOnFace = (Face & 1) ? CubeMax[Axis] == Dimensions[Axis] - 2 : CubeMin[Axis] == 0;
+		TouchesTransitionFace |= CubesOnFace && NeighbourLODStride[Face] > 1;
+	}
+	if (TouchesTransitionFace)
+	{
+		TSet<int32> NewVertices;
+		for (int32 Triangle : NewTriangles)
+		{
+			NewVertices.Add(Indices[Triangle * 3]);
+			NewVertices.Add(Indices[Triangle * 3 + 1]);
+			NewVertices.Add(Indices[Triangle * 3 + 2]);
 		}
+		const TArray<int32> ConformedVertices = NewVertices.Array();
+		ConformTransitionFaces(&ConformedVertices);
 	}
 
-	for (int Index = 0; Index < Indices.Num() ; Index++)
+	UE_LOG(MarchingCubesBuilder, Log, TEXT("Updated region. Cubes: %d, New triangles: %d, Free vertices: %d, Free triangles: %d"), 
+		(CubeMax.X - CubeMin.X + 1) * (CubeMax.Y - CubeMin.Y + 1) * (CubeMax.Z - CubeMin.Z + 1), NewTriangles.Num(), FreeVertices.Num(), FreeTriangles.Num());
+}
+
+void FMarchingCubesBuilder::RepoligonizeCube(const FIntVector& CubeCoords, TMap<int32, int32>& EdgeToVertex, TArray<int32>& OutNewTriangles)
+{
+	uint8 cubeindex = 0;
+	for (int Index = 0; Index < 8; Index++)
 	{
-		const int32* find = IndexRemap.Find(Indices[Index]);
-		if (find)
+		if (GetDensity(CubeCoords + CubeCorners[Index]) > SurfaceLevel)
 		{
-			Indices[Index] = *find;
+			cubeindex |= 1 << Index;
 		}
 	}
+	if (EdgeTable[cubeindex] == 0) return;
+
+	const int32 CubePointIndex = Grid.GetPointIndex(CubeCoords.X, CubeCoords.Y, CubeCoords.Z);
+	const FMarchingCubesCase& Case = CaseTable[cubeindex];
+	for (int i = 0; i < Case.TriangleNum * 3; i += 3)
+	{
+		int32 Triangle;
+		if (FreeTriangles.Num() > 0)
+		{
+			Triangle = FreeTriangles.Pop(false);
+		}
+		else
+		{
+			Triangle = TriangleCubes.Add(INDEX_NONE);
+			Indices.AddUninitialized(3);
+		}
+		TriangleCubes[Triangle] = CubePointIndex;
+		BlockTriangles[GetTriangleBlock(CubePointIndex)].Add(Triangle);
+		OutNewTriangles.Add(Triangle);
+
+		for (int32 Corner = 0; Corner < 3; Corner++)
+		{
+			const int LocalEdgeIndex = Case.GetEdge(i + Corner);
+			const int32 GlobalEdgeIndex = GetEdgeIndexGlobal(CubeCoords, LocalEdgeIndex);
+			const FVector Vertex = VertexLerp(SurfaceLevel, GetPoint(CubeCoords + CubeCorners[Edges[LocalEdgeIndex][0]]), GetPoint(CubeCoords + CubeCorners[Edges[LocalEdgeIndex][1]]));
 
+			int32 VertexIndex;
+			if (const int32* Found = EdgeToVertex.Find(GlobalEdgeIndex))
+			{
+				VertexIndex = *Found;
+			}
+			else
+			{
+				if (FreeVertices.Num() > 0)
+				{
+					VertexIndex = FreeVertices.Pop(false);
+				}
+				else
+				{
+					VertexIndex = Vertices.AddUninitialized();
+					VertexEdges.Add(INDEX_NONE);
+					VertexUseCount.Add(0);
+				}
+				EdgeToVertex.Add(GlobalEdgeIndex, VertexIndex);
+			}
+
+			// Position changes if density of edge end changed
+			Vertices[VertexIndex] = Vertex;
+			VertexEdges[VertexIndex] = GlobalEdgeIndex;
+			VertexUseCount[VertexIndex]++;
+			Indices[Triangle * 3 + Corner] = VertexIndex;
+		}
+	}
 }
 
+void FMarchingCubesBuilder::ConformTransitionFaces(const TArray<int32>* VertexIndices)
+{
+	for (int32 Face = 0; Face < 6; Face++)
+	{
+		const int32 Stride = NeighbourLODStride[Face];
+		if (Stride <= 1) continue;
+
+		const int32 Axis = Face / 2;
+		const int32 U = (Axis + 1) % 3;
+		const int32 V = (Axis + 2) % 3;
+		if ((Dimensions[U] - 1) % Stride != 0 || (Dimensions[V] - 1) % Stride != 0)
+		{
+			UE_LOG(MarchingCubesBuilder, Warning, TEXT("Face %d can not be conformed, dimensions are not divisible by stride %d"), Face, Stride);
+			continue;
+		}
+
+		FIntVector PlanePoint = FIntVector::ZeroValue;
+		PlanePoint[Axis] = (Face & 1) ? Dimensions[Axis] - 1 : 0;
+		// Vertices of face edges are lerped between points with same coordinate, so it is exact
+		const float PlaneCoord = GetPoint(PlanePoint)[Axis];
 
+		const int32 SquaresU = (Dimensions[U] - 1) / Stride;
+		const int32 SquaresV = (Dimensions[V] - 1) / Stride;
 
+		// Marching squares outline of coarse square, crossing of side I is between corners I and I + 1
+		auto AddSquareSegments = [&](int32 SquareU, int32 SquareV, TArray<TPair<FVector, FVector>, TInlineAllocator<18>>& OutSegments)
+		{
+			// Corners of coarse square in winding order
+			FVector4 Corners[4];
+			const int32 CornerOffsets[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+			for (int32 Corner = 0; Corner < 4; Corner++)
+			{
+				FIntVector Coords = PlanePoint;
+				Coords[U] = (SquareU + CornerOffsets[Corner][0]) * Stride;
+				Coords[V] = (SquareV + CornerOffsets[Corner][1]) * Stride;
+				Corners[Corner] = GetPoint(Coords);
+			}
+
+			FVector Crossings[4];
+			bool Crossed[4];
+			int32 CrossedNum = 0;
+			for (int32 Side = 0; Side < 4; Side++)
+			{
+				const FVector4& A = Corners[Side];
+				const FVector4& B = Corners[(Side + 1) % 4];
+				Crossed[Side] = (A.W > SurfaceLevel) != (B.W > SurfaceLevel);
+				if (Crossed[Side])
+				{
+					Crossings[Side] = VertexLerp(SurfaceLevel, A, B);
+					CrossedNum++;
+				}
+			}
+
+			if (CrossedNum == 2)
+			{
+				int32 First = INDEX_NONE;
+				for (int32 Side = 0; Side < 4; Side++)
+				{
+					if (!Crossed[Side]) continue;
+					if (First == INDEX_NONE)
+					{
+						First = Side;
+					}
+					else
+					{
+						OutSegments.Emplace(Crossings[First], Crossings[Side]);
+					}
+				}
+			}
+			else if (CrossedNum == 4)
+			{
+				// Saddle, center connects to corners of same side
+				const float CenterDensity = (Corners[0].W + Corners[1].W + Corners[2].W + Corners[3].W) * 0.25f;
+				if ((CenterDensity > SurfaceLevel) == (Corners[0].W > SurfaceLevel))
+				{
+					OutSegments.Emplace(Crossings[0], Crossings[1]);
+					OutSegments.Emplace(Crossings[2], Crossings[3]);
+				}
+				else
+				{
+					OutSegments.Emplace(Crossings[3], Crossings[0]);
+					OutSegments.Emplace(Crossings[1], Crossings[2]);
+				}
+			}
+		};
+
+		// Crossing of coarse square side from fine point Start to Stride points further along Axis, if side is crossed
+		auto GetSideCrossing = [&](const FIntVector& Start, int32 SideAxis, FVector& OutCrossing)
+		{
+			FIntVector End = Start;
+			End[SideAxis] += Stride;
+			const FVector4 A = GetPoint(Start);
+			const FVector4 B = GetPoint(End);
+			if ((A.W > SurfaceLevel) == (B.W > SurfaceLevel)) return false;
+
+			OutCrossing = VertexLerp(SurfaceLevel, A, B);
+			return true;
+		};
+
+		// Average of fine surface crossings on face edges inside coarse square. Whole fine outline of feature
+		// missing in coarse grid collapses to it. Computed from densities, so it does not depend on which vertices are conformed
+		TMap<int32, FVector> OutlineCenters;
+		auto GetFineOutlineCenter = [&](int32 SquareU, int32 SquareV)
+		{
+			if (const FVector* Found = OutlineCenters.Find(SquareU + SquareV * SquaresU))
+			{
+				return *Found;
+			}
+
+			FVector Sum = FVector::ZeroVector;
+			int32 CrossingsNum = 0;
+			for (int32 OffsetV = 0; OffsetV <= Stride; OffsetV++)
+			{
+				for (int32 OffsetU = 0; OffsetU <= Stride; OffsetU++)
+				{
+					FIntVector Coords = PlanePoint;
+					Coords[U] = SquareU * Stride + OffsetU;
+					Coords[V] = SquareV * Stride + OffsetV;
+					const FVector4 Point = GetPoint(Coords);
+					for (int32 EdgeAxis : { U, V })
+					{
+						// Edges along both axes starting at point, last point of row has none
+						if ((EdgeAxis == U ? OffsetU : OffsetV) == Stride) continue;
+
+						FIntVector EndCoords = Coords;
+						EndCoords[EdgeAxis]++;
+						const FVector4 End = GetPoint(EndCoords);
+						if ((Point.W > SurfaceLevel) != (End.W > SurfaceLevel))
+						{
+							Sum += VertexLerp(SurfaceLevel, Point, End);
+							CrossingsNum++;
+						}
+					}
+				}
+			}
+
+			FVector Center = Grid.Origin;
+			Center[U] = Grid.Origin[U] + (SquareU + 0.5f) * Grid.VoxelSize[U] * Stride;
+			Center[V] = Grid.Origin[V] + (SquareV + 0.5f) * Grid.VoxelSize[V] * Stride;
+			if (CrossingsNum > 0)
+			{
+				Center = Sum / CrossingsNum;
+			}
+			OutlineCenters.Add(SquareU + SquareV * SquaresU, Center);
+			return Center;
+		};
+
+		auto ConformVertex = [&](FVector& Vertex)
+		{
+			if (Vertex[Axis] != PlaneCoord) return;
+
+			// Fine grid line of vertex. Face vertices are lerped between points of one line, so coordinate across line is exact
+			const int32 LineU = FMath::RoundToInt((Vertex[U] - Grid.Origin[U]) / Grid.VoxelSize[U]);
+			const int32 LineV = FMath::RoundToInt((Vertex[V] - Grid.Origin[V]) / Grid.VoxelSize[V]);
+			const bool OnLineU = Vertex[U] == Grid.Origin[U] + LineU * Grid.VoxelSize[U];
+			const bool OnLineV = Vertex[V] == Grid.Origin[V] + LineV * Grid.VoxelSize[V];
+
+			const int32 SquareU = FMath::Clamp(FMath::FloorToInt((Vertex[U] - Grid.Origin[U]) / (Grid.VoxelSize[U] * Stride)), 0, SquaresU - 1);
+			const int32 SquareV = FMath::Clamp(FMath::FloorToInt((Vertex[V] - Grid.Origin[V]) / (Grid.VoxelSize[V] * Stride)), 0, SquaresV - 1);
+
+			// Vertex on side of coarse square takes crossing of that side, so outlines of adjacent squares meet in same point
+			FVector Closest = Vertex;
+			bool Snapped = false;
+			if (OnLineV && LineV % Stride == 0)
+			{
+				FIntVector Start = PlanePoint;
+				Start[U] = SquareU * Stride;
+				Start[V] = LineV;
+				Snapped = GetSideCrossing(Start, U, Closest);
+			}
+			if (!Snapped && OnLineU && LineU % Stride == 0)
+			{
+				FIntVector Start = PlanePoint;
+				Start[U] = LineU;
+				Start[V] = SquareV * Stride;
+				Snapped = GetSideCrossing(Start, V, Closest);
+			}
+
+			if (!Snapped)
+			{
+				TArray<TPair<FVector, FVector>, TInlineAllocator<18>> Segments;
+				AddSquareSegments(SquareU, SquareV, Segments);
+
+				// Fine surface crosses face where coarse one does not. Snap to outline of neighbouring squares if there is one
+				if (Segments.Num() == 0)
+				{
+					for (int32 OffsetV = -1; OffsetV <= 1; OffsetV++)
+					{
+						for (int32 OffsetU = -1; OffsetU <= 1; OffsetU++)
+						{
+							const int32 NeighbourU = SquareU + OffsetU;
+							const int32 NeighbourV = SquareV + OffsetV;
+							if ((OffsetU != 0 || OffsetV != 0) && NeighbourU >= 0 && NeighbourU < SquaresU && NeighbourV >= 0 && NeighbourV < SquaresV)
+							{
+								AddSquareSegments(NeighbourU, NeighbourV, Segments);
+							}
+						}
+					}
+				}
+
+				if (Segments.Num() == 0)
+				{
+					// Feature is smaller than coarse square, its outline collapses and opening closes
+					Closest = GetFineOutlineCenter(SquareU, SquareV);
+				}
+
+				float ClosestDistSquared = TNumericLimits<float>::Max();
+				for (const TPair<FVector, FVector>& Segment : Segments)
+				{
+					const FVector Point = FMath::ClosestPointOnSegment(Vertex, Segment.Key, Segment.Value);
+					const float DistSquared = FVector::DistSquared(Point, Vertex);
+					if (DistSquared < ClosestDistSquared)
+					{
+						ClosestDistSquared = DistSquared;
+						Closest = Point;
+					}
+				}
+			}
+			Closest[Axis] = PlaneCoord;
+			Vertex = Closest;
+		};
+
+		if (VertexIndices != nullptr)
+		{
+			for (int32 VertexIndex : *VertexIndices)
+			{
+				ConformVertex(Vertices[VertexIndex]);
+			}
+		}
+		else
+		{
+			for (FVector& Vertex : Vertices)
+			{
+				ConformVertex(Vertex);
+			}
+		}
+	}
+}
+
+void FMarchingCubesBuilder::GetCompactVertexRemap(TArray<int32>& OutRemap) const
+{
+	OutRemap.Reset();
+	if (!IncrementalDataValid || FreeVertices.Num() == 0) return;
+
+	// Retired vertex has no edge and is not used by any triangle or boundary/inner edge
+	OutRemap.SetNumUninitialized(Vertices.Num());
+	int32 VerticesNum = 0;
+	for (int32 VertexIndex = 0; VertexIndex < Vertices.Num(); VertexIndex++)
+	{
+		OutRemap[VertexIndex] = VertexEdges[VertexIndex] != INDEX_NONE ? VerticesNum++ : INDEX_NONE;
+	}
+}
+
+void FMarchingCubesBuilder::CopyLiveIndices(const TArray<int32>& VertexRemap, TArray<int32>& OutIndices) const
+{
+	if (FreeTriangles.Num() == 0 && VertexRemap.Num() == 0)
+	{
+		OutIndices = Indices;
+		return;
+	}
+
+	// Skip retired triangles
+	OutIndices.Reset(Indices.Num() - FreeTriangles.Num() * 3);
+	for (int32 Index = 0; Index < Indices.Num(); Index += 3)
+	{
+		if (Indices[Index] == INDEX_NONE) continue;
+
+		for (int32 Corner = 0; Corner < 3; Corner++)
+		{
+			OutIndices.Add(VertexRemap.Num() > 0 ? VertexRemap[Indices[Index + Corner]] : Indices[Index + Corner]);
+		}
+	}
+}
+
+void FMarchingCubesBuilder::RemapEdges(const TArray<int32>& VertexRemap, TArray<FIndexEdge>& Edges)
+{
+	if (VertexRemap.Num() == 0) return;
+
+	for (FIndexEdge& Edge : Edges)
+	{
+		Edge.A = VertexRemap[Edge.A];
+		Edge.B = VertexRemap[Edge.B];
+	}
+}
+
+void FMarchingCubesBuilder::GetData(TArray<FVector>& OutVertices, TArray<int32>& OutIndices) const
+{
+	TArray<int32> VertexRemap;
+	GetCompactVertexRemap(VertexRemap);
+
+	if (VertexRemap.Num() == 0)
+	{
+		OutVertices = Vertices;
+	}
+	else
+	{
+		OutVertices.Reset(Vertices.Num() - FreeVertices.Num());
+		for (int32 VertexIndex = 0; VertexIndex < Vertices.Num(); VertexIndex++)
+		{
+			if (VertexRemap[VertexIndex] != INDEX_NONE)
+			{
+				OutVertices.Add(Vertices[VertexIndex]);
+			}
+		}
+	}
+
+	CopyLiveIndices(VertexRemap, OutIndices);
+}
+
+void FMarchingCubesBuilder::GetQuantizedData(TArray<FQuantizedVector>& OutVertices, TArray<int32>& OutIndices, FVectorQuantizer& OutQuantizer) const
+{
+	// Every vertex lies on grid edge, so grid bounds hold all of them
+	const FBox GridBox(Grid.Origin, Grid.GetPosition(Dimensions.X - 1, Dimensions.Y - 1, Dimensions.Z - 1));
+	OutQuantizer = FVectorQuantizer(GridBox);
+
+	TArray<int32> VertexRemap;
+	GetCompactVertexRemap(VertexRemap);
+
+	OutVertices.Reset(Vertices.Num() - (VertexRemap.Num() > 0 ? FreeVertices.Num() : 0));
+	for (int32 Index = 0; Index < Vertices.Num(); Index++)
+	{
+		if (VertexRemap.Num() == 0 || VertexRemap[Index] != INDEX_NONE)
+		{
+			OutVertices.Add(OutQuantizer.Encode(Vertices[Index]));
+		}
+	}
+
+	CopyLiveIndices(VertexRemap, OutIndices);
+}
+
+void FMarchingCubesBuilder::TakeData(TArray<FVector>& OutVertices, TArray<int32>& OutIndices)
+{
+	TArray<int32> VertexRemap;
+	GetCompactVertexRemap(VertexRemap);
+
+	if (FreeTriangles.Num() > 0 || VertexRemap.Num() > 0)
+	{
+		// Skip retired triangles
+		int32 IndicesNum = 0;
+		for (int32 Index = 0; Index < Indices.Num(); Index += 3)
+		{
+			if (Indices[Index] == INDEX_NONE) continue;
+
+			for (int32 Corner = 0; Corner < 3; Corner++)
+			{
+				Indices[IndicesNum++] = VertexRemap.Num() > 0 ? VertexRemap[Indices[Index + Corner]] : Indices[Index + Corner];
+			}
+		}
+		Indices.SetNum(IndicesNum, false);
+	}
+
+	if (VertexRemap.Num() > 0)
+	{
+		// Remap only moves vertices down, so compaction is done in place
+		for (int32 VertexIndex = 0; VertexIndex < Vertices.Num(); VertexIndex++)
+		{
+			if (VertexRemap[VertexIndex] != INDEX_NONE)
+			{
+				Vertices[VertexRemap[VertexIndex]] = Vertices[VertexIndex];
+			}
+		}
+		Vertices.SetNum(Vertices.Num() - FreeVertices.Num(), false);
+
+		// Edges stay until taken, keep them matching taken vertices
+		RemapEdges(VertexRemap, BoundaryEdges);
+		RemapEdges(VertexRemap, InnerEdges);
+	}
+
+	OutVertices = MoveTemp(Vertices);
+	OutIndices = MoveTemp(Indices);
+	Vertices.Reset();
+	Indices.Reset();
+
+	IncrementalDataValid = false;
+	HasDirtyRegion = false;
+	VertexEdges.Empty();
+	TriangleCubes.Empty();
+	VertexUseCount.Empty();
+	FreeVertices.Empty();
+	FreeTriangles.Empty();
+	BlockTriangles.Empty();
+	EdgeSlotsValid = false;
+	BoundaryEdgeSlots.Empty();
+	InnerEdgeSlots.Empty();
+}
+
+bool FMarchingCubesBuilder::TakeEdges(TArray<FIndexEdge>& OutBoundaryEdges, TArray<FIndexEdge>& OutInnerEdges)
+{
+	if (!BoundaryEdgesCalculated) return false;
+
+	TArray<int32> VertexRemap;
+	GetCompactVertexRemap(VertexRemap);
+
+	OutBoundaryEdges = MoveTemp(BoundaryEdges);
+	OutInnerEdges = MoveTemp(InnerEdges);
+	RemapEdges(VertexRemap, OutBoundaryEdges);
+	RemapEdges(VertexRemap, OutInnerEdges);
+	BoundaryEdges.Reset();
+	InnerEdges.Reset();
+	BoundaryEdgesCalculated = false;
+	EdgeSlotsValid = false;
+	BoundaryEdgeSlots.Empty();
+	InnerEdgeSlots.Empty();
+	return true;
+}
+
+bool FMarchingCubesBuilder::GetOuterVertices(TArray<int32>& OutIndices) const
+{	
+	if (!BoundaryEdgesCalculated) return false;
+
+	GetEdgeVertices(BoundaryEdges, OutIndices);
+
+	// Remap keeps order, so indices stay sorted
+	TArray<int32> VertexRemap;
+	GetCompactVertexRemap(VertexRemap);
+	for (int32& VertexIndex : OutIndices)
+	{
+		VertexIndex = VertexRemap.Num() > 0 ? VertexRemap[VertexIndex] : VertexIndex;
+	}
+	return true;
+}
+
+void FMarchingCubesBuilder::GetEdgeVertices(const TArray<FIndexEdge>& Edges, TArray<int32>& OutIndices)
+{
+	OutIndices.Reset(Edges.Num() * 2);
+	for (const FIndexEdge& Edge : Edges)
+	{
+		OutIndices.Add(Edge.A);
+		OutIndices.Add(Edge.B);
+	}
+	OutIndices.Sort();
+
+	// Remove duplicates of sorted list
+	int32 UniqueNum = 0;
+	for (int32 Index = 0; Index < OutIndices.Num(); Index++)
+	{
+		if (UniqueNum == 0 || OutIndices[UniqueNum - 1] != OutIndices[Index])
+		{
+			OutIndices[UniqueNum++] = OutIndices[Index];
+		}
+	}
+	OutIndices.SetNum(UniqueNum, false);
+}
+
+bool FMarchingCubesBuilder::GetBoundaryEdges(TArray<FIndexEdge>& OutEdges) const
+{
+	if (!BoundaryEdgesCalculated) return false;
+	OutEdges = BoundaryEdges;
+
+	TArray<int32> VertexRemap;
+	GetCompactVertexRemap(VertexRemap);
+	RemapEdges(VertexRemap, OutEdges);
+	return true;
+}
+
+bool FMarchingCubesBuilder::GetInnerEdges(TArray<FIndexEdge>& OutEdges) const
+{
+	if (!BoundaryEdgesCalculated) return false;
+	OutEdges = InnerEdges;
+
+	TArray<int32> VertexRemap;
+	GetCompactVertexRemap(VertexRemap);
+	RemapEdges(VertexRemap, OutEdges);
+	return true;
+}
+
+void FMarchingCubesBuilder::CalcOuterEdges()
+{
+	ClassifyEdges(Indices, Vertices.Num(), BoundaryEdges, InnerEdges);
+	BoundaryEdgesCalculated = true;
+	EdgeSlotsValid = false;
+}
+
+void FMarchingCubesBuilder::ClassifyEdges(const TArray<int32>& TriangleIndices, int32 VerticesNum, TArray<FIndexEdge>& OutBoundaryEdges, TArray<FIndexEdge>& OutInnerEdges)
+{
+	OutBoundaryEdges.Reset();
+	OutInnerEdges.Reset();
+
+	// Packed (min, max) key of every triangle edge, equal edges get equal keys
+	TArray<uint64> EdgeKeys;
+	EdgeKeys.Reserve(TriangleIndices.Num());
+	for (int Index = 0; Index < TriangleIndices.Num(); Index += 3)
+	{
+		// Retired by incremental update
+		if (TriangleIndices[Index] == INDEX_NONE) continue;
+
+		EdgeKeys.Add(MakeEdgeKey(TriangleIndices[Index], TriangleIndices[Index + 1]));
+		EdgeKeys.Add(MakeEdgeKey(TriangleIndices[Index + 1], TriangleIndices[Index + 2]));
+		EdgeKeys.Add(MakeEdgeKey(TriangleIndices[Index + 2], TriangleIndices[Index]));
+	}
+
+	RadixSortEdgeKeys(EdgeKeys, VerticesNum);
+
+	// Equal keys are adjacent: single edge is boundary, shared one is inner
+	for (int32 RunStart = 0; RunStart < EdgeKeys.Num(); )
+	{
+		const uint64 Key = EdgeKeys[RunStart];
+		int32 RunEnd = RunStart + 1;
+		while (RunEnd < EdgeKeys.Num() && EdgeKeys[RunEnd] == Key)
+		{
+			RunEnd++;
+		}
+
+		const FIndexEdge Edge(static_cast<int32>(Key >> 32), static_cast<int32>(Key & 0xFFFFFFFF));
+		if (RunEnd - RunStart == 1)
+		{
+			OutBoundaryEdges.Add(Edge);
+		}
+		else
+		{
+			OutInnerEdges.Add(Edge);
+		}
+		RunStart = RunEnd;
+	}
+}
+
+void FMarchingCubesBuilder::RadixSortEdgeKeys(TArray<uint64>& Keys, int32 VerticesNum)
+{
+	if (Keys.Num() < 2) return;
+
+	// Both halves of key are vertex indices, bytes above highest index are always zero and skipped
+	int32 IndexBytes = 1;
+	while (IndexBytes < 4 && (static_cast<uint32>(VerticesNum) >> (IndexBytes * 8)) != 0)
+	{
+		IndexBytes++;
+	}
+
+	TArray<uint64> Buffer;
+	Buffer.SetNumUninitialized(Keys.Num());
+	uint64* Source = Keys.GetData();
+	uint64* Target = Buffer.GetData();
+
+	// Least significant digit first: max index, then min index
+	const int32 Shifts[] = { 0, 8, 16, 24, 32, 40, 48, 56 };
+	for (int32 Half = 0; Half < 2; Half++)
+	{
+		for (int32 Byte = 0; Byte < IndexBytes; Byte++)
+		{
+			const int32 Shift = Shifts[Half * 4 + Byte];
+
+			int32 Offsets[256] = { 0 };
+			for (int32 Index = 0; Index < Keys.Num(); Index++)
+			{
+				Offsets[(Source[Index] >> Shift) & 0xFF]++;
+			}
+
+			int32 Sum = 0;
+			for (int32 Digit = 0; Digit < 256; Digit++)
+			{
+				const int32 Count = Offsets[Digit];
+				Offsets[Digit] = Sum;
+				Sum += Count;
+			}
+
+			for (int32 Index = 0; Index < Keys.Num(); Index++)
+			{
+				Target[Offsets[(Source[Index] >> Shift) & 0xFF]++] = Source[Index];
+			}
+			Swap(Source, Target);
+		}
+	}
+
+	// Even number of passes always ends in Keys
+	check(Source == Keys.GetData());
+}
+
+/** Symmetric 4x4 error quadric of Garland-Heckbert decimation */
+struct FEdgeQuadric
+{
+	// aa, ab, ac, ad, bb, bc, bd, cc, cd, dd
+	double Q[10];
+
+	FEdgeQuadric() { FMemory::Memzero(Q); }
+
+	/** Squared distance to plane ax + by + cz + d = 0 with normalized (a, b, c) */
+	FEdgeQuadric(double a, double b, double c, double d)
+	{
+		Q[0] = a * a; Q[1] = a * b; Q[2] = a * c; Q[3] = a * d;
+		Q[4] = b * b; Q[5] = b * c; Q[6] = b * d;
+		Q[7] = c * c; Q[8] = c * d;
+		Q[9] = d * d;
+	}
+
+	FEdgeQuadric& operator+=(const FEdgeQuadric& Other)
+	{
+		for (int32 Index = 0; Index < 10; Index++)
+		{
+			Q[Index] += Other.Q[Index];
+		}
+		return *this;
+	}
+
+	FEdgeQuadric operator+(const FEdgeQuadric& Other) const
+	{
+		FEdgeQuadric Result = *this;
+		Result += Other;
+		return Result;
+	}
+
+	double Evaluate(const FVector& P) const
+	{
+		const double X = P.X, Y = P.Y, Z = P.Z;
+		return Q[0] * X * X + 2 * Q[1] * X * Y + 2 * Q[2] * X * Z + 2 * Q[3] * X
+			+ Q[4] * Y * Y + 2 * Q[5] * Y * Z + 2 * Q[6] * Y
+			+ Q[7] * Z * Z + 2 * Q[8] * Z
+			+ Q[9];
+	}
+
+	/** Position with minimal error. @returns false if quadric is singular (flat or straight neighbourhood) */
+	bool FindMinimum(FVector& OutPosition) const
+	{
+		const double Det = Q[0] * (Q[4] * Q[7] - Q[5] * Q[5]) - Q[1] * (Q[1] * Q[7] - Q[5] * Q[2]) + Q[2] * (Q[1] * Q[5] - Q[4] * Q[2]);
+		if (FMath::Abs(Det) < 1e-10) return false;
+
+		// Cramer's rule for A * p = -b
+		const double BX = -Q[3], BY = -Q[6], BZ = -Q[8];
+		const double DetX = BX * (Q[4] * Q[7] - Q[5] * Q[5]) - Q[1] * (BY * Q[7] - Q[5] * BZ) + Q[2] * (BY * Q[5] - Q[4] * BZ);
+		const double DetY = Q[0] * (BY * Q[7] - BZ * Q[5]) - BX * (Q[1] * Q[7] - Q[5] * Q[2]) + Q[2] * (Q[1] * BZ - BY * Q[2]);
+		const double DetZ = Q[0] * (Q[4] * BZ - Q[5] * BY) - Q[1] * (Q[1] * BZ - BY * Q[2]) + BX * (Q[1] * Q[5] - Q[4] * Q[2]);
+
+		OutPosition = FVector(DetX / Det, DetY / Det, DetZ / Det);
+		return true;
+	}
+};
+
+struct FEdgeCollapse
+{
+	double Cost;
+	int32 Keep;
+	int32 Remove;
+	uint32 KeepVersion;
+	uint32 RemoveVersion;
+	FVector Position;
+
+	bool operator<(const FEdgeCollapse& Other) const { return Cost < Other.Cost; }
+};
+
+void FMarchingCubesBuilder::SimplifyMesh(int32 TargetTriangleNum, float MaxError)
+{
+	if (!RemoveDuplicateVertices)
+	{
+		UE_LOG(MarchingCubesBuilder, Warning, TEXT("Simplification requires shared vertices, enable RemoveDuplicateVertices"));
+		return;
+	}
+
+	if (!BoundaryEdgesCalculated)
+	{
+		CalcOuterEdges();
+	}
+
+	// Vertices are moved and merged, edges and cubes do not match them anymore
+	IncrementalDataValid = false;
+
+	// Boundary stays in place so neighbouring cells still stitch
+	TArray<bool> Locked;
+	Locked.Init(false, Vertices.Num());
+	{
+		TArray<int32> OuterVertices;
+		GetOuterVertices(OuterVertices);
+		for (int32 VertexIndex : OuterVertices)
+		{
+			Locked[VertexIndex] = true;
+		}
+	}
+
+	// Live triangles, retired by incremental update are dropped
+	TArray<int32> Triangles;
+	Triangles.Reserve(Indices.Num());
+	for (int32 Index = 0; Index < Indices.Num(); Index += 3)
+	{
+		if (Indices[Index] == INDEX_NONE) continue;
+		Triangles.Append(&Indices[Index], 3);
+	}
+	const int32 SourceTriangleNum = Triangles.Num() / 3;
+	int32 TriangleNum = SourceTriangleNum;
+
+	TArray<bool> TriangleRemoved;
+	TriangleRemoved.Init(false, TriangleNum);
+
+	TArray<TArray<int32>> VertexTriangles;
+	VertexTriangles.SetNum(Vertices.Num());
+
+	TArray<FEdgeQuadric> Quadrics;
+	Quadrics.SetNum(Vertices.Num());
+
+	TArray<uint64> EdgeKeys;
+	EdgeKeys.Reserve(Triangles.Num());
+
+	for (int32 Triangle = 0; Triangle < TriangleNum; Triangle++)
+	{
+		const int32* Corners = &Triangles[Triangle * 3];
+		const FVector& P0 = Vertices[Corners[0]];
+		const FVector Normal = FVector::CrossProduct(Vertices[Corners[1]] - P0, Vertices[Corners[2]] - P0).GetSafeNormal();
+		const FEdgeQuadric Plane(Normal.X, Normal.Y, Normal.Z, -FVector::DotProduct(Normal, P0));
+
+		for (int32 Corner = 0; Corner < 3; Corner++)
+		{
+			Quadrics[Corners[Corner]] += Plane;
+			VertexTriangles[Corners[Corner]].Add(Triangle);
+			EdgeKeys.Add(MakeEdgeKey(Corners[Corner], Corners[(Corner + 1) % 3]));
+		}
+	}
+
+	TArray<uint32> Versions;
+	Versions.Init(0, Vertices.Num());
+
+	auto MakeCollapse = [&](int32 A, int32 B, FEdgeCollapse& OutCollapse)
+	{
+		if (Locked[A] && Locked[B]) return false;
+
+		// Locked vertex never moves
+		if (Locked[B])
+		{
+			Swap(A, B);
+		}
+
+		const FEdgeQuadric Quadric = Quadrics[A] + Quadrics[B];
+
+		OutCollapse.Keep = A;
+		OutCollapse.Remove = B;
+		OutCollapse.KeepVersion = Versions[A];
+		OutCollapse.RemoveVersion = Versions[B];
+
+		if (Locked[A])
+		{
+			OutCollapse.Position = Vertices[A];
+			OutCollapse.Cost = Quadric.Evaluate(Vertices[A]);
+			return true;
+		}
+
+		// Best of ends and midpoint, or optimal position if it stays near edge
+		const FVector Candidates[3] = { Vertices[A], Vertices[B], (Vertices[A] + Vertices[B]) * 0.5f };
+		OutCollapse.Position = Candidates[0];
+		OutCollapse.Cost = Quadric.Evaluate(Candidates[0]);
+		for (int32 Index = 1; Index < 3; Index++)
+		{
+			const double Cost = Quadric.Evaluate(Candidates[Index]);
+			if (Cost < OutCollapse.Cost)
+			{
+				OutCollapse.Cost = Cost;
+				OutCollapse.Position = Candidates[Index];
+			}
+		}
+
+		FVector Optimal;
+		if (Quadric.FindMinimum(Optimal) && FVector::DistSquared(Optimal, Candidates[2]) <= FVector::DistSquared(Vertices[A], Vertices[B]))
+		{
+			const double Cost = Quadric.Evaluate(Optimal);
+			if (Cost < OutCollapse.Cost)
+			{
+				OutCollapse.Cost = Cost;
+				OutCollapse.Position = Optimal;
+			}
+		}
+
+		OutCollapse.Cost = FMath::Max(OutCollapse.Cost, 0.0);
+		return true;
+	};
+
+	TArray<FEdgeCollapse> Heap;
+	RadixSortEdgeKeys(EdgeKeys, Vertices.Num());
+	for (int32 Index = 0; Index < EdgeKeys.Num(); Index++)
+	{
+		if (Index > 0 && EdgeKeys[Index] == EdgeKeys[Index - 1]) continue;
+
+		FEdgeCollapse Collapse;
+		if (MakeCollapse(static_cast<int32>(EdgeKeys[Index] >> 32), static_cast<int32>(EdgeKeys[Index] & 0xFFFFFFFF), Collapse))
+		{
+			Heap.Add(Collapse);
+		}
+	}
+	Heap.Heapify();
+
+	// Collapse must not flip or degenerate surviving triangles
+	auto CanMove = [&](int32 VertexIndex, int32 OtherIndex, const FVector& Position)
+	{
+		for (int32 Triangle : VertexTriangles[VertexIndex])
+		{
+			if (TriangleRemoved[Triangle]) continue;
+
+			const int32* Corners = &Triangles[Triangle * 3];
+			if (Corners[0] == OtherIndex || Corners[1] == OtherIndex || Corners[2] == OtherIndex) continue;
+
+			FVector Before[3], After[3];
+			for (int32 Corner = 0; Corner < 3; Corner++)
+			{
+				Before[Corner] = Vertices[Corners[Corner]];
+				After[Corner] = Corners[Corner] == VertexIndex ? Position : Before[Corner];
+			}
+
+			const FVector NormalBefore = FVector::CrossProduct(Before[1] - Before[0], Before[2] - Before[0]).GetSafeNormal();
+			const FVector NormalAfter = FVector::CrossProduct(After[1] - After[0], After[2] - After[0]).GetSafeNormal();
+			if (NormalAfter.IsNearlyZero() || FVector::DotProduct(NormalBefore, NormalAfter) < 0.2f) return false;
+		}
+		return true;
+	};
+
+	// Link condition: vertices adjacent to both ends may only be opposite corners of triangles on the edge,
+	// otherwise collapse pinches surface into non-manifold edge or folds tetrahedron
+	TArray<int32> LinkVertices;
+	TArray<int32> EdgeOpposites;
+	auto IsLinkValid = [&](int32 A, int32 B)
+	{
+		LinkVertices.Reset();
+		EdgeOpposites.Reset();
+		for (int32 Triangle : VertexTriangles[A])
+		{
+			if (TriangleRemoved[Triangle]) continue;
+
+			const int32* Corners = &Triangles[Triangle * 3];
+			const bool OnEdge = Corners[0] == B || Corners[1] == B || Corners[2] == B;
+			for (int32 Corner = 0; Corner < 3; Corner++)
+			{
+				const int32 VertexIndex = Corners[Corner];
+				if (VertexIndex == A || VertexIndex == B) continue;
+
+				LinkVertices.AddUnique(VertexIndex);
+				if (OnEdge)
+				{
+					EdgeOpposites.AddUnique(VertexIndex);
+				}
+			}
+		}
+		for (int32 Triangle : VertexTriangles[B])
+		{
+			if (TriangleRemoved[Triangle]) continue;
+
+			const int32* Corners = &Triangles[Triangle * 3];
+			for (int32 Corner = 0; Corner < 3; Corner++)
+			{
+				const int32 VertexIndex = Corners[Corner];
+				if (VertexIndex != A && VertexIndex != B && LinkVertices.Contains(VertexIndex) && !EdgeOpposites.Contains(VertexIndex)) return false;
+			}
+		}
+		return true;
+	};
+
+	const double MaxCost = static_cast<double>(MaxError) * MaxError;
+	TArray<int32> Neighbours;
+	while (Heap.Num() > 0 && (TargetTriangleNum <= 0 || TriangleNum > TargetTriangleNum))
+	{
+		FEdgeCollapse Collapse;
+		Heap.HeapPop(Collapse, false);
+
+		if (Collapse.Cost > MaxCost) break;
+
+		// Either end changed since candidate was made
+		if (Versions[Collapse.Keep] != Collapse.KeepVersion || Versions[Collapse.Remove] != Collapse.RemoveVersion) continue;
+
+		if (!IsLinkValid(Collapse.Keep, Collapse.Remove)) continue;
+
+		if (!CanMove(Collapse.Keep, Collapse.Remove, Collapse.Position) || !CanMove(Collapse.Remove, Collapse.Keep, Collapse.Position)) continue;
+
+		const int32 Keep = Collapse.Keep;
+		const int32 Remove = Collapse.Remove;
+
+		Vertices[Keep] = Collapse.Position;
+		Quadrics[Keep] += Quadrics[Remove];
+		Versions[Keep]++;
+		Versions[Remove]++;
+
+		for (int32 Triangle : VertexTriangles[Remove])
+		{
+			if (TriangleRemoved[Triangle]) continue;
+
+			int32* Corners = &Triangles[Triangle * 3];
+			if (Corners[0] == Keep || Corners[1] == Keep || Corners[2] == Keep)
+			{
+				// Triangle on collapsed edge degenerates
+				TriangleRemoved[Triangle] = true;
+				TriangleNum--;
+				continue;
+			}
+
+			for (int32 Corner = 0; Corner < 3; Corner++)
+			{
+				if (Corners[Corner] == Remove)
+				{
+					Corners[Corner] = Keep;
+				}
+			}
+			VertexTriangles[Keep].Add(Triangle);
+		}
+		VertexTriangles[Remove].Empty();
+
+		// Costs of edges around moved vertex
+		Neighbours.Reset();
+		VertexTriangles[Keep].RemoveAllSwap([&TriangleRemoved](int32 Triangle) { return TriangleRemoved[Triangle]; });
+		for (int32 Triangle : VertexTriangles[Keep])
+		{
+			for (int32 Corner = 0; Corner < 3; Corner++)
+			{
+				const int32 VertexIndex = Triangles[Triangle * 3 + Corner];
+				if (VertexIndex != Keep)
+				{
+					Neighbours.AddUnique(VertexIndex);
+				}
+			}
+		}
+		for (int32 Neighbour : Neighbours)
+		{
+			FEdgeCollapse NewCollapse;
+			if (MakeCollapse(Keep, Neighbour, NewCollapse))
+			{
+				Heap.HeapPush(NewCollapse);
+			}
+		}
+	}
+
+	// Compact mesh: drop removed triangles and vertices without triangles
+	TArray<int32> VertexRemap;
+	VertexRemap.Init(INDEX_NONE, Vertices.Num());
+	TArray<FVector> NewVertices;
+	NewVertices.Reserve(Vertices.Num());
+	Indices.Reset(TriangleNum * 3);
+	for (int32 Triangle = 0; Triangle < SourceTriangleNum; Triangle++)
+	{
+		if (TriangleRemoved[Triangle]) continue;
+
+		for (int32 Corner = 0; Corner < 3; Corner++)
+		{
+			int32& NewIndex = VertexRemap[Triangles[Triangle * 3 + Corner]];
+			if (NewIndex == INDEX_NONE)
+			{
+				NewIndex = NewVertices.Add(Vertices[Triangles[Triangle * 3 + Corner]]);
+			}
+			Indices.Add(NewIndex);
+		}
+	}
+
+	UE_LOG(MarchingCubesBuilder, Log, TEXT("Simplified mesh. Vertices: %d -> %d, Triangles: %d -> %d"), Vertices.Num(), NewVertices.Num(), SourceTriangleNum, TriangleNum);
+
+	Vertices = MoveTemp(NewVertices);
+	FreeVertices.Empty();
+	FreeTriangles.Empty();
+	BlockTriangles.Empty();
+	VertexEdges.Empty();
+	TriangleCubes.Empty();
+	VertexUseCount.Empty();
+
+	CalcOuterEdges();
+}
+
+void FMarchingCubesBuilder::CollapseCoplanarTriangles()
+{
+	// Coplanar neighbourhood has zero error
+	SimplifyMesh(0, KINDA_SMALL_NUMBER);
+}
+
+void FMarchingCubesBuilder::OptimizeVertexCache(int32 CacheSize)
+{
+	// Triangles are reordered, cubes and edges of incremental data do not match them anymore
+	IncrementalDataValid = false;
+	VertexEdges.Empty();
+	TriangleCubes.Empty();
+	VertexUseCount.Empty();
+	FreeVertices.Empty();
+	FreeTriangles.Empty();
+	BlockTriangles.Empty();
+
+	TArray<int32> SourceIndices;
+	SourceIndices.Reserve(Indices.Num());
+	for (int32 Index = 0; Index < Indices.Num(); Index += 3)
+	{
+		if (Indices[Index] == INDEX_NONE) continue;
+		SourceIndices.Append(&Indices[Index], 3);
+	}
+
+	const int32 VerticesNum = Vertices.Num();
+	const int32 TrianglesNum = SourceIndices.Num() / 3;
+	if (TrianglesNum == 0) return;
+
+	// Triangles of every vertex in one array, LiveTriangles counts not emitted ones
+	TArray<int32> LiveTriangles;
+	LiveTriangles.Init(0, VerticesNum);
+	for (int32 VertexIndex : SourceIndices)
+	{
+		LiveTriangles[VertexIndex]++;
+	}
+	TArray<int32> AdjacencyOffsets;
+	AdjacencyOffsets.SetNumUninitialized(VerticesNum + 1);
+	AdjacencyOffsets[0] = 0;
+	for (int32 VertexIndex = 0; VertexIndex < VerticesNum; VertexIndex++)
+	{
+		AdjacencyOffsets[VertexIndex + 1] = AdjacencyOffsets[VertexIndex] + LiveTriangles[VertexIndex];
+	}
+	TArray<int32> Adjacency;
+	Adjacency.SetNumUninitialized(SourceIndices.Num());
+	{
+		TArray<int32> Fill = AdjacencyOffsets;
+		for (int32 Index = 0; Index < SourceIndices.Num(); Index++)
+		{
+			Adjacency[Fill[SourceIndices[Index]]++] = Index / 3;
+		}
+	}
+
+	TArray<int32> CacheTime;
+	CacheTime.Init(0, VerticesNum);
+	TArray<bool> Emitted;
+	Emitted.Init(false, TrianglesNum);
+
+	TArray<int32> DeadEnd;
+	TArray<int32> Candidates;
+	int32 Time = CacheSize + 1;
+	int32 Cursor = 0;
+
+	Indices.Reset(SourceIndices.Num());
+
+	int32 Fanning = 0;
+	while (Fanning >= 0)
+	{
+		// Emit all triangles around fanning vertex
+		Candidates.Reset();
+		for (int32 Offset = AdjacencyOffsets[Fanning]; Offset < AdjacencyOffsets[Fanning + 1]; Offset++)
+		{
+			const int32 Triangle = Adjacency[Offset];
+			if (Emitted[Triangle]) continue;
+
+			for (int32 Corner = 0; Corner < 3; Corner++)
+			{
+				const int32 VertexIndex = SourceIndices[Triangle * 3 + Corner];
+				Indices.Add(VertexIndex);
+				DeadEnd.Add(VertexIndex);
+				Candidates.Add(VertexIndex);
+				LiveTriangles[VertexIndex]--;
+				if (Time - CacheTime[VertexIndex] > CacheSize)
+				{
+					CacheTime[VertexIndex] = Time++;
+				}
+			}
+			Emitted[Triangle] = true;
+		}
+
+		// Next fanning vertex is one that stays in cache after its triangles are emitted, oldest first
+		int32 Best = INDEX_NONE;
+		int32 BestPriority = -1;
+		for (int32 VertexIndex : Candidates)
+		{
+			if (LiveTriangles[VertexIndex] <= 0) continue;
+
+			int32 Priority = 0;
+			if (Time - CacheTime[VertexIndex] + 2 * LiveTriangles[VertexIndex] <= CacheSize)
+			{
+				Priority = Time - CacheTime[VertexIndex];
+			}
+			if (Priority > BestPriority)
+			{
+				BestPriority = Priority;
+				Best = VertexIndex;
+			}
+		}
+
+		if (Best == INDEX_NONE)
+		{
+			// Recently used vertices first, then any vertex with triangles left
+			while (DeadEnd.Num() > 0 && Best == INDEX_NONE)
+			{
+				const int32 VertexIndex = DeadEnd.Pop(false);
+				if (LiveTriangles[VertexIndex] > 0)
+				{
+					Best = VertexIndex;
+				}
+			}
+			while (Best == INDEX_NONE && Cursor < VerticesNum)
+			{
+				if (LiveTriangles[Cursor] > 0)
+				{
+					Best = Cursor;
+				}
+				Cursor++;
+			}
+		}
+		Fanning = Best;
+	}
+	check(Indices.Num() == SourceIndices.Num());
+
+	// Vertices in first use order, unused vertices are dropped
+	TArray<int32> VertexRemap;
+	VertexRemap.Init(INDEX_NONE, VerticesNum);
+	TArray<FVector> NewVertices;
+	NewVertices.Reserve(VerticesNum);
+	for (int32& VertexIndex : Indices)
+	{
+		int32& NewIndex = VertexRemap[VertexIndex];
+		if (NewIndex == INDEX_NONE)
+		{
+			NewIndex = NewVertices.Add(Vertices[VertexIndex]);
+		}
+		VertexIndex = NewIndex;
+	}
+	Vertices = MoveTemp(NewVertices);
+
+	if (BoundaryEdgesCalculated)
+	{
+		CalcOuterEdges();
+	}
+}
+
+float FMarchingCubesBuilder::CalcACMR(const TArray<int32>& TriangleIndices, int32 VerticesNum, int32 CacheSize)
+{
+	if (TriangleIndices.Num() < 3) return 0.f;
+
+	// FIFO cache, vertex is in cache if it was inserted less than CacheSize misses ago
+	TArray<int32> InsertedAt;
+	InsertedAt.Init(INDEX_NONE, VerticesNum);
+	int32 Misses = 0;
+	int32 TrianglesNum = 0;
+	for (int32 Index = 0; Index < TriangleIndices.Num(); Index++)
+	{
+		const int32 VertexIndex = TriangleIndices[Index];
+		if (VertexIndex == INDEX_NONE)
+		{
+			Index += 2;
+			continue;
+		}
+		if (Index % 3 == 0)
+		{
+			TrianglesNum++;
+		}
+
+		if (InsertedAt[VertexIndex] == INDEX_NONE || Misses - InsertedAt[VertexIndex] >= CacheSize)
+		{
+			InsertedAt[VertexIndex] = Misses++;
+		}
+	}
+	return TrianglesNum > 0 ? (float)Misses / TrianglesNum : 0.f;
+}
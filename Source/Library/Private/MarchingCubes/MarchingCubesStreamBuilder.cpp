@@ -0,0 +1,110 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "MarchingCubesStreamBuilder.h"
+
+
+
+void FMarchingCubesStreamBuilder::Begin(const FMeshConsumer& InConsumer)
+{
+	Consumer = InConsumer;
+	SlicesNum = 0;
+	VerticesNum = 0;
+	TrianglesNum = 0;
+
+	const int32 SliceSize = Dimensions.X * Dimensions.Y;
+	Slices[0].SetNumUninitialized(SliceSize);
+	Slices[1].SetNumUninitialized(SliceSize);
+	EdgeSlabs.Init(Dimensions);
+}
+
+bool FMarchingCubesStreamBuilder::AddSlice(const float* Densities, int32 DensitiesNum)
+{
+	if (!IsValid() || IsFinished()) return false;
+
+	const int32 SliceSize = Dimensions.X * Dimensions.Y;
+	if (DensitiesNum != SliceSize)
+	{
+		UE_LOG(MarchingCubesBuilder, Error, TEXT("Slice %d has %d densities, expected %d"), SlicesNum, DensitiesNum, SliceSize);
+		return false;
+	}
+
+	FMemory::Memcpy(Slices[SlicesNum & 1].GetData(), Densities, SliceSize * sizeof(float));
+	SlicesNum++;
+
+	if (SlicesNum >= 2)
+	{
+		PoligonizeLayer(SlicesNum - 2);
+	}
+
+	if (IsFinished())
+	{
+		UE_LOG(MarchingCubesBuilder, Log, TEXT("Streamed mesh. Vertices: %d, Triangles: %d"), VerticesNum, TrianglesNum);
+	}
+	return true;
+}
+
+bool FMarchingCubesStreamBuilder::Build(const FSliceProducer& Producer, const FMeshConsumer& InConsumer)
+{
+	if (!IsValid()) return false;
+
+	Begin(InConsumer);
+
+	TArray<float> Slice;
+	while (!IsFinished())
+	{
+		Slice.Reset();
+		if (!Producer(SlicesNum, Slice) || !AddSlice(Slice.GetData(), Slice.Num()))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void FMarchingCubesStreamBuilder::PoligonizeLayer(int32 CubeLayerZ)
+{
+	LayerVertices.Reset();
+	LayerIndices.Reset();
+	EdgeSlabs.BeginLayer(CubeLayerZ);
+
+	for (int32 Y = 0; Y < Dimensions.Y - 1; Y++)
+	{
+		for (int32 X = 0; X < Dimensions.X - 1; X++)
+		{
+			const FIntVector CubeCoords(X, Y, CubeLayerZ);
+
+			uint8 CubeIndex = 0;
+			for (int32 Corner = 0; Corner < 8; Corner++)
+			{
+				if (GetDensity(CubeCoords + FMarchingCubesBuilder::CubeCorners[Corner]) > SurfaceLevel)
+				{
+					CubeIndex |= 1 << Corner;
+				}
+			}
+
+			const FMarchingCubesCase& Case = FMarchingCubesBuilder::CaseTable[CubeIndex];
+			const int32 EdgesNum = Case.TriangleNum * 3;
+			for (int32 Index = 0; Index < EdgesNum; Index++)
+			{
+				const int32 LocalEdgeIndex = Case.GetEdge(Index);
+				const FIntVector OwnerPoint = CubeCoords + FMarchingCubesBuilder::EdgeToCubeOffset[LocalEdgeIndex];
+
+				int32& VertexIndex = EdgeSlabs.GetEdgeVertex(OwnerPoint, FMarchingCubesBuilder::GetEdgeAxis(LocalEdgeIndex));
+				if (VertexIndex == INDEX_NONE)
+				{
+					const FVector4 A = GetPoint(CubeCoords + FMarchingCubesBuilder::CubeCorners[FMarchingCubesBuilder::Edges[LocalEdgeIndex][0]]);
+					const FVector4 B = GetPoint(CubeCoords + FMarchingCubesBuilder::CubeCorners[FMarchingCubesBuilder::Edges[LocalEdgeIndex][1]]);
+					LayerVertices.Add(FMarchingCubesBuilder::VertexLerp(SurfaceLevel, A, B));
+					VertexIndex = VerticesNum++;
+				}
+				LayerIndices.Add(VertexIndex);
+			}
+			TrianglesNum += Case.TriangleNum;
+		}
+	}
+
+	if (Consumer)
+	{
+		Consumer(CubeLayerZ, LayerVertices, LayerIndices);
+	}
+}
@@ -0,0 +1,46 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "OccupancyMask.h"
+
+
+
+int32 FOccupancyMask::CountBits(const uint64* Words, int32 WordsNum)
+{
+	int32 Count = 0;
+	for (int32 Index = 0; Index < WordsNum; Index++)
+	{
+		Count += (int32)FPlatformMath::CountBits(Words[Index]);
+	}
+	return Count;
+}
+
+bool FOccupancyMask::AnySetInBlock(const uint64* Words, const FIntVector& Dimensions, const FIntVector& Min, const FIntVector& Max)
+{
+	// Empty block, also keeps shift of last mask below 64
+	if (Max.X <= Min.X || Max.Y <= Min.Y || Max.Z <= Min.Z) return false;
+
+	const int32 WordsPerRow = GetWordsPerRow(Dimensions.X);
+	const int32 FirstWord = Min.X / 64;
+	const int32 LastWord = (Max.X - 1) / 64;
+
+	// Masks of bits in [Min.X, Max.X) for first and last word
+	const uint64 FirstMask = ~uint64(0) << (Min.X % 64);
+	const uint64 LastMask = ~uint64(0) >> (63 - (Max.X - 1) % 64);
+
+	for (int32 Z = Min.Z; Z < Max.Z; Z++)
+	{
+		for (int32 Y = Min.Y; Y < Max.Y; Y++)
+		{
+			const uint64* Row = Words + (Y + Z * Dimensions.Y) * WordsPerRow;
+			for (int32 Word = FirstWord; Word <= LastWord; Word++)
+			{
+				uint64 Mask = ~uint64(0);
+				if (Word == FirstWord) Mask &= FirstMask;
+				if (Word == LastWord) Mask &= LastMask;
+
+				if (Row[Word] & Mask) return true;
+			}
+		}
+	}
+	return false;
+}
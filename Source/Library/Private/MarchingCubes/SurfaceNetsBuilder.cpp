@@ -0,0 +1,241 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "SurfaceNetsBuilder.h"
+
+
+
+void FSurfaceNetsBuilder::Build()
+{
+	if (!IsValid()) return;
+
+	Vertices.Reset();
+	Indices.Reset();
+	BoundaryEdgesCalculated = false;
+
+	const FIntVector CubesNum = Dimensions - FIntVector(1);
+	CubeVertices.Init(INDEX_NONE, CubesNum.X * CubesNum.Y * CubesNum.Z);
+
+	for (int32 Z = 0; Z < CubesNum.Z; Z++)
+	{
+		for (int32 Y = 0; Y < CubesNum.Y; Y++)
+		{
+			for (int32 X = 0; X < CubesNum.X; X++)
+			{
+				PlaceCubeVertex(FIntVector(X, Y, Z));
+			}
+		}
+	}
+
+	// Edges on grid border use border vertices in place of missing cubes
+	for (int32 Z = 0; Z < Dimensions.Z; Z++)
+	{
+		for (int32 Y = 0; Y < Dimensions.Y; Y++)
+		{
+			for (int32 X = 0; X < Dimensions.X; X++)
+			{
+				const FIntVector Point(X, Y, Z);
+				for (int32 Axis = 0; Axis < 3; Axis++)
+				{
+					AddEdgeQuad(Point, Axis);
+				}
+			}
+		}
+	}
+
+	CubeVertices.Empty();
+	BorderVertices.Empty();
+
+	if (FindBoundaryEdges)
+	{
+		CalcOuterEdges();
+	}
+
+	UE_LOG(MarchingCubesBuilder, Log, TEXT("Built surface nets. Vertices: %d, Triangles: %d"), Vertices.Num(), Indices.Num() / 3);
+}
+
+void FSurfaceNetsBuilder::PlaceCubeVertex(const FIntVector& CubeCoords)
+{
+	FVector4 Corners[8];
+	uint8 CubeIndex = 0;
+	for (int32 Corner = 0; Corner < 8; Corner++)
+	{
+		const FIntVector Coords = CubeCoords + FMarchingCubesBuilder::CubeCorners[Corner];
+		Corners[Corner] = Grid.GetPoint(Coords.X, Coords.Y, Coords.Z);
+		if (Corners[Corner].W > SurfaceLevel)
+		{
+			CubeIndex |= 1 << Corner;
+		}
+	}
+
+	const uint16 EdgeMask = FMarchingCubesBuilder::EdgeTable[CubeIndex];
+	if (EdgeMask == 0) return;
+
+	FVector Sum = FVector::ZeroVector;
+	int32 CrossingsNum = 0;
+	for (int32 Edge = 0; Edge < 12; Edge++)
+	{
+		if (EdgeMask & (1 << Edge))
+		{
+			Sum += FMarchingCubesBuilder::VertexLerp(SurfaceLevel, Corners[FMarchingCubesBuilder::Edges[Edge][0]], Corners[FMarchingCubesBuilder::Edges[Edge][1]]);
+			CrossingsNum++;
+		}
+	}
+
+	CubeVertices[GetCubeIndex(CubeCoords.X, CubeCoords.Y, CubeCoords.Z)] = Vertices.Add(Sum / CrossingsNum);
+}
+
+void FSurfaceNetsBuilder::AddEdgeQuad(const FIntVector& PointCoords, int32 Axis)
+{
+	const int32 U = (Axis + 1) % 3;
+	const int32 V = (Axis + 2) % 3;
+	if (PointCoords[Axis] >= Dimensions[Axis] - 1) return;
+
+	FIntVector EndCoords = PointCoords;
+	EndCoords[Axis]++;
+
+	const bool StartInside = Grid.GetDensity(Grid.GetPointIndex(PointCoords.X, PointCoords.Y, PointCoords.Z)) > SurfaceLevel;
+	const bool EndInside = Grid.GetDensity(Grid.GetPointIndex(EndCoords.X, EndCoords.Y, EndCoords.Z)) > SurfaceLevel;
+	if (StartInside == EndInside) return;
+
+	// Cubes around edge counterclockwise looking against Axis
+	const int32 QuadOffsets[4][2] = { { -1, -1 }, { 0, -1 }, { 0, 0 }, { -1, 0 } };
+	int32 Quad[4];
+	for (int32 Corner = 0; Corner < 4; Corner++)
+	{
+		FIntVector Cube = PointCoords;
+		Cube[U] += QuadOffsets[Corner][0];
+		Cube[V] += QuadOffsets[Corner][1];
+
+		const bool OutsideU = Cube[U] < 0 || Cube[U] >= Dimensions[U] - 1;
+		const bool OutsideV = Cube[V] < 0 || Cube[V] >= Dimensions[V] - 1;
+		if (OutsideU && OutsideV)
+		{
+			Quad[Corner] = GetBorderEdgeVertex(PointCoords, Axis);
+		}
+		else if (OutsideU || OutsideV)
+		{
+			// Face of inside cube lying on border plane that holds the edge
+			const int32 NormalAxis = OutsideU ? U : V;
+			Cube[NormalAxis] = PointCoords[NormalAxis];
+			Quad[Corner] = GetBorderFaceVertex(Cube, NormalAxis);
+		}
+		else
+		{
+			Quad[Corner] = CubeVertices[GetCubeIndex(Cube.X, Cube.Y, Cube.Z)];
+		}
+		check(Quad[Corner] != INDEX_NONE);
+	}
+
+	// Same winding as marching cubes: normal points to inside
+	if (StartInside)
+	{
+		Swap(Quad[1], Quad[3]);
+	}
+
+	const bool SplitFirstDiagonal = !SplitByShorterDiagonal 
+		|| FVector::DistSquared(Vertices[Quad[0]], Vertices[Quad[2]]) <= FVector::DistSquared(Vertices[Quad[1]], Vertices[Quad[3]]);
+	if (SplitFirstDiagonal)
+	{
+		Indices.Append({ Quad[0], Quad[1], Quad[2], Quad[0], Quad[2], Quad[3] });
+	}
+	else
+	{
+		Indices.Append({ Quad[0], Quad[1], Quad[3], Quad[1], Quad[2], Quad[3] });
+	}
+}
+
+int32 FSurfaceNetsBuilder::GetBorderFaceVertex(const FIntVector& PointCoords, int32 NormalAxis)
+{
+	const int64 Key = int64(Grid.GetPointIndex(PointCoords.X, PointCoords.Y, PointCoords.Z)) * 6 + NormalAxis;
+	if (const int32* Found = BorderVertices.Find(Key))
+	{
+		return *Found;
+	}
+
+	const int32 A = (NormalAxis + 1) % 3;
+	const int32 B = (NormalAxis + 2) % 3;
+
+	// Corners of square in winding order
+	FVector4 Corners[4];
+	const int32 CornerOffsets[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+	for (int32 Corner = 0; Corner < 4; Corner++)
+	{
+		FIntVector Coords = PointCoords;
+		Coords[A] += CornerOffsets[Corner][0];
+		Coords[B] += CornerOffsets[Corner][1];
+		Corners[Corner] = Grid.GetPoint(Coords.X, Coords.Y, Coords.Z);
+	}
+
+	// Crossings lie on plane, so their mean does too
+	FVector Sum = FVector::ZeroVector;
+	int32 CrossingsNum = 0;
+	for (int32 Side = 0; Side < 4; Side++)
+	{
+		const FVector4& Start = Corners[Side];
+		const FVector4& End = Corners[(Side + 1) % 4];
+		if ((Start.W > SurfaceLevel) != (End.W > SurfaceLevel))
+		{
+			Sum += FMarchingCubesBuilder::VertexLerp(SurfaceLevel, Start, End);
+			CrossingsNum++;
+		}
+	}
+	if (CrossingsNum == 0) return INDEX_NONE;
+
+	return BorderVertices.Add(Key, Vertices.Add(Sum / CrossingsNum));
+}
+
+int32 FSurfaceNetsBuilder::GetBorderEdgeVertex(const FIntVector& PointCoords, int32 Axis)
+{
+	const int64 Key = int64(Grid.GetPointIndex(PointCoords.X, PointCoords.Y, PointCoords.Z)) * 6 + 3 + Axis;
+	if (const int32* Found = BorderVertices.Find(Key))
+	{
+		return *Found;
+	}
+
+	FIntVector EndCoords = PointCoords;
+	EndCoords[Axis]++;
+	const FVector Crossing = FMarchingCubesBuilder::VertexLerp(SurfaceLevel, 
+		Grid.GetPoint(PointCoords.X, PointCoords.Y, PointCoords.Z), Grid.GetPoint(EndCoords.X, EndCoords.Y, EndCoords.Z));
+
+	return BorderVertices.Add(Key, Vertices.Add(Crossing));
+}
+
+bool FSurfaceNetsBuilder::GetOuterVertices(TArray<int32>& OutIndices) const
+{
+	if (!BoundaryEdgesCalculated) return false;
+
+	FMarchingCubesBuilder::GetEdgeVertices(BoundaryEdges, OutIndices);
+	return true;
+}
+
+bool FSurfaceNetsBuilder::GetBoundaryEdges(TArray<FIndexEdge>& OutEdges) const
+{
+	if (!BoundaryEdgesCalculated) return false;
+	OutEdges = BoundaryEdges;
+	return true;
+}
+
+bool FSurfaceNetsBuilder::GetInnerEdges(TArray<FIndexEdge>& OutEdges) const
+{
+	if (!BoundaryEdgesCalculated) return false;
+	OutEdges = InnerEdges;
+	return true;
+}
+
+bool FSurfaceNetsBuilder::TakeEdges(TArray<FIndexEdge>& OutBoundaryEdges, TArray<FIndexEdge>& OutInnerEdges)
+{
+	if (!BoundaryEdgesCalculated) return false;
+
+	OutBoundaryEdges = MoveTemp(BoundaryEdges);
+	OutInnerEdges = MoveTemp(InnerEdges);
+	BoundaryEdges.Reset();
+	InnerEdges.Reset();
+	BoundaryEdgesCalculated = false;
+	return true;
+}
+
+void FSurfaceNetsBuilder::CalcOuterEdges()
+{
+	FMarchingCubesBuilder::ClassifyEdges(Indices, Vertices.Num(), BoundaryEdges, InnerEdges);
+	BoundaryEdgesCalculated = true;
+}
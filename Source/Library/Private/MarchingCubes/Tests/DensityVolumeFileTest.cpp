@@ -0,0 +1,106 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "Misc/Paths.h"
+#include "HAL/FileManager.h"
+
+#include "DensityVolumeFile.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FDensityVolumeChunksTest, "Library.MarchingCubes.DensityVolume.ChunkViews", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FDensityVolumeChunksTest::RunTest(const FString& Parameters)
+{
+	// Every point has unique density, so wrong offset of view is visible
+	FDensityGrid Grid;
+	Grid.Origin = FVector(-20, 10, 100);
+	Grid.VoxelSize = FVector(5, 5, 8);
+	Grid.Dimensions = FIntVector(5, 4, 11);
+	Grid.Densities.SetNumUninitialized(Grid.Dimensions.X * Grid.Dimensions.Y * Grid.Dimensions.Z);
+	for (int32 Index = 0; Index < Grid.Densities.Num(); Index++)
+	{
+		Grid.Densities[Index] = Index * 0.25f;
+	}
+	const FDensityGridView Source = Grid.GetView();
+
+	const FString Filename = FPaths::AutomationTransientDir() / TEXT("DensityVolumeChunksTest.dvol");
+	const int32 ChunkSlices = 4;
+	if (!TestTrue(TEXT("Volume is written"), FDensityVolumeWriter::Write(Filename, Source, ChunkSlices))) return false;
+
+	{
+		FDensityVolumeReader Reader;
+		if (!TestTrue(TEXT("Volume is opened"), Reader.Open(Filename))) return false;
+
+		const FDensityGridView View = Reader.GetView();
+		TestEqual(TEXT("Dimensions are kept"), View.Dimensions, Source.Dimensions);
+		TestEqual(TEXT("Origin is kept"), View.Origin, Source.Origin);
+		TestEqual(TEXT("Voxel size is kept"), View.VoxelSize, Source.VoxelSize);
+		bool DensitiesMatch = View.IsValid();
+		for (int32 Index = 0; DensitiesMatch && Index < Source.GetPointsNum(); Index++)
+		{
+			DensitiesMatch = View.GetDensity(Index) == Source.GetDensity(Index);
+		}
+		TestTrue(TEXT("Densities are kept"), DensitiesMatch);
+
+		// 11 slices, 10 cube layers in chunks of 4, 4 and 2 layers
+		const int32 ChunksNum = Reader.GetChunksNum();
+		TestEqual(TEXT("Chunks num"), ChunksNum, 3);
+
+		const int32 SliceSize = Source.Dimensions.X * Source.Dimensions.Y;
+		int32 CoveredSlices = 0;
+		for (int32 ChunkIndex = 0; ChunkIndex < ChunksNum; ChunkIndex++)
+		{
+			const FDensityGridView Chunk = Reader.GetChunkView(ChunkIndex);
+			const int32 FirstSlice = ChunkIndex * ChunkSlices;
+			const int32 ExpectedSlices = FMath::Min(ChunkSlices + 1, Source.Dimensions.Z - FirstSlice);
+			if (!TestTrue(FString::Printf(TEXT("Chunk %d is valid"), ChunkIndex), Chunk.IsValid())) continue;
+
+			TestEqual(FString::Printf(TEXT("Chunk %d slices"), ChunkIndex), Chunk.Dimensions.Z, ExpectedSlices);
+			TestEqual(FString::Printf(TEXT("Chunk %d origin"), ChunkIndex), Chunk.Origin.Z, Source.Origin.Z + FirstSlice * Source.VoxelSize.Z);
+
+			bool ChunkMatches = true;
+			for (int32 Index = 0; ChunkMatches && Index < Chunk.GetPointsNum(); Index++)
+			{
+				ChunkMatches = Chunk.GetDensity(Index) == Source.GetDensity(FirstSlice * SliceSize + Index);
+			}
+			TestTrue(FString::Printf(TEXT("Chunk %d densities"), ChunkIndex), ChunkMatches);
+
+			// Top slice of chunk is first slice of next one
+			if (ChunkIndex + 1 < ChunksNum)
+			{
+				const FDensityGridView Next = Reader.GetChunkView(ChunkIndex + 1);
+				const int32 TopSlice = (Chunk.Dimensions.Z - 1) * SliceSize;
+				bool OverlapMatches = Next.IsValid();
+				for (int32 Index = 0; OverlapMatches && Index < SliceSize; Index++)
+				{
+					OverlapMatches = Chunk.GetDensity(TopSlice + Index) == Next.GetDensity(Index);
+				}
+				TestTrue(FString::Printf(TEXT("Chunk %d overlaps next chunk by one slice"), ChunkIndex), OverlapMatches);
+			}
+			CoveredSlices = FirstSlice + Chunk.Dimensions.Z;
+		}
+		TestEqual(TEXT("Chunks cover all slices"), CoveredSlices, Source.Dimensions.Z);
+
+		TestFalse(TEXT("Negative chunk index gives empty view"), Reader.GetChunkView(-1).IsValid());
+		TestFalse(TEXT("Chunk index past last chunk gives empty view"), Reader.GetChunkView(ChunksNum).IsValid());
+	}
+
+	// Volume that is not split is single chunk
+	if (TestTrue(TEXT("Single chunk volume is written"), FDensityVolumeWriter::Write(Filename, Source)))
+	{
+		FDensityVolumeReader Reader;
+		if (TestTrue(TEXT("Single chunk volume is opened"), Reader.Open(Filename)))
+		{
+			TestEqual(TEXT("Single chunk"), Reader.GetChunksNum(), 1);
+			TestEqual(TEXT("Only chunk is whole volume"), Reader.GetChunkView(0).Dimensions, Source.Dimensions);
+			TestFalse(TEXT("Second chunk of single chunk volume gives empty view"), Reader.GetChunkView(1).IsValid());
+		}
+	}
+
+	IFileManager::Get().Delete(*Filename);
+	return true;
+}
+
+#endif //WITH_DEV_AUTOMATION_TESTS
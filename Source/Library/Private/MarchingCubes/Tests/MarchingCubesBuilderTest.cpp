@@ -0,0 +1,153 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#include "MarchingCubesBuilder.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace MarchingCubesBuilderTest
+{
+	/** Grid of sphere density, 0.5 at radius */
+	void FillSphere(const FVector& Origin, float VoxelSize, const FIntVector& Dimensions, const FVector& Center, float Radius, FDensityGrid& OutGrid)
+	{
+		OutGrid.Origin = Origin;
+		OutGrid.VoxelSize = FVector(VoxelSize);
+		OutGrid.Dimensions = Dimensions;
+		OutGrid.Densities.SetNumUninitialized(Dimensions.X * Dimensions.Y * Dimensions.Z);
+		for (int32 Z = 0; Z < Dimensions.Z; Z++)
+		{
+			for (int32 Y = 0; Y < Dimensions.Y; Y++)
+			{
+				for (int32 X = 0; X < Dimensions.X; X++)
+				{
+					const FVector Position = Origin + FVector(X, Y, Z) * VoxelSize;
+					OutGrid.Densities[X + Dimensions.X * (Y + Dimensions.Y * Z)] = 0.5f + (Radius - FVector::Dist(Position, Center)) / VoxelSize;
+				}
+			}
+		}
+	}
+
+	/** Edges used by one triangle with both ends on plane X = PlaneX */
+	void GetFaceBoundaryEdges(const TArray<FVector>& Vertices, const TArray<int32>& Indices, float PlaneX, TArray<TPair<FVector, FVector>>& OutEdges)
+	{
+		TMap<TPair<int32, int32>, int32> EdgeUseCount;
+		for (int32 Index = 0; Index < Indices.Num(); Index += 3)
+		{
+			for (int32 Corner = 0; Corner < 3; Corner++)
+			{
+				const int32 A = Indices[Index + Corner];
+				const int32 B = Indices[Index + (Corner + 1) % 3];
+				EdgeUseCount.FindOrAdd(TPair<int32, int32>(FMath::Min(A, B), FMath::Max(A, B)))++;
+			}
+		}
+
+		for (const TPair<TPair<int32, int32>, int32>& Pair : EdgeUseCount)
+		{
+			const FVector& A = Vertices[Pair.Key.Key];
+			const FVector& B = Vertices[Pair.Key.Value];
+			if (Pair.Value == 1 && FMath::IsNearlyEqual(A.X, PlaneX) && FMath::IsNearlyEqual(B.X, PlaneX))
+			{
+				OutEdges.Emplace(A, B);
+			}
+		}
+	}
+
+	/** Largest distance from points along edges to closest of other edges */
+	float GetCoverageGap(const TArray<TPair<FVector, FVector>>& Edges, const TArray<TPair<FVector, FVector>>& OtherEdges)
+	{
+		float MaxGap = 0;
+		for (const TPair<FVector, FVector>& Edge : Edges)
+		{
+			for (int32 Step = 0; Step <= 4; Step++)
+			{
+				const FVector Point = FMath::Lerp(Edge.Key, Edge.Value, Step / 4.f);
+				float Gap = TNumericLimits<float>::Max();
+				for (const TPair<FVector, FVector>& Other : OtherEdges)
+				{
+					Gap = FMath::Min(Gap, FVector::Dist(Point, FMath::ClosestPointOnSegment(Point, Other.Key, Other.Value)));
+				}
+				MaxGap = FMath::Max(MaxGap, Gap);
+			}
+		}
+		return MaxGap;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FMarchingCubesTransitionFaceTest, "Library.MarchingCubes.Builder.TransitionFaceClosed", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FMarchingCubesTransitionFaceTest::RunTest(const FString& Parameters)
+{
+	using namespace MarchingCubesBuilderTest;
+
+	const float VoxelSize = 10;
+	const FVector Center(90, 62, 88);
+	const float Radius = 33;
+
+	// Fine grid on X [0, 80], coarse one on X [80, 240] shares face points of every second fine point
+	FDensityGrid FineGrid;
+	FillSphere(FVector::ZeroVector, VoxelSize, FIntVector(9, 17, 17), Center, Radius, FineGrid);
+
+	FDensityGrid CoarseSource;
+	FillSphere(FVector(80, 0, 0), VoxelSize, FIntVector(17, 17, 17), Center, Radius, CoarseSource);
+	FDensityGrid CoarseGrid;
+	if (!TestTrue(TEXT("Coarse grid is downsampled"), FDensityGrid::Downsample(CoarseSource.GetView(), 2, CoarseGrid))) return false;
+
+	FMarchingCubesBuilder FineBuilder(FineGrid.GetView());
+	FineBuilder.NeighbourLODStride[1] = 2;
+	FineBuilder.Build();
+
+	FMarchingCubesBuilder CoarseBuilder(CoarseGrid.GetView());
+	CoarseBuilder.Build();
+
+	TArray<FVector> FineVertices, CoarseVertices;
+	TArray<int32> FineIndices, CoarseIndices;
+	FineBuilder.GetData(FineVertices, FineIndices);
+	CoarseBuilder.GetData(CoarseVertices, CoarseIndices);
+
+	TArray<TPair<FVector, FVector>> FineEdges, CoarseEdges;
+	GetFaceBoundaryEdges(FineVertices, FineIndices, 80, FineEdges);
+	GetFaceBoundaryEdges(CoarseVertices, CoarseIndices, 80, CoarseEdges);
+	if (!TestTrue(TEXT("Both meshes have border on shared face"), FineEdges.Num() > 0 && CoarseEdges.Num() > 0)) return false;
+
+	// Borders may meet with T-junctions, but every part of one must lie on the other
+	const float Tolerance = VoxelSize * 0.01f;
+	const float FineGap = GetCoverageGap(FineEdges, CoarseEdges);
+	const float CoarseGap = GetCoverageGap(CoarseEdges, FineEdges);
+	TestTrue(FString::Printf(TEXT("Fine border lies on coarse border, gap %f"), FineGap), FineGap <= Tolerance);
+	TestTrue(FString::Printf(TEXT("Coarse border lies on fine border, gap %f"), CoarseGap), CoarseGap <= Tolerance);
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FMarchingCubesVertexCacheTest, "Library.MarchingCubes.Builder.VertexCacheOrder", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FMarchingCubesVertexCacheTest::RunTest(const FString& Parameters)
+{
+	using namespace MarchingCubesBuilderTest;
+
+	FDensityGrid Grid;
+	FillSphere(FVector::ZeroVector, 10, FIntVector(33, 33, 33), FVector(160, 155, 165), 120, Grid);
+
+	FMarchingCubesBuilder Builder(Grid.GetView());
+	Builder.Build();
+
+	TArray<FVector> Vertices;
+	TArray<int32> Indices;
+	Builder.GetData(Vertices, Indices);
+	const int32 SweepTriangleNum = Indices.Num() / 3;
+	const float SweepACMR = FMarchingCubesBuilder::CalcACMR(Indices, Vertices.Num());
+
+	Builder.OptimizeVertexCache();
+	Builder.GetData(Vertices, Indices);
+	const float OptimizedACMR = FMarchingCubesBuilder::CalcACMR(Indices, Vertices.Num());
+
+	AddInfo(FString::Printf(TEXT("Triangles: %d, ACMR: %.3f -> %.3f"), SweepTriangleNum, SweepACMR, OptimizedACMR));
+	TestEqual(TEXT("Reorder keeps triangles"), Indices.Num() / 3, SweepTriangleNum);
+	TestTrue(TEXT("Optimized ACMR is not above sweep order ACMR"), OptimizedACMR <= SweepACMR);
+
+	return true;
+}
+
+#endif //WITH_DEV_AUTOMATION_TESTS
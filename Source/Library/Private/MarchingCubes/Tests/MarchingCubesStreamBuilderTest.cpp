@@ -0,0 +1,98 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#include "MarchingCubesStreamBuilder.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FMarchingCubesStreamBuilderMatchTest, "Library.MarchingCubes.StreamBuilder.MatchesBuilder", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FMarchingCubesStreamBuilderMatchTest::RunTest(const FString& Parameters)
+{
+	// Two overlapping spheres, so some cubes have several triangles
+	FDensityGrid Grid;
+	Grid.Origin = FVector(-50, 20, 0);
+	Grid.VoxelSize = FVector(10, 10, 12);
+	Grid.Dimensions = FIntVector(20, 17, 15);
+	Grid.Densities.SetNumUninitialized(Grid.Dimensions.X * Grid.Dimensions.Y * Grid.Dimensions.Z);
+	for (int32 Z = 0; Z < Grid.Dimensions.Z; Z++)
+	{
+		for (int32 Y = 0; Y < Grid.Dimensions.Y; Y++)
+		{
+			for (int32 X = 0; X < Grid.Dimensions.X; X++)
+			{
+				const FVector Position = Grid.Origin + FVector(X, Y, Z) * Grid.VoxelSize;
+				const float Distance = FMath::Min(FVector::Dist(Position, FVector(30, 100, 80)) - 55, FVector::Dist(Position, FVector(80, 110, 70)) - 35);
+				Grid.Densities[X + Grid.Dimensions.X * (Y + Grid.Dimensions.Y * Z)] = 0.5f - Distance / 10;
+			}
+		}
+	}
+	const int32 SliceSize = Grid.Dimensions.X * Grid.Dimensions.Y;
+
+	TArray<FVector> StreamVertices;
+	TArray<int32> StreamIndices;
+	FMarchingCubesStreamBuilder StreamBuilder(Grid.Dimensions, Grid.Origin, Grid.VoxelSize);
+	const bool Finished = StreamBuilder.Build(
+		[&Grid, SliceSize](int32 SliceZ, TArray<float>& OutDensities)
+		{
+			OutDensities.Append(&Grid.Densities[SliceZ * SliceSize], SliceSize);
+			return true;
+		},
+		[&StreamVertices, &StreamIndices](int32 CubeLayerZ, const TArray<FVector>& NewVertices, const TArray<int32>& NewIndices)
+		{
+			StreamVertices.Append(NewVertices);
+			StreamIndices.Append(NewIndices);
+		});
+	if (!TestTrue(TEXT("Stream is finished"), Finished && StreamIndices.Num() > 0)) return false;
+
+	// Slab sweep of builder visits cubes in same Z, Y, X order
+	{
+		FMarchingCubesBuilder Builder(Grid.GetView());
+		Builder.RestoreLegacyOrder = false;
+		Builder.Build();
+
+		TArray<FVector> Vertices;
+		TArray<int32> Indices;
+		Builder.GetData(Vertices, Indices);
+		TestTrue(TEXT("Same vertices as slab order build"), Vertices == StreamVertices);
+		TestTrue(TEXT("Same indices as slab order build"), Indices == StreamIndices);
+	}
+
+	// Legacy order has triangles in X, Y, Z cube order, compared as sets of corner positions
+	{
+		FMarchingCubesBuilder Builder(Grid.GetView());
+		Builder.Build();
+
+		TArray<FVector> Vertices;
+		TArray<int32> Indices;
+		Builder.GetData(Vertices, Indices);
+
+		auto GetTriangleKeys = [](const TArray<FVector>& TriangleVertices, const TArray<int32>& TriangleIndices)
+		{
+			// Winding is kept, triangle is keyed by smallest rotation of its corners
+			TArray<FString> Keys;
+			for (int32 Index = 0; Index < TriangleIndices.Num(); Index += 3)
+			{
+				const FVector Corners[3] = { TriangleVertices[TriangleIndices[Index]], TriangleVertices[TriangleIndices[Index + 1]], TriangleVertices[TriangleIndices[Index + 2]] };
+				TArray<FString> Rotations;
+				for (int32 First = 0; First < 3; First++)
+				{
+					Rotations.Add(Corners[First].ToString() + Corners[(First + 1) % 3].ToString() + Corners[(First + 2) % 3].ToString());
+				}
+				Rotations.Sort();
+				Keys.Add(Rotations[0]);
+			}
+			Keys.Sort();
+			return Keys;
+		};
+
+		TestEqual(TEXT("Same triangle count as legacy order build"), Indices.Num(), StreamIndices.Num());
+		TestTrue(TEXT("Same triangles as legacy order build up to permutation"), GetTriangleKeys(Vertices, Indices) == GetTriangleKeys(StreamVertices, StreamIndices));
+	}
+
+	return true;
+}
+
+#endif //WITH_DEV_AUTOMATION_TESTS
@@ -2,264 +2,191 @@
 
 #include "CelledSurfaceNavData.h"
 #include "DrawDebugHelpers.h"
+#include "Async/Async.h"
+#include "Containers/Ticker.h"
 
 
 
-FVector FCelledSurfaceNavData::GetNodeCenter(GraphNodeRef NodeRef) const
+void FCelledSurfaceNavData::SetUseCompactVertices(bool NewUseCompactVertices)
 {
-	const FGraphNode& Node = Nodes[NodeRef];
-	return (Vertices[Node.Triangle[0]] + Vertices[Node.Triangle[1]] + Vertices[Node.Triangle[2]]) / 3;
+	UseCompactVertices = NewUseCompactVertices;
 }
 
-FVector FCelledSurfaceNavData::GetNodeVertex(GraphNodeRef NodeRef, int8 VertexIndexFrom0to2) const
-{
-	const FGraphNode& Node = Nodes[NodeRef];
-	return Vertices[Node.Triangle[VertexIndexFrom0to2]];
-}
 
-FCelledSurfaceNavData::GraphNodeRef FCelledSurfaceNavData::GetNodeCloseToLocation(const FVector& WorldLocation) const
-{
-	FIntVector Coordinate = GetCellCoordinate(WorldLocation);	
 
-	const FCellData& Cell = Cells.FindRef(Coordinate);
-	if (Cell.IsEmpty())
+FCelledSurfaceNavData::~FCelledSurfaceNavData()
+{
+	if (FlushTickerHandle.IsValid())
 	{
-		return -1;
+		FTicker::GetCoreTicker().RemoveTicker(FlushTickerHandle);
 	}
-
-	float MinDist = TNumericLimits<float>::Max();
-	GraphNodeRef ClosestNode = -1;
-	for (GraphNodeRef NodeRef : Cell.NodesInside)
+	if (AsyncToken.IsValid() && AsyncToken->Owner == this)
 	{
-		const FGraphNode& Node = Nodes[NodeRef];
-		FPlane Plane(Vertices[Node.Triangle[0]], Vertices[Node.Triangle[1]], Vertices[Node.Triangle[2]]);
-		float CurDist = FMath::Abs(Plane.PlaneDot(WorldLocation));
-
-		if (CurDist < MinDist)
-		{
-			MinDist = CurDist;
-			ClosestNode = NodeRef;
-		}
+		AsyncToken->Owner = nullptr;
 	}
-	return ClosestNode;
-}
-
-bool FCelledSurfaceNavData::HasCellData(const FIntVector& CellCoordinate) const
-{
-	return Cells.Contains(CellCoordinate);
 }
 
-bool FCelledSurfaceNavData::IsCellEmpty(const FIntVector& CellCoordinate) const
+TSharedPtr<const FSurfaceNavSnapshot, ESPMode::ThreadSafe> FCelledSurfaceNavData::GetSnapshot() const
 {
-	const FCellData* Cell = Cells.Find(CellCoordinate);
-	return Cell ? Cell->IsEmpty() : false;
+	FScopeLock Lock(&SnapshotLock);
+	return Snapshot;
 }
 
-
-FCelledSurfaceNavData::FCellData& FCelledSurfaceNavData::GetOrAddCellData(const FIntVector& CellCoordinate)
+void FCelledSurfaceNavData::QueueSnapshotCell(const FIntVector& CellCoordinate, const TSharedPtr<const FSurfaceNavCell, ESPMode::ThreadSafe>& Cell)
 {
-	return Cells.FindOrAdd(CellCoordinate);
-}
+	check(IsInGameThread());
 
+	PendingSnapshotCells.Add(CellCoordinate, Cell);
 
-
-bool FCelledSurfaceNavData::GetCellData(const FIntVector& CellCoordinate, FCellData& OutCellData) const
-{
-	if (const FCellData* find = Cells.Find(CellCoordinate))
+	if (!FlushTickerHandle.IsValid())
 	{
-		OutCellData = *find;
-		return true;
+		FlushTickerHandle = FTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([this](float DeltaTime)
+		{
+			FlushTickerHandle.Reset();
+			FlushSnapshot();
+			return false;
+		}));
 	}
-	OutCellData = FCellData();
-	return false; 
 }
 
-
-
-void FCelledSurfaceNavData::UpdateCell(const FIntVector& CellCoordinate, const FCellCreationData& Data)
+void FCelledSurfaceNavData::FlushSnapshot()
 {
-	ClearCell(CellCoordinate);
-
-	UE_LOG(LogTemp, Warning, TEXT("Coord: %s, Data: Indices: %d, Vertices: %d"), *CellCoordinate.ToString(), Data.CellTriangles.Num(), Data.CellVertices.Num());
-	
-	FCellData& Cell = GetOrAddCellData(CellCoordinate);
-	FBox CellBox = GetCellBox(CellCoordinate);
+	check(IsInGameThread());
 
-	int32 VerticesOutside = 0;
+	if (PendingSnapshotCells.Num() == 0) return;
 
-	Cell.VerticesInside.Reserve(Data.CellVertices.Num());
-	TMap<int32, int32> Remap;
-	for (int Index = 0; Index < Data.CellVertices.Num() ; Index++)
+	// Snapshot is copied once per flush and never changed after publishing, cells are shared between snapshots
+	TSharedRef<FSurfaceNavSnapshot, ESPMode::ThreadSafe> NewSnapshot = Snapshot.IsValid()
+		? MakeShared<FSurfaceNavSnapshot, ESPMode::ThreadSafe>(*Snapshot)
+		: MakeShared<FSurfaceNavSnapshot, ESPMode::ThreadSafe>();
+	NewSnapshot->Center = Center;
+	NewSnapshot->CellSize = CellSize;
+	for (const TPair<FIntVector, TSharedPtr<const FSurfaceNavCell, ESPMode::ThreadSafe>>& Pending : PendingSnapshotCells)
 	{
-		const FVector& Vertex = Data.CellVertices[Index];
-		if (!CellBox.IsInsideOrOn(Vertex))
+		if (Pending.Value.IsValid())
 		{
-			VerticesOutside++;
+			NewSnapshot->Cells.Add(Pending.Key, Pending.Value);
 		}
-
-		int32 AddedAt = Vertices.Add(Vertex);
-		if (AddedAt >= 0)
+		else
 		{
-			Remap.Add(Index, AddedAt);			
+			NewSnapshot->Cells.Remove(Pending.Key);
 		}
-		Cell.VerticesInside.Add(AddedAt);
 	}
+	PendingSnapshotCells.Reset();
 
-	if (VerticesOutside > 0)
+	// Pointers are swapped under lock, old snapshot is released after it, so freeing its cells never blocks readers
+	TSharedPtr<const FSurfaceNavSnapshot, ESPMode::ThreadSafe> OldSnapshot = NewSnapshot;
 	{
-		UE_LOG(LogTemp, Warning, TEXT("Found %d vertices outside cell bounds when updating cell %s"), VerticesOutside, *CellCoordinate.ToString());
+		FScopeLock Lock(&SnapshotLock);
+		Swap(Snapshot, OldSnapshot);
 	}
+}
 
-	// Apply remap to triangle indices
-	TArray<int32> Triangles;
-	Triangles.Reserve(Data.CellTriangles.Num());
-	for (int Index = 0; Index < Data.CellTriangles.Num() ; Index++)
-	{
-		Triangles.Add(Remap[Data.CellTriangles[Index]]);
-	}
+void FCelledSurfaceNavData::UpdateCell(const FIntVector& CellCoordinate, const FCellCreationData& Data)
+{
+	CellBuildVersions.FindOrAdd(CellCoordinate)++;
+	PublishCell(FSurfaceNavCell::Build(CellCoordinate, GetCellBox(CellCoordinate), Data, SortNodesSpatially, UseCompactVertices));
+}
+
+void FCelledSurfaceNavData::UpdateCell(const FIntVector& CellCoordinate, FCellCreationData&& Data)
+{
+	CellBuildVersions.FindOrAdd(CellCoordinate)++;
+	PublishCell(FSurfaceNavCell::Build(CellCoordinate, GetCellBox(CellCoordinate), MoveTemp(Data), SortNodesSpatially, UseCompactVertices));
+}
 
-	TSet<int32> OuterVertices;
-	OuterVertices.Reserve(Data.OuterVertices.Num());
-	for (int Index = 0; Index < Data.OuterVertices.Num(); Index++)
+void FCelledSurfaceNavData::UpdateCellAsync(const FIntVector& CellCoordinate, FCellCreationData&& Data)
+{
+	if (!AsyncToken.IsValid() || AsyncToken->Owner != this)
 	{
-		OuterVertices.Add(Remap[Data.OuterVertices[Index]]);
+		AsyncToken = MakeShared<FAsyncBuildToken, ESPMode::ThreadSafe>();
+		AsyncToken->Owner = this;
 	}
 
-	//Add graph nodes
-	Cell.NodesInside.Reserve(Triangles.Num() / 3);
-	for (int NodeIndex = 0; NodeIndex < Triangles.Num(); NodeIndex += 3)
+	const int32 Version = ++CellBuildVersions.FindOrAdd(CellCoordinate);
+	const int32 Epoch = BuildEpoch;
+	const FBox CellBox = GetCellBox(CellCoordinate);
+	const bool SortSpatially = SortNodesSpatially;
+	const bool Compact = UseCompactVertices;
+	const TWeakPtr<FAsyncBuildToken, ESPMode::ThreadSafe> WeakToken = AsyncToken;
+	const TSharedRef<FCellCreationData, ESPMode::ThreadSafe> SharedData = MakeShared<FCellCreationData, ESPMode::ThreadSafe>(MoveTemp(Data));
+
+	Async(EAsyncExecution::ThreadPool, [=]()
 	{
-		FGraphNode Node(Triangles[NodeIndex + 0], Triangles[NodeIndex + 1], Triangles[NodeIndex + 2]);
-		int32 AddedAt = Nodes.Add(Node);
-		if (AddedAt >= 0)
+		const TSharedRef<const FSurfaceNavCell, ESPMode::ThreadSafe> Cell = FSurfaceNavCell::Build(CellCoordinate, CellBox, MoveTemp(*SharedData), SortSpatially, Compact);
+
+		AsyncTask(ENamedThreads::GameThread, [=]()
 		{
-			Cell.NodesInside.Add(AddedAt);
-			if (OuterVertices.Contains(Node.Triangle[0]) || OuterVertices.Contains(Node.Triangle[1]) || OuterVertices.Contains(Node.Triangle[2]))
+			TSharedPtr<FAsyncBuildToken, ESPMode::ThreadSafe> Token = WeakToken.Pin();
+			if (Token.IsValid() && Token->Owner)
 			{
-				Cell.BoundaryNodes.Add(AddedAt);
+				Token->Owner->FinishAsyncBuild(CellCoordinate, Version, Epoch, Cell);
 			}
-		}
-	}
-	BuildGraphInCell(Cell);	
-
-	AttachToNeighbouringCells(CellCoordinate);
-	
-	UE_LOG(LogTemp, Warning, TEXT("Add. Vertices data: Size: %d, Free: %d, Occupied: %d"), Vertices.NumTotal(), Vertices.NumHoles(), Vertices.NumOccupied());
+		});
+	});
 }
 
-
-
-
-void FCelledSurfaceNavData::ClearCell(const FIntVector& CellCoordinate)
+void FCelledSurfaceNavData::FinishAsyncBuild(const FIntVector& CellCoordinate, int32 Version, int32 Epoch, const TSharedRef<const FSurfaceNavCell, ESPMode::ThreadSafe>& Cell)
 {
-	if (IsCellEmpty(CellCoordinate)) return;
-
-	DetachFromNeighbouringCells(CellCoordinate);
-
-
-	FCellData& Cell = GetOrAddCellData(CellCoordinate);
-	for (int32 Index : Cell.VerticesInside)
-	{
-		Vertices.RemoveAt(Index);
-	}
-	for (int32 Index : Cell.NodesInside)
-	{
-		Nodes.RemoveAt(Index);
-	}	
+	if (Epoch != BuildEpoch || CellBuildVersions.FindRef(CellCoordinate) != Version) return;
 
-	Cell.VerticesInside.Empty();
-	Cell.NodesInside.Empty();
-	Cell.BoundaryNodes.Empty();
-
-	UE_LOG(LogTemp, Warning, TEXT("Clear. Vertices data: Size: %d, Free: %d, Occupied: %d"), Vertices.NumTotal(), Vertices.NumHoles(), Vertices.NumOccupied());
+	PublishCell(Cell);
 }
 
-void FCelledSurfaceNavData::ClearAllCells()
+void FCelledSurfaceNavData::PublishCell(const TSharedRef<const FSurfaceNavCell, ESPMode::ThreadSafe>& Cell)
 {
-	Cells.Empty();
-	Vertices.Empty();
-
-	UE_LOG(LogTemp, Warning, TEXT("Force clear"));
-}
-
-
-
-FIntVector FCelledSurfaceNavData::CellNeighbourOffsets[6] =
-{
-	FIntVector(1, 0, 0),
-	FIntVector(-1, 0, 0),
-
-	FIntVector(0, 1, 0),
-	FIntVector(0, -1, 0),
-
-	FIntVector(0, 0, 1),
-	FIntVector(0, 0, -1)
-};
+	const FIntVector& CellCoordinate = Cell->Coordinate;
 
+	UE_LOG(LogTemp, Log, TEXT("Coord: %s, Nodes: %d, Vertices: %d, Memory: %d"), *CellCoordinate.ToString(), Cell->GetNodesNum(), Cell->GetVerticesNum(), (int32)Cell->GetAllocatedSize());
 
+	QueueSnapshotCell(CellCoordinate, Cell);
 
+	OnCellPublished.ExecuteIfBound(CellCoordinate);
+}
 
-void FCelledSurfaceNavData::AttachToNeighbouringCells(const FIntVector& CellCoordinate)
+TSharedPtr<const FSurfaceNavCell, ESPMode::ThreadSafe> FCelledSurfaceNavData::FindLatestCell(const FIntVector& CellCoordinate) const
 {
-	if (IsCellEmpty(CellCoordinate)) return;
-	
-	
-	for (int Index = 0; Index < 6 ; Index++)
+	if (const TSharedPtr<const FSurfaceNavCell, ESPMode::ThreadSafe>* Pending = PendingSnapshotCells.Find(CellCoordinate))
 	{
-		FIntVector NeighbourCell = CellCoordinate + CellNeighbourOffsets[Index];
-		if(IsCellEmpty(NeighbourCell)) continue;
-		StitchCells(GetOrAddCellData(CellCoordinate), GetOrAddCellData(NeighbourCell));
+		return *Pending;
 	}
+	if (Snapshot.IsValid())
+	{
+		if (const TSharedPtr<const FSurfaceNavCell, ESPMode::ThreadSafe>* Published = Snapshot->Cells.Find(CellCoordinate))
+		{
+			return *Published;
+		}
+	}
+	return nullptr;
 }
 
-void FCelledSurfaceNavData::DetachFromNeighbouringCells(const FIntVector& CellCoordinate)
+void FCelledSurfaceNavData::ClearCell(const FIntVector& CellCoordinate)
 {
-	if (IsCellEmpty(CellCoordinate)) return;	
+	CellBuildVersions.FindOrAdd(CellCoordinate)++;
 
-	for (int Index = 0; Index < 6; Index++)
+	if (PendingSnapshotCells.Contains(CellCoordinate) || (Snapshot.IsValid() && Snapshot->Cells.Contains(CellCoordinate)))
 	{
-		FIntVector NeighbourCell = CellCoordinate + CellNeighbourOffsets[Index];
-		if (IsCellEmpty(NeighbourCell)) continue;		
-		RipCells(GetOrAddCellData(CellCoordinate), GetOrAddCellData(NeighbourCell));
+		QueueSnapshotCell(CellCoordinate, nullptr);
 	}
 }
 
-void FCelledSurfaceNavData::StitchCells(FCellData& A, FCellData& B)
-{
-	//#todo Stitching algorithm
-}
-
-void FCelledSurfaceNavData::RipCells(FCellData& A, FCellData& B)
+void FCelledSurfaceNavData::ClearAllCells()
 {
-	//#todo ripping algorithm
-}
+	// Background builds started before are dropped
+	BuildEpoch++;
+	CellBuildVersions.Empty();
 
-void FCelledSurfaceNavData::BuildGraphInCell(FCellData& Cell)
-{
-	//#todo fast graph building algorithm
+	PendingSnapshotCells.Empty();
 
-	// Dumb method as proof of concept
-	for (int NodeIndex = 0; NodeIndex < Cell.NodesInside.Num(); NodeIndex++)
+	TSharedPtr<const FSurfaceNavSnapshot, ESPMode::ThreadSafe> OldSnapshot;
 	{
-		GraphNodeRef CurrentNodeRef = Cell.NodesInside[NodeIndex];
-		FGraphNode& CurrentNode = Nodes.GetRef(CurrentNodeRef);
+		FScopeLock Lock(&SnapshotLock);
+		Swap(Snapshot, OldSnapshot);
+	}
 
-		for (int Index = 0; Index < Cell.NodesInside.Num(); Index++)
-		{
-			GraphNodeRef OtherNodeRef = Cell.NodesInside[Index];
-			if (OtherNodeRef == CurrentNodeRef) continue;
+	UE_LOG(LogTemp, Warning, TEXT("Force clear"));
+}
 
-			const FGraphNode& OtherNode = Nodes[OtherNodeRef];
 
-			if (CurrentNode.IsConnectedTo(OtherNode))
-			{
-				CurrentNode.Neighbours.AddUnique(OtherNodeRef);
-			}
-		}
-
-		Nodes.ValidateAt(CurrentNodeRef);
-	}
-}
 
 float FCelledSurfaceNavData::GetCellSize() const
 {
@@ -312,11 +239,9 @@ TArray<FIntVector> FCelledSurfaceNavData::GetCellsContainingBox(const FBox& Worl
 
 bool FCelledSurfaceNavData::ProjectPointToNavigation(const FVector& WorldLocation, FVector& OutLocation) const
 {
-	GraphNodeRef NodeRef = GetNodeCloseToLocation(WorldLocation);
-	if (NodeRef < 0) return false;
-	
-	OutLocation = GetNodeCenter(NodeRef);
-	return true;
+	// Snapshot keeps working while cells are updated
+	TSharedPtr<const FSurfaceNavSnapshot, ESPMode::ThreadSafe> CurrentSnapshot = GetSnapshot();
+	return CurrentSnapshot.IsValid() && CurrentSnapshot->ProjectPointToNavigation(WorldLocation, OutLocation);
 }
 
 void FCelledSurfaceNavData::DrawCellBounds(const FIntVector& CellCoords, FColor CellColor, float Lifetime /*= 1*/, float Thickness /*= 0*/) const
@@ -338,46 +263,66 @@ void FCelledSurfaceNavData::DrawCellGraph(const FIntVector& CellCoords, float Li
 	const float EdgeSize = 1;
 	const float LinkSize = 2;
 
-	const FCellData& CellData = Cells.FindRef(CellCoords);
-	if (CellData.IsEmpty()) return;
-	
-	for (int32 Vertex : CellData.VerticesInside)
+	const TSharedPtr<const FSurfaceNavCell, ESPMode::ThreadSafe> Cell = FindLatestCell(CellCoords);
+	if (!Cell.IsValid()) return;
+
+	TSharedPtr<const FSurfaceNavCell, ESPMode::ThreadSafe> NeighbourCells[6];
+	for (int Face = 0; Face < 6; Face++)
 	{
-		check(Vertices.IsElementAt(Vertex));
-		DrawDebugPoint(World, Vertices[Vertex], VertexSize, VertexColor, false, Lifetime);
+		NeighbourCells[Face] = FindLatestCell(CellCoords + FSurfaceNavCell::FaceOffsets[Face]);
 	}
 
-	for (GraphNodeRef NodeRef : CellData.NodesInside)
+	for (int32 Vertex = 0; Vertex < Cell->GetVerticesNum(); Vertex++)
 	{
-		const FGraphNode& Node = Nodes[NodeRef];
+		DrawDebugPoint(World, Cell->GetVertex(Vertex), VertexSize, VertexColor, false, Lifetime);
+	}
 
-		FVector NodeCenter = GetNodeCenter(NodeRef);
+	for (int32 Node = 0; Node < Cell->GetNodesNum(); Node++)
+	{
+		const FVector NodeCenter = Cell->GetNodeCenter(Node);
+		const FVector Corners[3] = { Cell->GetVertex(Cell->Triangles[Node * 3]), Cell->GetVertex(Cell->Triangles[Node * 3 + 1]), Cell->GetVertex(Cell->Triangles[Node * 3 + 2]) };
 
 		DrawDebugPoint(World, NodeCenter, LinkSize, LinkColor, false, Lifetime);
-		DrawDebugLine(World, Vertices[Node.Triangle[1]], Vertices[Node.Triangle[0]], EdgeColor, false, Lifetime, 0, EdgeSize);
-		DrawDebugLine(World, Vertices[Node.Triangle[2]], Vertices[Node.Triangle[1]], EdgeColor, false, Lifetime, 0, EdgeSize);
-		DrawDebugLine(World, Vertices[Node.Triangle[0]], Vertices[Node.Triangle[2]], EdgeColor, false, Lifetime, 0, EdgeSize);
-
-		for (GraphNodeRef ConnectedNodeRef : Node.Neighbours)
-		{			
-			FVector NodeCenter2 = GetNodeCenter(ConnectedNodeRef);
-			DrawDebugLine(World, NodeCenter, NodeCenter2, LinkColor, false, Lifetime, 0, LinkSize);
+		DrawDebugLine(World, Corners[1], Corners[0], EdgeColor, false, Lifetime, 0, EdgeSize);
+		DrawDebugLine(World, Corners[2], Corners[1], EdgeColor, false, Lifetime, 0, EdgeSize);
+		DrawDebugLine(World, Corners[0], Corners[2], EdgeColor, false, Lifetime, 0, EdgeSize);
+
+		for (int32 Neighbour : Cell->GetNeighbours(Node))
+		{
+			DrawDebugLine(World, NodeCenter, Cell->GetNodeCenter(Neighbour), LinkColor, false, Lifetime, 0, LinkSize);
+		}
+
+		// Same links across faces as pathfinding follows
+		for (const FSurfaceNavCell::FFaceEdge& Edge : Cell->GetFaceEdges(Node))
+		{
+			const FSurfaceNavCell* NeighbourCell = NeighbourCells[Edge.Face].Get();
+			if (NeighbourCell == nullptr) continue;
+
+			for (TMultiMap<FSurfaceNavEdgeKey, int32>::TConstKeyIterator It = NeighbourCell->FaceEdgeNodes.CreateConstKeyIterator(Edge.Key); It; ++It)
+			{
+				DrawDebugLine(World, NodeCenter, NeighbourCell->GetNodeCenter(It.Value()), LinkColor, false, Lifetime, 0, LinkSize);
+			}
 		}
 	}
 }
 
 void FCelledSurfaceNavData::DrawGraph(float Lifetime /*= 5*/) const
 {
-	TArray<FIntVector> CellCoords;
-	Cells.GenerateKeyArray(CellCoords);
-	for (FIntVector Coord : CellCoords)
+	TSet<FIntVector> CellCoords;
+	if (Snapshot.IsValid())
+	{
+		for (const TPair<FIntVector, TSharedPtr<const FSurfaceNavCell, ESPMode::ThreadSafe>>& Cell : Snapshot->Cells)
+		{
+			CellCoords.Add(Cell.Key);
+		}
+	}
+	for (const TPair<FIntVector, TSharedPtr<const FSurfaceNavCell, ESPMode::ThreadSafe>>& Pending : PendingSnapshotCells)
+	{
+		CellCoords.Add(Pending.Key);
+	}
+
+	for (const FIntVector& Coord : CellCoords)
 	{
 		DrawCellGraph(Coord, Lifetime);
 	}
 }
-
-
-
-
-
-
@@ -0,0 +1,117 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "DensitySource.h"
+
+
+
+void FAnalyticDensitySource::SampleBatch(const FVector* Positions, int32 Num, float* OutDensities) const
+{
+	SampleDistances(Positions, Num, OutDensities);
+
+	const float InvFalloff = 0.5f / FMath::Max(Falloff, KINDA_SMALL_NUMBER);
+	for (int32 Index = 0; Index < Num; Index++)
+	{
+		OutDensities[Index] = FMath::Clamp(0.5f - OutDensities[Index] * InvFalloff, 0.f, 1.f);
+	}
+}
+
+void FAnalyticDensitySource::SampleDistances(const FVector* Positions, int32 Num, float* OutDistances) const
+{
+	float X[BatchSize];
+	float Y[BatchSize];
+	float Z[BatchSize];
+	float Distances[BatchSize];
+
+	for (int32 BatchStart = 0; BatchStart < Num; BatchStart += BatchSize)
+	{
+		const int32 BatchNum = FMath::Min(BatchSize, Num - BatchStart);
+		float* BatchOut = OutDistances + BatchStart;
+
+		for (int32 Index = 0; Index < BatchNum; Index++)
+		{
+			BatchOut[Index] = MAX_FLT;
+		}
+
+		for (const FAnalyticShape& Shape : Shapes)
+		{
+			// Transform to local space once per shape, distance functions then run over plain float arrays
+			for (int32 Index = 0; Index < BatchNum; Index++)
+			{
+				const FVector Local = Shape.Transform.InverseTransformPosition(Positions[BatchStart + Index]);
+				X[Index] = Local.X;
+				Y[Index] = Local.Y;
+				Z[Index] = Local.Z;
+			}
+
+			ShapeDistances(Shape, X, Y, Z, BatchNum, Distances);
+
+			// Local distances are scaled back to world. Exact for uniform scale, smallest axis keeps non uniform scale conservative
+			const float Scale = Shape.Transform.GetScale3D().GetAbsMin();
+			if (Scale != 1.f)
+			{
+				for (int32 Index = 0; Index < BatchNum; Index++)
+				{
+					Distances[Index] *= Scale;
+				}
+			}
+
+			if (Shape.Subtract)
+			{
+				for (int32 Index = 0; Index < BatchNum; Index++)
+				{
+					BatchOut[Index] = FMath::Max(BatchOut[Index], -Distances[Index]);
+				}
+			}
+			else
+			{
+				for (int32 Index = 0; Index < BatchNum; Index++)
+				{
+					BatchOut[Index] = FMath::Min(BatchOut[Index], Distances[Index]);
+				}
+			}
+		}
+	}
+}
+
+void FAnalyticDensitySource::ShapeDistances(const FAnalyticShape& Shape, const float* X, const float* Y, const float* Z, int32 Num, float* OutDistances)
+{
+	const FVector& E = Shape.Extent;
+
+	switch (Shape.Type)
+	{
+	case EAnalyticShapeType::Box:
+		for (int32 Index = 0; Index < Num; Index++)
+		{
+			const float QX = FMath::Abs(X[Index]) - E.X;
+			const float QY = FMath::Abs(Y[Index]) - E.Y;
+			const float QZ = FMath::Abs(Z[Index]) - E.Z;
+			const float OX = FMath::Max(QX, 0.f);
+			const float OY = FMath::Max(QY, 0.f);
+			const float OZ = FMath::Max(QZ, 0.f);
+			OutDistances[Index] = FMath::Sqrt(OX * OX + OY * OY + OZ * OZ) + FMath::Min(FMath::Max3(QX, QY, QZ), 0.f);
+		}
+		break;
+
+	case EAnalyticShapeType::Sphere:
+		for (int32 Index = 0; Index < Num; Index++)
+		{
+			OutDistances[Index] = FMath::Sqrt(X[Index] * X[Index] + Y[Index] * Y[Index] + Z[Index] * Z[Index]) - E.X;
+		}
+		break;
+
+	case EAnalyticShapeType::Capsule:
+		for (int32 Index = 0; Index < Num; Index++)
+		{
+			const float QZ = Z[Index] - FMath::Clamp(Z[Index], -E.Z, E.Z);
+			OutDistances[Index] = FMath::Sqrt(X[Index] * X[Index] + Y[Index] * Y[Index] + QZ * QZ) - E.X;
+		}
+		break;
+
+	case EAnalyticShapeType::Plane:
+		for (int32 Index = 0; Index < Num; Index++)
+		{
+			OutDistances[Index] = Z[Index];
+		}
+		break;
+	}
+}
@@ -13,9 +13,9 @@ DECLARE_DWORD_COUNTER_STAT(TEXT("SurfaceNavigation ~ CellsNumber"), STAT_CellsNu
 
 
 
-bool FSurfaceNavBuilder::BuildGraph(const TArray<FVector4>& Points, const FIntVector& Dimensions, TArray<FEdgeData>& OutGraph)
+bool FSurfaceNavBuilder::BuildGraph(const FDensityGridView& Grid, TArray<FEdgeData>& OutGraph)
 {
-	if (BuildGraph_Internal(Points, Dimensions, SurfaceValue, AllEdges))
+	if (BuildGraph_Internal(Grid, SurfaceValue, AllEdges))
 	{
 		CleanUp();
 		OutGraph = MoveTemp(AllEdges);
@@ -25,18 +25,30 @@ bool FSurfaceNavBuilder::BuildGraph(const TArray<FVector4>& Points, const FIntVe
 	return false;
 }
 
-bool FSurfaceNavBuilder::BuildGraph(const TArray<FVector4>& Points, const FIntVector& Dimensions, FSurfaceNavLocalData& SaveTarget)
+bool FSurfaceNavBuilder::BuildGraph(const FDensityGridView& Grid, FSurfaceNavLocalData& SaveTarget)
 {
-	if (BuildGraph_Internal(Points, Dimensions, SurfaceValue, AllEdges))
+	if (BuildGraph_Internal(Grid, SurfaceValue, AllEdges))
 	{
 		CleanUp();
-		SaveTarget.SetGraph(AllEdges, Dimensions);
+		SaveTarget.SetGraph(AllEdges, Grid.Dimensions);
 		return true;
 	}
 
 	return false;
 }
 
+bool FSurfaceNavBuilder::BuildGraph(const TArray<FVector4>& Points, const FIntVector& Dimensions, TArray<FEdgeData>& OutGraph)
+{
+	FDensityGrid Grid;
+	return FDensityGrid::FromPoints(Points, Dimensions, Grid) && BuildGraph(Grid.GetView(), OutGraph);
+}
+
+bool FSurfaceNavBuilder::BuildGraph(const TArray<FVector4>& Points, const FIntVector& Dimensions, FSurfaceNavLocalData& SaveTarget)
+{
+	FDensityGrid Grid;
+	return FDensityGrid::FromPoints(Points, Dimensions, Grid) && BuildGraph(Grid.GetView(), SaveTarget);
+}
+
 void FSurfaceNavBuilder::CleanUp()
 {
 	SCOPE_CYCLE_COUNTER(STAT_CleanUp);
@@ -69,19 +81,14 @@ void FSurfaceNavBuilder::CleanUp()
 
 
 
-bool FSurfaceNavBuilder::BuildGraph_Internal(const TArray<FVector4>& Points, const FIntVector& PointsDimensions, float SurfaceValue, TArray<FEdgeData>& OutEdges)
+bool FSurfaceNavBuilder::BuildGraph_Internal(const FDensityGridView& Grid, float SurfaceValue, TArray<FEdgeData>& OutEdges)
 {	
-	if (Points.Num() < PointsDimensions.X*PointsDimensions.Y*PointsDimensions.Z) return false;
+	if (!Grid.IsValid()) return false;
 
 	SCOPE_CYCLE_COUNTER(STAT_Build);
-	SET_DWORD_STAT(STAT_CellsNumber, PointsDimensions.X*PointsDimensions.Y*PointsDimensions.Z);
-
-	Dimensions = PointsDimensions;
-
+	SET_DWORD_STAT(STAT_CellsNumber, Grid.GetPointsNum());
 
-	int SizeX = Dimensions.X;
-	int	SizeXY = Dimensions.X * Dimensions.Y;
-	auto GetPointIndex = [SizeX, SizeXY](int x, int y, int z) {	return x + y * SizeX + z * SizeXY; };
+	Dimensions = Grid.Dimensions;
 
 	StorageOffset = Dimensions.X*Dimensions.Y*Dimensions.Z;
 	
@@ -97,15 +104,15 @@ bool FSurfaceNavBuilder::BuildGraph_Internal(const TArray<FVector4>& Points, con
 			{
 				FCell Cell = {
 					{
-						Points[GetPointIndex(X,		Y,		Z)],
-						Points[GetPointIndex(X + 1, Y,		Z)],
-						Points[GetPointIndex(X + 1, Y + 1,	Z)],
-						Points[GetPointIndex(X,		Y + 1,	Z)],
-
-						Points[GetPointIndex(X,		Y,		Z + 1)],
-						Points[GetPointIndex(X + 1, Y,		Z + 1)],
-						Points[GetPointIndex(X + 1, Y + 1,	Z + 1)],
-						Points[GetPointIndex(X,		Y + 1,	Z + 1)]
+						Grid.GetPoint(X,		Y,		Z),
+						Grid.GetPoint(X + 1,	Y,		Z),
+						Grid.GetPoint(X + 1,	Y + 1,	Z),
+						Grid.GetPoint(X,		Y + 1,	Z),
+
+						Grid.GetPoint(X,		Y,		Z + 1),
+						Grid.GetPoint(X + 1,	Y,		Z + 1),
+						Grid.GetPoint(X + 1,	Y + 1,	Z + 1),
+						Grid.GetPoint(X,		Y + 1,	Z + 1)
 					},
 					FIntVector(X, Y, Z)
 				};
@@ -2,14 +2,174 @@
 
 #include "SurfaceSampler.h"
 #include "DrawDebugHelpers.h"
+#include "Async/ParallelFor.h"
+#include "Async/Async.h"
+#include "GameFramework/PlayerController.h"
+#include "Camera/PlayerCameraManager.h"
+#include "Components/PrimitiveComponent.h"
+#include "Engine/World.h"
 
 
 
+/** Coarse to fine overlap sampling, same strategy as UOctreeTesterComponent::UpdateCells */
+struct FSamplingTask::FHierarchicalSampling
+{
+	const FSamplingTask* Task;
+
+	FSamplerResult* Result;
+
+	int32 TestsDone;
+
+	// World location of first point
+	FVector FirstPoint;
+
+	FVector CellSize;
+
+	const FCollisionObjectQueryParams& QueryParameters;
+
+	const FCollisionQueryParams& Params;
+
+	/** Test box covering points in [Min, Max), split it in octants if it overlaps */
+	void SampleRegion(const FIntVector& Min, const FIntVector& Max)
+	{
+		const FIntVector Size = Max - Min;
+		const FVector Center = FirstPoint + (FVector(Min) + FVector(Max - FIntVector(1))) * 0.5f * CellSize;
+		const FVector Extent = FVector(Size) * CellSize * 0.5f;
+
+		if (Task->IsCancelled()) return;
+
+		TestsDone++;
+		const bool WasOverlap = Task->World->OverlapAnyTestByObjectType(Center, FQuat::Identity, QueryParameters, FCollisionShape::MakeBox(Extent), Params);
+		if (!WasOverlap) return;
+
+		if (Size.X == 1 && Size.Y == 1 && Size.Z == 1)
+		{
+			const FIntVector& Dimensions = Result->Dimensions;
+			if (Task->Parameters.bOccupancyOnly)
+			{
+				FOccupancyMask::SetBit(Result->Grid.OccupancyWords.GetData() + (Min.Y + Dimensions.Y * Min.Z) * FOccupancyMask::GetWordsPerRow(Dimensions.X), Min.X);
+			}
+			else
+			{
+				Result->Grid.ByteDensities[Min.X + Dimensions.X * (Min.Y + Dimensions.Y * Min.Z)] = 255;
+			}
+
+			if (Task->Parameters.bDrawDebug && IsInGameThread())
+			{
+				DrawDebugPoint(Task->World, Center, 5, FColor::White, false, 10);
+			}
+			return;
+		}
+
+		const FIntVector Half = Min + FIntVector((Size.X + 1) / 2, (Size.Y + 1) / 2, (Size.Z + 1) / 2);
+		for (int32 Octant = 0; Octant < 8; Octant++)
+		{
+			const FIntVector ChildMin(
+				(Octant & 1) ? Half.X : Min.X,
+				(Octant & 2) ? Half.Y : Min.Y,
+				(Octant & 4) ? Half.Z : Min.Z);
+			const FIntVector ChildMax(
+				(Octant & 1) ? Max.X : Half.X,
+				(Octant & 2) ? Max.Y : Half.Y,
+				(Octant & 4) ? Max.Z : Half.Z);
+
+			if (ChildMin.X < ChildMax.X && ChildMin.Y < ChildMax.Y && ChildMin.Z < ChildMax.Z)
+			{
+				SampleRegion(ChildMin, ChildMax);
+			}
+		}
+	}
+};
+
+
+
+
+
+
+FCollisionObjectQueryParams FSamplingTask::GetObjectQueryParameters()
+{
+	FCollisionObjectQueryParams QueryParameters;
+	QueryParameters.AddObjectTypesToQuery(ECC_WorldStatic);
+	QueryParameters.AddObjectTypesToQuery(ECC_WorldDynamic);
+	return QueryParameters;
+}
+
+void FSamplingTask::Reset(const UWorld* InWorld, const FBox& InSampleBox, const SamplingTaskParameters& Params)
+{
+	World = InWorld;
+	SampleBox = InSampleBox;
+	Parameters = Params;
+	Priority = 0;
+	CollisionHash.Reset();
+	bCacheChecked = false;
+	Result.Reset();
+	SharedResult.Reset();
+	bCancelled = false;
+	Future = TFuture<void>();
+	OnFinish.Unbind();
+	SetState(TaskState::Waiting);
+}
 
+void FSamplingTask::Sample()
+{
+	SetState(TaskState::InProgress);
+	ExecuteSampling();
+}
 
+void FSamplingTask::ExecuteSampling()
+{
+	Result.Reset();
+	SampleData(Result);
+
+	if (IsCancelled())
+	{
+		Result.Reset();
+		SetState(TaskState::DataExtracted);
+		return;
+	}
+	SetState(TaskState::DataReady);
+}
+
+void FSamplingTask::Deliver()
+{
+	if (!IsDataReady()) return;
+
+	if (!IsCancelled())
+	{
+		OnFinish.ExecuteIfBound(GetResult());
+	}
+	Result.Reset();
+	SharedResult.Reset();
+	SetState(TaskState::DataExtracted);
+}
+
+void FSamplingTask::Cancel()
+{
+	bCancelled = true;
+
+	// Active task stops on its own and discards data
+	if (IsWaiting() || IsDataReady())
+	{
+		Result.Reset();
+		SharedResult.Reset();
+		SetState(TaskState::DataExtracted);
+	}
+}
+
+int32 FSamplingTask::GetBatchSlices(int32 SlicesNum)
+{
+	const int32 BatchesNum = FMath::Max(FTaskGraphInterface::Get().GetNumWorkerThreads(), 1) * 2;
+	return FMath::Max(FMath::DivideAndRoundUp(SlicesNum, BatchesNum), 1);
+}
 
 void FSamplingTask::SampleData(FSamplerResult& OutResult)
 {
+	if (Parameters.Source.IsValid())
+	{
+		SampleSource(OutResult);
+		return;
+	}
+
 	float VoxelSize = FMath::Max(FMath::Abs(Parameters.VoxelSize), 10.0f);
 
 	const FVector BoxCenter = SampleBox.GetCenter();
@@ -24,41 +184,536 @@ void FSamplingTask::SampleData(FSamplerResult& OutResult)
 
 	const FCollisionShape TestBox = FCollisionShape::MakeBox(FVector(CellSize / 2));
 
-	FCollisionObjectQueryParams QueryParameters;
-	QueryParameters.AddObjectTypesToQuery(ECC_WorldStatic);
-	QueryParameters.AddObjectTypesToQuery(ECC_WorldDynamic);
+	const FCollisionObjectQueryParams QueryParameters = GetObjectQueryParameters();
 
 	FCollisionQueryParams Params;
 	Params.bFindInitialOverlaps = true;
 
 	OutResult.Box = SampleBox;
 	OutResult.Dimensions = Dimensions;
-	OutResult.Points.Reset(Dimensions.X*Dimensions.Y*Dimensions.Z);
-	for (int Z = 0; Z < Dimensions.Z; Z++)
+
+	FDensityGrid& Grid = OutResult.Grid;
+	Grid.Origin = Parameters.bSaveInWorldSpace ? BoxCenter + CellOffset : CellOffset;
+	Grid.VoxelSize = CellSize;
+	Grid.Dimensions = Dimensions;
+	OutResult.WorstCaseTestsDone = Dimensions.X*Dimensions.Y*Dimensions.Z;
+	OutResult.TestsDone = 0;
+
+	// Points are split in batches of Z slices, overlap queries of batches run in parallel
+	const int32 BatchSlices = GetBatchSlices(Dimensions.Z);
+	const int32 BatchesNum = FMath::DivideAndRoundUp(Dimensions.Z, BatchSlices);
+	TArray<int32> BatchTestsDone;
+	BatchTestsDone.SetNumZeroed(BatchesNum);
+
+	if (Parameters.bHierarchical)
+	{
+		// Empty regions are left zeroed, only regions that overlap something are split further
+		if (Parameters.bOccupancyOnly)
+		{
+			Grid.OccupancyWords.SetNumZeroed(FOccupancyMask::GetWordsNum(Dimensions));
+		}
+		else
+		{
+			Grid.ByteDensities.SetNumZeroed(Dimensions.X*Dimensions.Y*Dimensions.Z);
+		}
+
+		ParallelFor(BatchesNum, [&](int32 BatchIndex)
+		{
+			const FIntVector Min(0, 0, BatchIndex * BatchSlices);
+			const FIntVector Max(Dimensions.X, Dimensions.Y, FMath::Min(Min.Z + BatchSlices, Dimensions.Z));
+
+			FHierarchicalSampling Sampling{ this, &OutResult, 0, BoxCenter + CellOffset, CellSize, QueryParameters, Params };
+			Sampling.SampleRegion(Min, Max);
+			BatchTestsDone[BatchIndex] = Sampling.TestsDone;
+		});
+	}
+	else
 	{
-		for (int Y = 0; Y < Dimensions.Y; Y++)
+		if (Parameters.bOccupancyOnly)
+		{
+			Grid.OccupancyWords.SetNumZeroed(FOccupancyMask::GetWordsNum(Dimensions));
+		}
+		else
 		{
-			for (int X = 0; X < Dimensions.X; X++)
+			Grid.ByteDensities.SetNumUninitialized(Dimensions.X*Dimensions.Y*Dimensions.Z);
+		}
+
+		ParallelFor(BatchesNum, [&](int32 BatchIndex)
+		{
+			const int32 EndZ = FMath::Min((BatchIndex + 1) * BatchSlices, Dimensions.Z);
+			for (int Z = BatchIndex * BatchSlices; Z < EndZ && !IsCancelled(); Z++)
 			{
-				FVector TestLocation = FVector(X, Y, Z) * CellSize + CellOffset;
-				FVector WorldLocation = BoxCenter + TestLocation;
-				bool WasOverlap = World->OverlapAnyTestByObjectType(WorldLocation, FQuat::Identity, QueryParameters, TestBox, Params);
+				for (int Y = 0; Y < Dimensions.Y; Y++)
+				{
+					for (int X = 0; X < Dimensions.X; X++)
+					{
+						FVector TestLocation = FVector(X, Y, Z) * CellSize + CellOffset;
+						FVector WorldLocation = BoxCenter + TestLocation;
+						bool WasOverlap = World->OverlapAnyTestByObjectType(WorldLocation, FQuat::Identity, QueryParameters, TestBox, Params);
+
+						if (Parameters.bDrawDebug && IsInGameThread())
+						{
+							DrawDebugPoint(World, WorldLocation, 5, FColor::White, false, 10);
+						}
+
+						if (Parameters.bOccupancyOnly)
+						{
+							if (WasOverlap)
+							{
+								FOccupancyMask::SetBit(Grid.OccupancyWords.GetData() + (Y + Dimensions.Y * Z) * FOccupancyMask::GetWordsPerRow(Dimensions.X), X);
+							}
+						}
+						else
+						{
+							Grid.ByteDensities[X + Dimensions.X * (Y + Dimensions.Y * Z)] = WasOverlap ? 255 : 0;
+						}
+					}
+				}
+				BatchTestsDone[BatchIndex] += Dimensions.X * Dimensions.Y;
+			}
+		});
+	}
+
+	for (int32 BatchTests : BatchTestsDone)
+	{
+		OutResult.TestsDone += BatchTests;
+	}
+
+	if (Parameters.bDrawDebug && IsInGameThread())
+	{
+		DrawDebugBox(World, BoxCenter, BoxExtent, FQuat::Identity, FColor::White, false, 10, 0, 1);
+	}
+
+	UE_LOG(SurfaceNavigation, Log, TEXT("Sampled box:%s, voxel:%.5g, dimensions:%s, pointsNum:%d, tests:%d/%d"), *OutResult.Box.GetExtent().ToString(), VoxelSize, *OutResult.Dimensions.ToString(), OutResult.WorstCaseTestsDone, OutResult.TestsDone, OutResult.WorstCaseTestsDone);
+		
+}
+
+void FSamplingTask::SampleSource(FSamplerResult& OutResult)
+{
+	float VoxelSize = FMath::Max(FMath::Abs(Parameters.VoxelSize), 10.0f);
+
+	const FVector BoxCenter = SampleBox.GetCenter();
+	const FVector BoxExtent = SampleBox.GetExtent();
+
+	const FVector CellSize = FVector(VoxelSize);
+	const FVector CellOffset = -BoxExtent + CellSize / 2;
+
+	FIntVector Dimensions = FIntVector(BoxExtent * 2 / CellSize + 1);
+
+	OutResult.Box = SampleBox;
+	OutResult.Dimensions = Dimensions;
+
+	FDensityGrid& Grid = OutResult.Grid;
+	Grid.Origin = Parameters.bSaveInWorldSpace ? BoxCenter + CellOffset : CellOffset;
+	Grid.VoxelSize = CellSize;
+	Grid.Dimensions = Dimensions;
+	if (Parameters.bOccupancyOnly)
+	{
+		Grid.OccupancyWords.SetNumZeroed(FOccupancyMask::GetWordsNum(Dimensions));
+	}
+	else
+	{
+		Grid.Densities.SetNumUninitialized(Dimensions.X*Dimensions.Y*Dimensions.Z);
+	}
 
-				if (Parameters.bDrawDebug)
+	const int32 BatchSlices = GetBatchSlices(Dimensions.Z);
+	const int32 BatchesNum = FMath::DivideAndRoundUp(Dimensions.Z, BatchSlices);
+	ParallelFor(BatchesNum, [&](int32 BatchIndex)
+	{
+		TArray<FVector> RowPositions;
+		RowPositions.SetNumUninitialized(Dimensions.X);
+
+		TArray<float> RowDensities;
+		if (Parameters.bOccupancyOnly)
+		{
+			RowDensities.SetNumUninitialized(Dimensions.X);
+		}
+
+		const int32 EndZ = FMath::Min((BatchIndex + 1) * BatchSlices, Dimensions.Z);
+		for (int Z = BatchIndex * BatchSlices; Z < EndZ && !IsCancelled(); Z++)
+		{
+			for (int Y = 0; Y < Dimensions.Y; Y++)
+			{
+				for (int X = 0; X < Dimensions.X; X++)
 				{
-					DrawDebugPoint(World, WorldLocation, 5, FColor::White, false, 10);
+					RowPositions[X] = BoxCenter + FVector(X, Y, Z) * CellSize + CellOffset;
 				}
+				if (Parameters.bOccupancyOnly)
+				{
+					Parameters.Source->SampleBatch(RowPositions.GetData(), Dimensions.X, RowDensities.GetData());
 
-				OutResult.Points.Add(FVector4(Parameters.bSaveInWorldSpace ? WorldLocation : TestLocation, WasOverlap ? 1 : 0));
+					uint64* RowWords = Grid.OccupancyWords.GetData() + (Y + Dimensions.Y * Z) * FOccupancyMask::GetWordsPerRow(Dimensions.X);
+					for (int X = 0; X < Dimensions.X; X++)
+					{
+						RowWords[X / 64] |= uint64(RowDensities[X] > 0.5f) << (X % 64);
+					}
+				}
+				else
+				{
+					Parameters.Source->SampleBatch(RowPositions.GetData(), Dimensions.X, &Grid.Densities[Dimensions.X * (Y + Dimensions.Y * Z)]);
+				}
 			}
 		}
-	}
-	if (Parameters.bDrawDebug)
+	});
+
+	if (Parameters.bDrawDebug && World && IsInGameThread())
 	{
 		DrawDebugBox(World, BoxCenter, BoxExtent, FQuat::Identity, FColor::White, false, 10, 0, 1);
 	}
 
-	UE_LOG(SurfaceNavigation, Log, TEXT("Sampled box:%s, voxel:%.5g, dimensions:%s, pointsNum:%d"), *OutResult.Box.GetExtent().ToString(), VoxelSize, *OutResult.Dimensions.ToString(), OutResult.Points.Num());
-		
+	UE_LOG(SurfaceNavigation, Log, TEXT("Sampled source box:%s, voxel:%.5g, dimensions:%s, pointsNum:%d"), *OutResult.Box.GetExtent().ToString(), VoxelSize, *OutResult.Dimensions.ToString(), Dimensions.X*Dimensions.Y*Dimensions.Z);
+}
+
+
+
+void USurfaceSamplerBase::BeginDestroy()
+{
+	CancelAllTasks();
+
+	Super::BeginDestroy();
+}
+
+void USurfaceSamplerBase::ScheduleTask(FSamplingTask& Task)
+{
+	// Re-requested box replaces earlier task
+	for (const FTaskSlot& Slot : TaskSlots)
+	{
+		FSamplingTask* Other = Slot.Task.Get();
+		if (Slot.InUse && Other != &Task && Other->GetSampleBox() == Task.GetSampleBox() && !Other->IsDataExtracted())
+		{
+			Other->Cancel();
+		}
+	}
+
+	if (!bAsync)
+	{
+		if (!bUseCache || !LookUpCache(Task))
+		{
+			Task.Sample();
+		}
+		DeliverTask(Task);
+		ClearFinishedTasks();
+		return;
+	}
+
+	// Collision hash is an overlap query on game thread, it is left for ProcessTasks budget
+	UE_LOG(SurfaceNavigation, Verbose, TEXT("Scheduled new task. Task queue size: %d"), UsedSlotsNum);
+}
+
+FSamplingTaskHandle USurfaceSamplerBase::SetupTask(const FBox& SampleBox)
+{
+	SamplingTaskParameters Params = SamplingTaskParameters();
+	Params.bDrawDebug = bDrawDebug;
+	Params.VoxelSize = VoxelSize;
+	Params.bHierarchical = bHierarchical;
+	Params.bOccupancyOnly = bOccupancyOnly;
+	Params.Source = GetDensitySource();
+
+	// Most recently freed slot has buffers of similar size still allocated
+	const int32 Index = FreeSlots.Num() > 0 ? FreeSlots.Pop(false) : TaskSlots.AddDefaulted();
+	FTaskSlot& Slot = TaskSlots[Index];
+	if (Slot.Task.IsValid())
+	{
+		Slot.Task->Reset(GetWorld(), SampleBox, Params);
+	}
+	else
+	{
+		Slot.Task = MakeUnique<FSamplingTask>(GetWorld(), SampleBox, Params);
+	}
+	Slot.InUse = true;
+	Slot.Task->Priority = ScheduledNum++;
+	UsedSlotsNum++;
+
+	FSamplingTaskHandle Handle;
+	Handle.Index = Index;
+	Handle.Generation = Slot.Generation;
+	return Handle;
+}
+
+const FSamplingTask* USurfaceSamplerBase::FindTask(const FSamplingTaskHandle& Handle) const
+{
+	if (!TaskSlots.IsValidIndex(Handle.Index)) return nullptr;
+
+	const FTaskSlot& Slot = TaskSlots[Handle.Index];
+	return Slot.InUse && Slot.Generation == Handle.Generation ? Slot.Task.Get() : nullptr;
+}
+
+void USurfaceSamplerBase::CancelTask(const FSamplingTaskHandle& Handle)
+{
+	if (FindTask(Handle))
+	{
+		TaskSlots[Handle.Index].Task->Cancel();
+	}
+}
+
+void USurfaceSamplerBase::CancelTasks(const FBox& SampleBox)
+{
+	for (const FTaskSlot& Slot : TaskSlots)
+	{
+		if (Slot.InUse && Slot.Task->GetSampleBox() == SampleBox && !Slot.Task->IsDataExtracted())
+		{
+			Slot.Task->Cancel();
+		}
+	}
+}
+
+void USurfaceSamplerBase::CancelAllTasks()
+{
+	for (const FTaskSlot& Slot : TaskSlots)
+	{
+		if (Slot.InUse)
+		{
+			Slot.Task->Cancel();
+		}
+	}
+	for (const FTaskSlot& Slot : TaskSlots)
+	{
+		if (Slot.InUse && Slot.Task->Future.IsValid())
+		{
+			Slot.Task->Future.Wait();
+		}
+	}
+	ClearFinishedTasks();
+}
+
+void USurfaceSamplerBase::ClearFinishedTasks()
+{
+	for (int32 Index = 0; Index < TaskSlots.Num(); Index++)
+	{
+		FTaskSlot& Slot = TaskSlots[Index];
+		if (!Slot.InUse || !Slot.Task->IsDataExtracted()) continue;
+
+		// Cancelled worker may still be running
+		if (Slot.Task->Future.IsValid() && !Slot.Task->Future.IsReady()) continue;
+
+		Slot.InUse = false;
+		Slot.Generation++;
+		FreeSlots.Push(Index);
+		UsedSlotsNum--;
+	}
+}
+
+void USurfaceSamplerBase::TrimPool()
+{
+	for (int32 Index : FreeSlots)
+	{
+		TaskSlots[Index].Task.Reset();
+	}
+}
+
+SIZE_T USurfaceSamplerBase::GetPooledMemory() const
+{
+	SIZE_T Size = TaskSlots.GetAllocatedSize();
+	for (const FTaskSlot& Slot : TaskSlots)
+	{
+		if (Slot.Task.IsValid())
+		{
+			Size += sizeof(FSamplingTask) + Slot.Task->GetResult().GetAllocatedSize();
+		}
+	}
+	return Size;
+}
+
+bool USurfaceSamplerBase::IsTickable() const
+{
+	return !HasAnyFlags(RF_ClassDefaultObject) && !bTickedExternally && UsedSlotsNum > 0;
+}
+
+void USurfaceSamplerBase::Tick(float DeltaTime)
+{
+	ProcessTasks(FPlatformTime::Seconds() + DeliveryBudgetMs / 1000.0);
+}
+
+void USurfaceSamplerBase::ProcessTasks(double EndTime)
+{
+	ClearFinishedTasks();
+	StartTasks(EndTime);
+	DeliverResults(EndTime);
+	ClearFinishedTasks();
+}
+
+bool USurfaceSamplerBase::GetFocusLocation(FVector& OutLocation) const
+{
+	const UWorld* World = GetWorld();
+	const APlayerController* Controller = World ? World->GetFirstPlayerController() : nullptr;
+	if (Controller && Controller->PlayerCameraManager)
+	{
+		OutLocation = Controller->PlayerCameraManager->GetCameraLocation();
+		return true;
+	}
+	return false;
+}
+
+void USurfaceSamplerBase::StartTasks(double EndTime)
+{
+	FVector FocusLocation;
+	if (GetFocusLocation(FocusLocation))
+	{
+		for (const FTaskSlot& Slot : TaskSlots)
+		{
+			if (Slot.InUse && Slot.Task->IsWaiting())
+			{
+				Slot.Task->Priority = Slot.Task->GetSampleBox().ComputeSquaredDistanceToPoint(FocusLocation);
+			}
+		}
+	}
+
+	int32 ActiveNum = 0;
+	for (const FTaskSlot& Slot : TaskSlots)
+	{
+		ActiveNum += Slot.InUse && Slot.Task->IsActive() ? 1 : 0;
+	}
+
+	bool bLookedUpAny = false;
+	while (ActiveNum < MaxActiveTasks)
+	{
+		FSamplingTask* Next = FindNextTask([](const FSamplingTask& Task) { return Task.IsWaiting(); });
+		if (Next == nullptr) break;
+
+		if (bUseCache && !Next->bCacheChecked)
+		{
+			// Rest of tasks are looked up next call, they stay waiting
+			if (bLookedUpAny && FPlatformTime::Seconds() >= EndTime) break;
+			bLookedUpAny = true;
+
+			// Cached result is delivered without taking active slot
+			if (LookUpCache(*Next)) continue;
+		}
+
+		// State is switched here so task can not be started twice, slot is not reused until worker finishes
+		Next->SetState(FSamplingTask::InProgress);
+		Next->Future = Async(EAsyncExecution::ThreadPool, [Next]() { Next->ExecuteSampling(); });
+		ActiveNum++;
+	}
+}
+
+void USurfaceSamplerBase::DeliverResults(double EndTime)
+{
+	do
+	{
+		FSamplingTask* Next = FindNextTask([](const FSamplingTask& Task) { return Task.IsDataReady(); });
+		if (Next == nullptr) break;
+
+		DeliverTask(*Next);
+	} 
+	while (FPlatformTime::Seconds() < EndTime);
+}
+
+
+
+void USurfaceSamplerBase::DeliverTask(FSamplingTask& Task)
+{
+	if (Task.IsDataReady() && !Task.IsCancelled() && Task.CollisionHash.IsSet())
+	{
+		AddToCache(MakeCacheKey(Task.GetSampleBox()), Task.CollisionHash.GetValue(), Task.ShareResult());
+	}
+	Task.Deliver();
+}
+
+bool USurfaceSamplerBase::LookUpCache(FSamplingTask& Task)
+{
+	Task.bCacheChecked = true;
+
+	uint32 CollisionHash;
+	if (!GetCollisionHash(Task.GetSampleBox(), CollisionHash)) return false;
+
+	FSampleCacheEntry* Entry = SampleCache.Find(MakeCacheKey(Task.GetSampleBox()));
+	if (Entry && Entry->CollisionHash == CollisionHash)
+	{
+		Entry->LastUsed = ++CacheUseCounter;
+		Task.SetCachedResult(Entry->Result.ToSharedRef());
+		return true;
+	}
+
+	// Sampled result is cached on delivery
+	Task.CollisionHash = CollisionHash;
+	return false;
 }
 
+bool USurfaceSamplerBase::GetCollisionHash(const FBox& SampleBox, uint32& OutHash) const
+{
+	const UWorld* World = GetWorld();
+	if (World == nullptr || GetDensitySource().IsValid()) return false;
+
+	// Box of outer points is expanded by test box of point
+	const float TestExtent = FMath::Max(FMath::Abs(VoxelSize), 10.0f);
+
+	TArray<FOverlapResult> Overlaps;
+	FCollisionQueryParams Params;
+	Params.bFindInitialOverlaps = true;
+	World->OverlapMultiByObjectType(Overlaps, SampleBox.GetCenter(), FQuat::Identity, FSamplingTask::GetObjectQueryParameters(), FCollisionShape::MakeBox(SampleBox.GetExtent() + FVector(TestExtent)), Params);
+
+	// Sum does not depend on order of overlaps
+	OutHash = Overlaps.Num();
+	for (const FOverlapResult& Overlap : Overlaps)
+	{
+		const UPrimitiveComponent* Component = Overlap.GetComponent();
+		if (Component == nullptr) continue;
+
+		const FTransform& Transform = Component->GetComponentTransform();
+		uint32 Hash = GetTypeHash(Component->GetUniqueID());
+		Hash = HashCombine(Hash, GetTypeHash(Transform.GetLocation()));
+		Hash = HashCombine(Hash, GetTypeHash(Transform.GetRotation().Euler()));
+		Hash = HashCombine(Hash, GetTypeHash(Transform.GetScale3D()));
+		Hash = HashCombine(Hash, GetTypeHash(Component->Bounds.BoxExtent));
+		Hash = HashCombine(Hash, GetTypeHash(Overlap.ItemIndex));
+		OutHash += Hash;
+	}
+	return true;
+}
+
+FSampleCacheKey USurfaceSamplerBase::MakeCacheKey(const FBox& SampleBox) const
+{
+	FSampleCacheKey Key;
+	Key.Box = SampleBox;
+	Key.VoxelSize = VoxelSize;
+	Key.bOccupancyOnly = bOccupancyOnly;
+	return Key;
+}
+
+void USurfaceSamplerBase::AddToCache(const FSampleCacheKey& Key, uint32 CollisionHash, const TSharedRef<const FSamplerResult, ESPMode::ThreadSafe>& Result)
+{
+	if (FSampleCacheEntry* Existing = SampleCache.Find(Key))
+	{
+		SampleCacheSize -= Existing->Result->GetAllocatedSize();
+	}
+
+	FSampleCacheEntry& Entry = SampleCache.FindOrAdd(Key);
+	Entry.CollisionHash = CollisionHash;
+	Entry.LastUsed = ++CacheUseCounter;
+	Entry.Result = Result;
+	SampleCacheSize += Result->GetAllocatedSize();
+
+	const SIZE_T Budget = (SIZE_T)(FMath::Max(CacheBudgetMB, 0.f) * 1024 * 1024);
+	while (SampleCacheSize > Budget && SampleCache.Num() > 0)
+	{
+		const FSampleCacheKey* Oldest = nullptr;
+		uint64 OldestUse = MAX_uint64;
+		for (const TPair<FSampleCacheKey, FSampleCacheEntry>& Pair : SampleCache)
+		{
+			if (Pair.Value.LastUsed < OldestUse)
+			{
+				OldestUse = Pair.Value.LastUsed;
+				Oldest = &Pair.Key;
+			}
+		}
+
+		const FSampleCacheKey OldestKey = *Oldest;
+		SampleCacheSize -= SampleCache[OldestKey].Result->GetAllocatedSize();
+		SampleCache.Remove(OldestKey);
+	}
+}
+
+void USurfaceSamplerBase::ClearCache()
+{
+	SampleCache.Empty();
+	SampleCacheSize = 0;
+}
+
+TSharedPtr<const FDensitySource, ESPMode::ThreadSafe> UAnalyticSurfaceSampler::GetDensitySource() const
+{
+	TSharedPtr<FAnalyticDensitySource, ESPMode::ThreadSafe> Source = MakeShared<FAnalyticDensitySource, ESPMode::ThreadSafe>();
+	Source->Shapes = Shapes;
+	Source->Falloff = FMath::Max(FMath::Abs(VoxelSize), 10.0f);
+	return Source;
+}
@@ -0,0 +1,356 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "SurfaceNavCell.h"
+#include "CelledSurfaceNavData.h"
+#include "Algo/Reverse.h"
+#include "Algo/BinarySearch.h"
+
+
+
+/** Interleave bits of 10 bit coordinates */
+static uint32 EncodeMorton3(uint32 X, uint32 Y, uint32 Z)
+{
+	auto Spread = [](uint32 Value)
+	{
+		Value = (Value | (Value << 16)) & 0x030000FF;
+		Value = (Value | (Value << 8)) & 0x0300F00F;
+		Value = (Value | (Value << 4)) & 0x030C30C3;
+		Value = (Value | (Value << 2)) & 0x09249249;
+		return Value;
+	};
+	return Spread(X) | (Spread(Y) << 1) | (Spread(Z) << 2);
+}
+
+
+
+const FIntVector FSurfaceNavCell::FaceOffsets[6] =
+{
+	FIntVector(1, 0, 0),
+	FIntVector(-1, 0, 0),
+
+	FIntVector(0, 1, 0),
+	FIntVector(0, -1, 0),
+
+	FIntVector(0, 0, 1),
+	FIntVector(0, 0, -1)
+};
+
+TArrayView<const FSurfaceNavCell::FFaceEdge> FSurfaceNavCell::GetFaceEdges(int32 Node) const
+{
+	const int32 First = Algo::LowerBoundBy(FaceEdges, Node, &FFaceEdge::Node);
+	const int32 Last = Algo::UpperBoundBy(FaceEdges, Node, &FFaceEdge::Node);
+	return TArrayView<const FFaceEdge>(FaceEdges.GetData() + First, Last - First);
+}
+
+int32 FSurfaceNavCell::FindClosestNode(const FVector& Location) const
+{
+	float MinDist = TNumericLimits<float>::Max();
+	int32 ClosestNode = INDEX_NONE;
+	for (int32 Node = 0; Node < GetNodesNum(); Node++)
+	{
+		FPlane Plane(GetVertex(Triangles[Node * 3]), GetVertex(Triangles[Node * 3 + 1]), GetVertex(Triangles[Node * 3 + 2]));
+		float CurDist = FMath::Abs(Plane.PlaneDot(Location));
+
+		if (CurDist < MinDist)
+		{
+			MinDist = CurDist;
+			ClosestNode = Node;
+		}
+	}
+	return ClosestNode;
+}
+
+TSharedRef<const FSurfaceNavCell, ESPMode::ThreadSafe> FSurfaceNavCell::Build(const FIntVector& Coordinate, const FBox& CellBox, const FCellCreationData& Data, bool SortSpatially, bool Compact)
+{
+	TSharedRef<FSurfaceNavCell, ESPMode::ThreadSafe> Cell = MakeShared<FSurfaceNavCell, ESPMode::ThreadSafe>();
+	Cell->Coordinate = Coordinate;
+	Cell->Vertices = Data.CellVertices;
+	Cell->BuildGraph(CellBox, Data.CellTriangles, Data.OuterVertices, SortSpatially);
+	Cell->BuildFaceEdges(CellBox, Data.GridBox.IsValid ? Data.GridBox : CellBox);
+	if (Compact)
+	{
+		Cell->CompactVertexData(CellBox);
+	}
+	return Cell;
+}
+
+TSharedRef<const FSurfaceNavCell, ESPMode::ThreadSafe> FSurfaceNavCell::Build(const FIntVector& Coordinate, const FBox& CellBox, FCellCreationData&& Data, bool SortSpatially, bool Compact)
+{
+	TSharedRef<FSurfaceNavCell, ESPMode::ThreadSafe> Cell = MakeShared<FSurfaceNavCell, ESPMode::ThreadSafe>();
+	Cell->Coordinate = Coordinate;
+	Cell->Vertices = MoveTemp(Data.CellVertices);
+	Cell->BuildGraph(CellBox, Data.CellTriangles, Data.OuterVertices, SortSpatially);
+	Cell->BuildFaceEdges(CellBox, Data.GridBox.IsValid ? Data.GridBox : CellBox);
+	if (Compact)
+	{
+		Cell->CompactVertexData(CellBox);
+	}
+	return Cell;
+}
+
+void FSurfaceNavCell::CompactVertexData(const FBox& CellBox)
+{
+	if (Vertices.Num() == 0) return;
+
+	// Margin for vertices slightly outside of cell
+	Quantizer = FVectorQuantizer(FBox::BuildAABB(CellBox.GetCenter(), CellBox.GetExtent() * 1.5f));
+
+	CompactVertices.SetNumUninitialized(Vertices.Num());
+	for (int32 Vertex = 0; Vertex < Vertices.Num(); Vertex++)
+	{
+		CompactVertices[Vertex] = Quantizer.Encode(Vertices[Vertex]);
+	}
+	Vertices.Empty();
+}
+
+SIZE_T FSurfaceNavCell::GetAllocatedSize() const
+{
+	return Vertices.GetAllocatedSize() + CompactVertices.GetAllocatedSize() + Triangles.GetAllocatedSize() 
+		+ NeighbourOffsets.GetAllocatedSize() + Neighbours.GetAllocatedSize() + BoundaryNodes.GetAllocatedSize() 
+		+ FaceEdges.GetAllocatedSize() + FaceEdgeNodes.GetAllocatedSize();
+}
+
+void FSurfaceNavCell::BuildGraph(const FBox& CellBox, const TArray<int32>& SourceTriangles, const TArray<int32>& OuterVertices, bool SortSpatially)
+{
+	const int32 NodesNum = SourceTriangles.Num() / 3;
+
+	TArray<int32> NodeOrder;
+	NodeOrder.SetNumUninitialized(NodesNum);
+	for (int Index = 0; Index < NodesNum; Index++)
+	{
+		NodeOrder[Index] = Index;
+	}
+	if (SortSpatially)
+	{
+		// Centers quantized to 10 bits per axis inside of cell
+		const FVector CellMin = CellBox.Min;
+		const FVector Scale = FVector(1023.f) / CellBox.GetSize().ComponentMax(FVector(KINDA_SMALL_NUMBER));
+		TArray<uint32> MortonCodes;
+		MortonCodes.SetNumUninitialized(NodesNum);
+		for (int Index = 0; Index < NodesNum; Index++)
+		{
+			const FVector NodeCenter = (Vertices[SourceTriangles[Index * 3]] + Vertices[SourceTriangles[Index * 3 + 1]] + Vertices[SourceTriangles[Index * 3 + 2]]) / 3;
+			const FVector Local = (NodeCenter - CellMin) * Scale;
+			MortonCodes[Index] = EncodeMorton3(
+				(uint32)FMath::Clamp(FMath::FloorToInt(Local.X), 0, 1023),
+				(uint32)FMath::Clamp(FMath::FloorToInt(Local.Y), 0, 1023),
+				(uint32)FMath::Clamp(FMath::FloorToInt(Local.Z), 0, 1023));
+		}
+		NodeOrder.Sort([&MortonCodes](int32 A, int32 B) { return MortonCodes[A] < MortonCodes[B]; });
+	}
+
+	Triangles.SetNumUninitialized(NodesNum * 3);
+	for (int Node = 0; Node < NodesNum; Node++)
+	{
+		Triangles[Node * 3 + 0] = SourceTriangles[NodeOrder[Node] * 3 + 0];
+		Triangles[Node * 3 + 1] = SourceTriangles[NodeOrder[Node] * 3 + 1];
+		Triangles[Node * 3 + 2] = SourceTriangles[NodeOrder[Node] * 3 + 2];
+	}
+
+	// Nodes are connected if they share an edge. Edges sorted by vertex pair put all nodes of an edge next to each other
+	TArray<TPair<uint64, int32>> EdgeNodes;
+	EdgeNodes.Reserve(NodesNum * 3);
+	for (int Node = 0; Node < NodesNum; Node++)
+	{
+		for (int Corner = 0; Corner < 3; Corner++)
+		{
+			const uint32 A = Triangles[Node * 3 + Corner];
+			const uint32 B = Triangles[Node * 3 + (Corner + 1) % 3];
+			if (A == B) continue;
+			EdgeNodes.Emplace((uint64(FMath::Min(A, B)) << 32) | FMath::Max(A, B), Node);
+		}
+	}
+	EdgeNodes.Sort([](const TPair<uint64, int32>& L, const TPair<uint64, int32>& R) { return L.Key < R.Key || (L.Key == R.Key && L.Value < R.Value); });
+
+	TArray<TPair<int32, int32>> Links;
+	Links.Reserve(EdgeNodes.Num() * 2);
+	for (int RunStart = 0; RunStart < EdgeNodes.Num();)
+	{
+		int RunEnd = RunStart + 1;
+		while (RunEnd < EdgeNodes.Num() && EdgeNodes[RunEnd].Key == EdgeNodes[RunStart].Key) RunEnd++;
+
+		for (int I = RunStart; I < RunEnd; I++)
+		{
+			for (int J = I + 1; J < RunEnd; J++)
+			{
+				if (EdgeNodes[I].Value == EdgeNodes[J].Value) continue;
+				Links.Emplace(EdgeNodes[I].Value, EdgeNodes[J].Value);
+				Links.Emplace(EdgeNodes[J].Value, EdgeNodes[I].Value);
+			}
+		}
+		RunStart = RunEnd;
+	}
+	Links.Sort([](const TPair<int32, int32>& L, const TPair<int32, int32>& R) { return L.Key < R.Key || (L.Key == R.Key && L.Value < R.Value); });
+
+	NeighbourOffsets.SetNumZeroed(NodesNum + 1);
+	Neighbours.Reset(Links.Num());
+	for (int Index = 0; Index < Links.Num(); Index++)
+	{
+		// Two nodes sharing two edges are linked once
+		if (Index > 0 && Links[Index] == Links[Index - 1]) continue;
+
+		Neighbours.Add(Links[Index].Value);
+		NeighbourOffsets[Links[Index].Key + 1]++;
+	}
+	for (int Node = 0; Node < NodesNum; Node++)
+	{
+		NeighbourOffsets[Node + 1] += NeighbourOffsets[Node];
+	}
+
+	TBitArray<> IsOuter(false, Vertices.Num());
+	for (int32 Vertex : OuterVertices)
+	{
+		IsOuter[Vertex] = true;
+	}
+	for (int Node = 0; Node < NodesNum; Node++)
+	{
+		if (IsOuter[Triangles[Node * 3]] || IsOuter[Triangles[Node * 3 + 1]] || IsOuter[Triangles[Node * 3 + 2]])
+		{
+			BoundaryNodes.Add(Node);
+		}
+	}
+}
+
+void FSurfaceNavCell::BuildFaceEdges(const FBox& CellBox, const FBox& FaceBox)
+{
+	// Same step in every cell of equal size, vertices of shared face are generated from same samples in both cells
+	const float Step = CellBox.GetSize().GetMax() / EdgeKeyResolution;
+	if (Step <= 0) return;
+
+	// Sampled grid overlaps neighbouring grid by one plane of points, so faces are outer planes of grid and not cell box
+	auto GetFacesMask = [&FaceBox, Step](const FVector& Vertex)
+	{
+		uint32 Mask = 0;
+		for (int Axis = 0; Axis < 3; Axis++)
+		{
+			Mask |= (FMath::Abs(Vertex[Axis] - FaceBox.Max[Axis]) <= Step) << (Axis * 2);
+			Mask |= (FMath::Abs(Vertex[Axis] - FaceBox.Min[Axis]) <= Step) << (Axis * 2 + 1);
+		}
+		return Mask;
+	};
+	auto Quantize = [Step](const FVector& Vertex)
+	{
+		return FIntVector(FMath::RoundToInt(Vertex.X / Step), FMath::RoundToInt(Vertex.Y / Step), FMath::RoundToInt(Vertex.Z / Step));
+	};
+
+	// Boundary nodes are in node order, so are face edges
+	for (int32 Node : BoundaryNodes)
+	{
+		for (int Corner = 0; Corner < 3; Corner++)
+		{
+			const FVector& V1 = Vertices[Triangles[Node * 3 + Corner]];
+			const FVector& V2 = Vertices[Triangles[Node * 3 + (Corner + 1) % 3]];
+
+			// Edge on box edge lies on two faces
+			const uint32 SharedFaces = GetFacesMask(V1) & GetFacesMask(V2);
+			if (SharedFaces == 0) continue;
+
+			const FSurfaceNavEdgeKey Key(Quantize(V1), Quantize(V2));
+			if (Key.A == Key.B) continue;
+
+			for (int Face = 0; Face < 6; Face++)
+			{
+				if (SharedFaces & (1 << Face))
+				{
+					FaceEdges.Add(FFaceEdge{ Key, Node, Face });
+				}
+			}
+			FaceEdgeNodes.AddUnique(Key, Node);
+		}
+	}
+}
+
+
+
+bool FSurfaceNavSnapshot::ProjectPointToNavigation(const FVector& WorldLocation, FVector& OutLocation) const
+{
+	const FSurfaceNavCell* Cell = FindCell(GetCellCoordinate(WorldLocation));
+	const int32 Node = Cell ? Cell->FindClosestNode(WorldLocation) : INDEX_NONE;
+	if (Node == INDEX_NONE) return false;
+
+	OutLocation = Cell->GetNodeCenter(Node);
+	return true;
+}
+
+bool FSurfaceNavSnapshot::FindPath(const FVector& From, const FVector& To, TArray<FVector>& OutPath) const
+{
+	OutPath.Reset();
+
+	typedef TPair<const FSurfaceNavCell*, int32> FNodeId;
+
+	const FSurfaceNavCell* StartCell = FindCell(GetCellCoordinate(From));
+	const FSurfaceNavCell* GoalCell = FindCell(GetCellCoordinate(To));
+	if (StartCell == nullptr || GoalCell == nullptr) return false;
+
+	const FNodeId Start(StartCell, StartCell->FindClosestNode(From));
+	const FNodeId Goal(GoalCell, GoalCell->FindClosestNode(To));
+	if (Start.Value == INDEX_NONE || Goal.Value == INDEX_NONE) return false;
+
+	const FVector GoalLocation = Goal.Key->GetNodeCenter(Goal.Value);
+
+	struct FOpenNode
+	{
+		FNodeId Id;
+		float Cost;
+		bool operator<(const FOpenNode& Other) const { return Cost < Other.Cost; }
+	};
+
+	TMap<FNodeId, float> CostSoFar;
+	TMap<FNodeId, FNodeId> CameFrom;
+	TArray<FOpenNode> Open;
+
+	CostSoFar.Add(Start, 0.f);
+	Open.HeapPush(FOpenNode{ Start, FVector::Dist(Start.Key->GetNodeCenter(Start.Value), GoalLocation) });
+
+	while (Open.Num() > 0)
+	{
+		FOpenNode Current;
+		Open.HeapPop(Current, false);
+		if (Current.Id == Goal) break;
+
+		const FSurfaceNavCell& Cell = *Current.Id.Key;
+		const FVector CurrentLocation = Cell.GetNodeCenter(Current.Id.Value);
+		const float CurrentCost = CostSoFar[Current.Id];
+
+		auto Visit = [&](const FNodeId& Next)
+		{
+			const FVector NextLocation = Next.Key->GetNodeCenter(Next.Value);
+			const float NewCost = CurrentCost + FVector::Dist(CurrentLocation, NextLocation);
+
+			const float* OldCost = CostSoFar.Find(Next);
+			if (OldCost == nullptr || NewCost < *OldCost)
+			{
+				CostSoFar.Add(Next, NewCost);
+				CameFrom.Add(Next, Current.Id);
+				Open.HeapPush(FOpenNode{ Next, NewCost + FVector::Dist(NextLocation, GoalLocation) });
+			}
+		};
+
+		for (int32 Neighbour : Cell.GetNeighbours(Current.Id.Value))
+		{
+			Visit(FNodeId(&Cell, Neighbour));
+		}
+
+		// Cells in snapshot are never stitched, matching face edge keys link nodes of neighbouring cells
+		for (const FSurfaceNavCell::FFaceEdge& Edge : Cell.GetFaceEdges(Current.Id.Value))
+		{
+			const FSurfaceNavCell* NeighbourCell = FindCell(Cell.Coordinate + FSurfaceNavCell::FaceOffsets[Edge.Face]);
+			if (NeighbourCell == nullptr) continue;
+
+			for (TMultiMap<FSurfaceNavEdgeKey, int32>::TConstKeyIterator It = NeighbourCell->FaceEdgeNodes.CreateConstKeyIterator(Edge.Key); It; ++It)
+			{
+				Visit(FNodeId(NeighbourCell, It.Value()));
+			}
+		}
+	}
+
+	if (!CostSoFar.Contains(Goal)) return false;
+
+	for (FNodeId Node = Goal; ; Node = CameFrom[Node])
+	{
+		OutPath.Add(Node.Key->GetNodeCenter(Node.Value));
+		if (Node == Start) break;
+	}
+	Algo::Reverse(OutPath);
+	return true;
+}
@@ -10,6 +10,7 @@
 #include "SurfaceNavFunctionLibrary.h"
 #include "DrawDebugHelpers.h"
 #include "MarchingCubesBuilder.h"
+#include "SurfaceNetsBuilder.h"
 
 DEFINE_LOG_CATEGORY(SurfaceNavigation);
 
@@ -64,6 +65,9 @@ USurfaceNavigationSystem::USurfaceNavigationSystem()
 
 	SurfaceValue = .5f;
 	ShowGraph = true;
+	UseSurfaceNets = false;
+	CompactNavVertices = false;
+	RebuildBudgetMs = 4.f;
 	
 	VolumesNum = 0;
 
@@ -75,6 +79,14 @@ void USurfaceNavigationSystem::PostInitProperties()
 {
 	Super::PostInitProperties();
 
+	CelledData.SetUseCompactVertices(CompactNavVertices);
+	CelledData.OnCellPublished.BindUObject(this, &USurfaceNavigationSystem::CellPublished);
+
+	if (Sampler)
+	{
+		Sampler->SetTickedExternally(true);
+	}
+
 	TArray<AActor*> FoundVolumes;
 	UGameplayStatics::GetAllActorsOfClass(this, ASurfaceNavigationVolume::StaticClass(), FoundVolumes);
 
@@ -90,35 +102,25 @@ void USurfaceNavigationSystem::FindPathSync(const FVector& From, const FVector&
 {
 	SCOPE_CYCLE_COUNTER(STAT_FindPath);
 
-	const FSurfaceNavigationBox* SharedBox = FindSharedBox(From, To);
-	if (SharedBox == nullptr)
+	// Snapshot stays valid while cells are rebuilt, path never mixes old and new version of a cell
+	TSharedPtr<const FSurfaceNavSnapshot, ESPMode::ThreadSafe> Snapshot = CelledData.GetSnapshot();
+	if (!Snapshot.IsValid())
 	{
-		UE_LOG(SurfaceNavigation, Error, TEXT("Pathfind request from: %s To: %s failed. Points are outside of shared nav volume"), *From.ToString(), *To.ToString());
+		UE_LOG(SurfaceNavigation, Error, TEXT("Pathfind request from: %s To: %s failed. Navigation is not built"), *From.ToString(), *To.ToString());
 		OutResult = FSurfacePathfindingResult::Failure;
 		return;
-	}	
-
-
-	const FSurfaceNavLocalData& NavData = SharedBox->NavData;
-	
-
-	int32 EdgeFrom = NavData.FindClosestEdgeIndex(SharedBox->ToLocal(From));
-	int32 EdgeTo = NavData.FindClosestEdgeIndex(SharedBox->ToLocal(To));
-	
+	}
 
-	if (EdgeFrom < 0)
+	TArray<FVector> Path;
+	if (!Snapshot->FindPath(From, To, Path))
 	{
+		UE_LOG(SurfaceNavigation, Error, TEXT("Pathfind request from: %s To: %s failed. Points are off navigation or not connected"), *From.ToString(), *To.ToString());
 		OutResult = FSurfacePathfindingResult::Failure;
-		UE_LOG(SurfaceNavigation, Error, TEXT("Pathfind failed, could not find Start point of path"));
 		return;
 	}
+	SET_DWORD_STAT(STAT_PathLength, Path.Num());
 
-	bool FindPartial = EdgeTo < 0;
-
-	FSurfacePathfindResult Result = NavData.FindPath(EdgeFrom, EdgeTo);
-	SET_DWORD_STAT(STAT_PathLength, Result.Path.Num());
-
-	OutResult = FSurfacePathfindingResult(Result, NavData, SharedBox->BoundingBox.GetCenter());	
+	OutResult = FSurfacePathfindingResult(MoveTemp(Path));
 }
 
 
@@ -126,14 +128,7 @@ void USurfaceNavigationSystem::FindPathSync(const FVector& From, const FVector&
 
 bool USurfaceNavigationSystem::GetClosestNodeLocation(const FVector& WorldLocation, FVector& OutLocation) const
 {
-	if (const FSurfaceNavigationBox* Box = FindBox(WorldLocation))
-	{
-		const FSurfaceNavLocalData NavData = Box->NavData;
-		const FVector Center = Box->BoundingBox.GetCenter();
-		OutLocation = Center + NavData.ToLocation(NavData.FindClosestEdgeIndex(WorldLocation - Center));
-		return true;
-	}
-	return false;
+	return CelledData.ProjectPointToNavigation(WorldLocation, OutLocation);
 }
 
 
@@ -189,7 +184,15 @@ void USurfaceNavigationSystem::RebuildGraph()
 
 void USurfaceNavigationSystem::ClearGraph()
 {
+	// Background builds are dropped with cells
+	const TArray<FIntVector> DroppedCells = BuildingCells.Array();
+	BuildingCells.Empty();
+	for (const FIntVector& Coord : DroppedCells)
+	{
+		UncountCell(Coord);
+	}
 	CelledData.ClearAllCells();
+	UpdateRebuildInfo();
 }
 
 FSurfaceNavigationBox* USurfaceNavigationSystem::FindBoxByID(NavBoxID BoxID)
@@ -206,7 +209,26 @@ void USurfaceNavigationSystem::VolumeUpdateRequest(FVolumeUpdateRequest Request)
 {
 	if (Request.Type == FVolumeUpdateRequest::Remove)
 	{
-		RemoveBoxByID(Request.BoxID);		
+		if (FSurfaceNavigationBox* Box = FindBoxByID(Request.BoxID))
+		{
+			const FBox RemovedBox = Box->BoundingBox;
+			RemoveBoxByID(Request.BoxID);
+
+			// Cells still covered by other volumes keep rebuilding
+			TSet<FIntVector> CoveredCells;
+			for (const TPair<NavBoxID, FSurfaceNavigationBox>& VolumePair : Volumes)
+			{
+				CoveredCells.Append(CelledData.GetCellsContainingBox(VolumePair.Value.BoundingBox));
+			}
+			for (const FIntVector& Coord : CelledData.GetCellsContainingBox(RemovedBox))
+			{
+				if (!CoveredCells.Contains(Coord))
+				{
+					DropCell(Coord);
+				}
+			}
+			UpdateRebuildInfo();
+		}
 	}
 	else
 	{
@@ -219,6 +241,8 @@ void USurfaceNavigationSystem::VolumeUpdateRequest(FVolumeUpdateRequest Request)
 				for (const FIntVector& Coord : cellsContainingBox)
 				{
 					CelledData.DrawCellBounds(Coord, FColor::Red, 15, 2);
+					// Clearing drops background build of cell, cells of new bounds are queued again below
+					DropCell(Coord);
 					CelledData.ClearCell(Coord);
 				}
 			}
@@ -260,26 +284,179 @@ void USurfaceNavigationSystem::BoxChanged(uint32 BoxID)
 	TArray<FIntVector> cellsContainingBox = CelledData.GetCellsContainingBox(Box->BoundingBox);
 	for (const FIntVector& Coord : cellsContainingBox)
 	{		
-		Sampler->ScheduleSampleTask<FSamplerFinishedCell>(CelledData.GetCellBox(Coord), this, &USurfaceNavigationSystem::SamplerFinished, Coord);
+		QueueCell(Coord);
+	}	
+	UpdateRebuildInfo();
+}
+
+void USurfaceNavigationSystem::QueueCell(const FIntVector& Coord)
+{
+	if (PendingCellsSet.Contains(Coord)) return;
+
+	PendingCells.Add(Coord);
+	PendingCellsSet.Add(Coord);
+
+	// Cell being sampled or built is already counted, new request replaces old one
+	if (!SamplingCells.Contains(Coord) && !BuildingCells.Contains(Coord))
+	{
+		RebuildCellsNum++;
+	}
+}
+
+bool USurfaceNavigationSystem::IsCellQueued(const FIntVector& Coord) const
+{
+	return PendingCellsSet.Contains(Coord) || SamplingCells.Contains(Coord) || BuildingCells.Contains(Coord);
+}
+
+void USurfaceNavigationSystem::DropCell(const FIntVector& Coord)
+{
+	if (!IsCellQueued(Coord)) return;
+
+	if (PendingCellsSet.Remove(Coord) > 0)
+	{
+		PendingCells.RemoveSingle(Coord);
+	}
+
+	FSamplingTaskHandle Handle;
+	if (SamplingCells.RemoveAndCopyValue(Coord, Handle) && Sampler)
+	{
+		Sampler->CancelTask(Handle);
+	}
+
+	BuildingCells.Remove(Coord);
+	UncountCell(Coord);
+}
+
+void USurfaceNavigationSystem::DropStaleSamplingCells()
+{
+	for (TMap<FIntVector, FSamplingTaskHandle>::TIterator It = SamplingCells.CreateIterator(); It; ++It)
+	{
+		// Stale handle means slot was freed without delivering, e.g. by CancelAllTasks on sampler destroy
+		const FSamplingTask* Task = Sampler ? Sampler->FindTask(It.Value()) : nullptr;
+		if (Task == nullptr || Task->IsCancelled())
+		{
+			const FIntVector Coord = It.Key();
+			It.RemoveCurrent();
+			UncountCell(Coord);
+		}
+	}
+}
+
+void USurfaceNavigationSystem::UncountCell(const FIntVector& Coord)
+{
+	if (!IsCellQueued(Coord))
+	{
+		RebuildCellsNum = FMath::Max(RebuildCellsNum - 1, 0);
+	}
+}
+
+bool USurfaceNavigationSystem::IsTickable() const
+{
+	return !HasAnyFlags(RF_ClassDefaultObject) && IsRebuilding();
+}
 
+void USurfaceNavigationSystem::Tick(float DeltaTime)
+{
+	if (Sampler == nullptr)
+	{
+		// Tasks of removed sampler never finish
+		DropStaleSamplingCells();
+		UpdateRebuildInfo();
+		return;
+	}
+
+	Sampler->SetTickedExternally(true);
+
+	const double EndTime = FPlatformTime::Seconds() + RebuildBudgetMs / 1000.0;
+
+	// At least one cell is scheduled each frame, so rebuild always progresses
+	bool bScheduledAny = false;
+	while (PendingCells.Num() > 0 && (!bScheduledAny || FPlatformTime::Seconds() < EndTime))
+	{
+		const FIntVector Coord = PendingCells.Pop(false);
+		PendingCellsSet.Remove(Coord);
+
+		// Added before scheduling, synchronous sampler finishes inside the call
+		SamplingCells.Add(Coord);
+		const FSamplingTaskHandle Handle = Sampler->ScheduleSampleTask<FSamplerFinishedCell>(CelledData.GetCellBox(Coord), this, &USurfaceNavigationSystem::SamplerFinished, Coord);
+		if (FSamplingTaskHandle* SamplingHandle = SamplingCells.Find(Coord))
+		{
+			*SamplingHandle = Handle;
+		}
 		CelledData.DrawCellBounds(Coord, FColor::White, 15, 1);
-	}	
+
+		bScheduledAny = true;
+	}
+
+	// Meshing and cell update run in SamplerFinished, during delivery
+	Sampler->ProcessTasks(EndTime);
+
+	DropStaleSamplingCells();
+	UpdateRebuildInfo();
 }
 
-void USurfaceNavigationSystem::SamplerFinished(FSamplerResult Result, FIntVector CellCoordinate)
+float USurfaceNavigationSystem::GetRebuildProgress() const
 {
-	FMarchingCubesBuilder Builder(Result.Points, Result.Dimensions);
-	Builder.FindBoundaryEdges = true;
-	Builder.Build();
-	
+	if (RebuildCellsNum == 0) return 100.f;
+
+	const int32 CellsLeft = PendingCells.Num() + SamplingCells.Num() + BuildingCells.Num();
+	return 100.f * (RebuildCellsNum - CellsLeft) / RebuildCellsNum;
+}
+
+void USurfaceNavigationSystem::UpdateRebuildInfo()
+{
+	if (PendingCells.Num() == 0 && SamplingCells.Num() == 0 && BuildingCells.Num() == 0)
+	{
+		RebuildCellsNum = 0;
+	}
+
+	Info = IsRebuilding() 
+		? FString::Printf(TEXT("Info: Rebuilding %.0f%% of %d cells"), GetRebuildProgress(), RebuildCellsNum)
+		: FString(TEXT("Info: Graph is up to date"));
+}
+
+void USurfaceNavigationSystem::SamplerFinished(const FSamplerResult& Result, FIntVector CellCoordinate)
+{
+	SamplingCells.Remove(CellCoordinate);
+
+	// Cell is done when its graph is published, see CellPublished
+	BuildingCells.Add(CellCoordinate);
+
 	FCellCreationData Data;
-	Builder.GetData(Data.CellVertices, Data.CellTriangles);
-	Builder.GetOuterVertices(Data.OuterVertices);
+	Data.GridBox = Result.Grid.GetView().GetBounds();
+	if (UseSurfaceNets)
+	{
+		FSurfaceNetsBuilder Builder(Result.Grid.GetView());
+		Builder.FindBoundaryEdges = true;
+		Builder.Build();
 
-	CelledData.UpdateCell(CellCoordinate, Data);
-	CelledData.DrawCellGraph(CellCoordinate, 5);
+		Builder.GetOuterVertices(Data.OuterVertices);
+		Builder.TakeData(Data.CellVertices, Data.CellTriangles);
+	}
+	else
+	{
+		FMarchingCubesBuilder Builder(Result.Grid.GetView());
+		Builder.FindBoundaryEdges = true;
+		// Cell graph does not depend on order of triangles
+		Builder.RestoreLegacyOrder = false;
+		Builder.Build();
+
+		Builder.GetOuterVertices(Data.OuterVertices);
+		Builder.TakeData(Data.CellVertices, Data.CellTriangles);
+	}
+
+	// Graph is built on worker thread, old cell stays readable until new one is published
+	CelledData.UpdateCellAsync(CellCoordinate, MoveTemp(Data));
 } 
 
+void USurfaceNavigationSystem::CellPublished(const FIntVector& CellCoordinate)
+{
+	BuildingCells.Remove(CellCoordinate);
+	UpdateRebuildInfo();
+
+	CelledData.DrawCellGraph(CellCoordinate, 5);
+}
+
 const FSurfaceNavigationBox* USurfaceNavigationSystem::FindBox(const FVector& Location) const
 {
  	float ClosestDist = TNumericLimits<float>::Max();
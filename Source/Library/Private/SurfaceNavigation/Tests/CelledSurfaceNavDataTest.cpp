@@ -0,0 +1,78 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#include "CelledSurfaceNavData.h"
+#include "SurfaceSampler.h"
+#include "DensitySource.h"
+#include "MarchingCubesBuilder.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FCelledSurfaceNavPathCrossesCellsTest, "Library.SurfaceNavigation.CelledData.PathCrossesCells", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FCelledSurfaceNavPathCrossesCellsTest::RunTest(const FString& Parameters)
+{
+	FCelledSurfaceNavData CelledData;
+	CelledData.CellSize = 300;
+
+	// Ground plane spanning both cells
+	TSharedPtr<FAnalyticDensitySource, ESPMode::ThreadSafe> Source = MakeShared<FAnalyticDensitySource, ESPMode::ThreadSafe>();
+	FAnalyticShape Ground;
+	Ground.Type = EAnalyticShapeType::Plane;
+	Ground.Transform.SetLocation(FVector(0, 0, 10));
+	Source->Shapes.Add(Ground);
+	Source->Falloff = 25;
+
+	SamplingTaskParameters Params;
+	Params.VoxelSize = 25;
+	Params.Source = Source;
+
+	const FIntVector Coords[2] = { FIntVector(0, 0, 0), FIntVector(1, 0, 0) };
+	for (const FIntVector& Coord : Coords)
+	{
+		// Same sampling and meshing as nav system does for rebuilt cell
+		FSamplingTask Task(nullptr, CelledData.GetCellBox(Coord), Params);
+		Task.Sample();
+		const FSamplerResult& Result = Task.GetResult();
+
+		FCellCreationData Data;
+		Data.GridBox = Result.Grid.GetView().GetBounds();
+
+		FMarchingCubesBuilder Builder(Result.Grid.GetView());
+		Builder.FindBoundaryEdges = true;
+		// Cell graph does not depend on order of triangles
+		Builder.RestoreLegacyOrder = false;
+		Builder.Build();
+		Builder.GetOuterVertices(Data.OuterVertices);
+		Builder.TakeData(Data.CellVertices, Data.CellTriangles);
+
+		TestTrue(TEXT("Cell has surface"), Data.CellTriangles.Num() > 0);
+
+		CelledData.UpdateCell(Coord, MoveTemp(Data));
+	}
+	CelledData.FlushSnapshot();
+
+	TSharedPtr<const FSurfaceNavSnapshot, ESPMode::ThreadSafe> Snapshot = CelledData.GetSnapshot();
+	if (!TestTrue(TEXT("Snapshot is published"), Snapshot.IsValid())) return false;
+
+	const FSurfaceNavCell* CellA = Snapshot->FindCell(Coords[0]);
+	const FSurfaceNavCell* CellB = Snapshot->FindCell(Coords[1]);
+	if (!TestTrue(TEXT("Both cells are published"), CellA && CellB)) return false;
+
+	TestTrue(TEXT("Cells have face edges on shared face"), CellA->FaceEdges.ContainsByPredicate([](const FSurfaceNavCell::FFaceEdge& Edge) { return Edge.Face == 0; }));
+	TestTrue(TEXT("Neighbour has face edges on shared face"), CellB->FaceEdges.ContainsByPredicate([](const FSurfaceNavCell::FFaceEdge& Edge) { return Edge.Face == 1; }));
+
+	TArray<FVector> Path;
+	const FVector From(-100, 0, 10);
+	const FVector To(400, 0, 10);
+	TestTrue(TEXT("Path is found across cells"), Snapshot->FindPath(From, To, Path));
+	// Closest node of coplanar surface can be anywhere in cell, only side of shared sample plane is checked
+	const float SharedFaceX = CelledData.GetCellBox(Coords[0]).Max.X + Params.VoxelSize / 2;
+	TestTrue(TEXT("Path crosses shared face"), Path.Num() > 1 && Path[0].X < SharedFaceX && Path.Last().X > SharedFaceX);
+
+	return true;
+}
+
+#endif //WITH_DEV_AUTOMATION_TESTS
@@ -7,6 +7,7 @@
 #include "DrawDebugHelpers.h"
 
 #include "MarchingCubesBuilder.h"
+#include "SurfaceNetsBuilder.h"
 
 
 
@@ -49,24 +50,44 @@ void AMeshToGraphTest::SheduleSample()
 	Sampler->ScheduleSampleTask(FBox::BuildAABB(GetActorLocation(), Extent), this, &AMeshToGraphTest::SampleFinished);
 }
 
-void AMeshToGraphTest::SampleFinished(FSamplerResult Result)
+void AMeshToGraphTest::SampleFinished(const FSamplerResult& Result)
 {	
 	Mesh->ClearAllMeshSections();
 
 	TArray<FVector> Vertices;
 	TArray<int32> Indices;
+	TArray<int32> OuterIndices;
 
+	if (CompareExtractors)
+	{
+		RunExtractorComparison(Result.Grid.GetView());
+	}
 
- 	FMarchingCubesBuilder Builder(Result.Points, Result.Dimensions);
-	Builder.FindBoundaryEdges = true;
- 	Builder.Build();
- 	Builder.GetData(Vertices, Indices);
+	if (MeasureVertexCache)
+	{
+		RunVertexCacheMeasure(Result.Grid.GetView());
+	}
+
+	if (UseSurfaceNets)
+	{
+		FSurfaceNetsBuilder Builder(Result.Grid.GetView());
+		Builder.FindBoundaryEdges = true;
+		Builder.Build();
+		Builder.GetData(Vertices, Indices);
+		Builder.GetOuterVertices(OuterIndices);
+	}
+	else
+	{
+ 		FMarchingCubesBuilder Builder(Result.Grid.GetView());
+		Builder.FindBoundaryEdges = true;
+ 		Builder.Build();
+ 		Builder.GetData(Vertices, Indices);
+		Builder.GetOuterVertices(OuterIndices);
+	}
 
 	Mesh->CreateMeshSection(0, Vertices, Indices, {}, {}, {}, {}, {}, {}, {}, false);
 	Mesh->SetMaterial(0, Material);
 
-	TArray<int32> OuterIndices;
-	Builder.GetOuterVertices(OuterIndices);
 	for (int32 Index : OuterIndices)
 	{
 		if (Vertices.IsValidIndex(Index)) 
@@ -95,6 +116,98 @@ void AMeshToGraphTest::SampleFinished(FSamplerResult Result)
 	
 }
 
+void AMeshToGraphTest::RunExtractorComparison(const FDensityGridView& Grid) const
+{
+	// Minimal edge length to triangle area ratio, low values are slivers
+	auto CountSlivers = [](const TArray<FVector>& Vertices, const TArray<int32>& Indices)
+	{
+		int32 Slivers = 0;
+		for (int32 Index = 0; Index < Indices.Num(); Index += 3)
+		{
+			const FVector& A = Vertices[Indices[Index]];
+			const FVector& B = Vertices[Indices[Index + 1]];
+			const FVector& C = Vertices[Indices[Index + 2]];
+			const float LongestSquared = FMath::Max3(FVector::DistSquared(A, B), FVector::DistSquared(B, C), FVector::DistSquared(C, A));
+			const float DoubleArea = FVector::CrossProduct(B - A, C - A).Size();
+			// Height to longest edge below tenth of its length
+			if (DoubleArea < 0.1f * LongestSquared)
+			{
+				Slivers++;
+			}
+		}
+		return Slivers;
+	};
+
+	TArray<FVector> Vertices;
+	TArray<int32> Indices;
+
+	double StartTime = FPlatformTime::Seconds();
+	for (int32 Iteration = 0; Iteration < CompareIterations; Iteration++)
+	{
+		FMarchingCubesBuilder Builder(Grid);
+		Builder.FindBoundaryEdges = true;
+		Builder.Build();
+		Builder.GetData(Vertices, Indices);
+	}
+	const double MarchingCubesTime = (FPlatformTime::Seconds() - StartTime) / CompareIterations;
+	UE_LOG(LogTemp, Log, TEXT("Marching cubes: %.3f ms, Vertices: %d, Triangles: %d, Slivers: %d"), 
+		MarchingCubesTime * 1000, Vertices.Num(), Indices.Num() / 3, CountSlivers(Vertices, Indices));
+
+	StartTime = FPlatformTime::Seconds();
+	for (int32 Iteration = 0; Iteration < CompareIterations; Iteration++)
+	{
+		FSurfaceNetsBuilder Builder(Grid);
+		Builder.FindBoundaryEdges = true;
+		Builder.Build();
+		Builder.GetData(Vertices, Indices);
+	}
+	const double SurfaceNetsTime = (FPlatformTime::Seconds() - StartTime) / CompareIterations;
+	UE_LOG(LogTemp, Log, TEXT("Surface nets: %.3f ms, Vertices: %d, Triangles: %d, Slivers: %d"), 
+		SurfaceNetsTime * 1000, Vertices.Num(), Indices.Num() / 3, CountSlivers(Vertices, Indices));
+}
+
+void AMeshToGraphTest::RunVertexCacheMeasure(const FDensityGridView& Grid) const
+{
+	// Gather of triangle vertices in index order, stands for memory access of graph traversal
+	auto MeasureGather = [](const TArray<FVector>& Vertices, const TArray<int32>& Indices)
+	{
+		const double StartTime = FPlatformTime::Seconds();
+		FVector Sum = FVector::ZeroVector;
+		for (int32 Iteration = 0; Iteration < 100; Iteration++)
+		{
+			for (int32 VertexIndex : Indices)
+			{
+				Sum += Vertices[VertexIndex];
+			}
+		}
+		// Keep loop from being optimized out
+		volatile float Sink = Sum.X;
+		(void)Sink;
+		// Milliseconds per pass
+		return (FPlatformTime::Seconds() - StartTime) * 10;
+	};
+
+	FMarchingCubesBuilder Builder(Grid);
+	Builder.Build();
+
+	TArray<FVector> Vertices;
+	TArray<int32> Indices;
+	Builder.GetData(Vertices, Indices);
+	const float SourceACMR = FMarchingCubesBuilder::CalcACMR(Indices, Vertices.Num());
+	const double SourceGather = MeasureGather(Vertices, Indices);
+
+	const double StartTime = FPlatformTime::Seconds();
+	Builder.OptimizeVertexCache();
+	const double OptimizeTime = FPlatformTime::Seconds() - StartTime;
+
+	Builder.GetData(Vertices, Indices);
+	const float OptimizedACMR = FMarchingCubesBuilder::CalcACMR(Indices, Vertices.Num());
+	const double OptimizedGather = MeasureGather(Vertices, Indices);
+
+	UE_LOG(LogTemp, Log, TEXT("Vertex cache. Triangles: %d, ACMR: %.3f -> %.3f, Gather: %.3f ms -> %.3f ms, Optimize: %.3f ms"),
+		Indices.Num() / 3, SourceACMR, OptimizedACMR, SourceGather, OptimizedGather, OptimizeTime * 1000);
+}
+
 bool AMeshToGraphTest::CreateGraph(const TArray<FVector>& Vertices, const TArray<int32>& Indices, FGraph& OutGraph)
 {
 	FGraph Graph;
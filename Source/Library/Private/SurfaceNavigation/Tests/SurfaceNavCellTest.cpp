@@ -0,0 +1,119 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#include "SurfaceNavCell.h"
+#include "CelledSurfaceNavData.h"
+#include "MarchingCubesBuilder.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace SurfaceNavCellTest
+{
+	const FBox CellBox(FVector::ZeroVector, FVector(320));
+
+	/** Mesh of sphere in the middle of CellBox */
+	void BuildSphereMesh(TArray<FVector>& OutVertices, TArray<int32>& OutTriangles, TArray<int32>& OutOuterVertices)
+	{
+		FDensityGrid Grid;
+		Grid.VoxelSize = FVector(10);
+		Grid.Dimensions = FIntVector(33, 33, 33);
+		Grid.Densities.SetNumUninitialized(Grid.Dimensions.X * Grid.Dimensions.Y * Grid.Dimensions.Z);
+		for (int32 Index = 0; Index < Grid.Densities.Num(); Index++)
+		{
+			const FVector Position = FVector(Index % 33, (Index / 33) % 33, Index / (33 * 33)) * Grid.VoxelSize;
+			Grid.Densities[Index] = 0.5f + (120 - FVector::Dist(Position, FVector(160))) / Grid.VoxelSize.X;
+		}
+
+		FMarchingCubesBuilder Builder(Grid.GetView());
+		Builder.FindBoundaryEdges = true;
+		Builder.Build();
+		Builder.GetOuterVertices(OutOuterVertices);
+		Builder.GetData(OutVertices, OutTriangles);
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSurfaceNavCellSpatialOrderTest, "Library.SurfaceNavigation.Cell.SpatialNodeOrder", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FSurfaceNavCellSpatialOrderTest::RunTest(const FString& Parameters)
+{
+	using namespace SurfaceNavCellTest;
+
+	FCellCreationData Data;
+	TArray<int32> Triangles;
+	BuildSphereMesh(Data.CellVertices, Triangles, Data.OuterVertices);
+
+	// Scatter triangles so source order has no locality
+	const int32 NodesNum = Triangles.Num() / 3;
+	const int32 Step = 7919;
+	if (!TestTrue(TEXT("Step is coprime to node count"), NodesNum > 0 && NodesNum % Step != 0)) return false;
+	Data.CellTriangles.SetNumUninitialized(Triangles.Num());
+	for (int32 Node = 0; Node < NodesNum; Node++)
+	{
+		const int32 SourceNode = static_cast<int32>((static_cast<int64>(Node) * Step) % NodesNum);
+		Data.CellTriangles[Node * 3 + 0] = Triangles[SourceNode * 3 + 0];
+		Data.CellTriangles[Node * 3 + 1] = Triangles[SourceNode * 3 + 1];
+		Data.CellTriangles[Node * 3 + 2] = Triangles[SourceNode * 3 + 2];
+	}
+
+	const TSharedRef<const FSurfaceNavCell, ESPMode::ThreadSafe> Unsorted = FSurfaceNavCell::Build(FIntVector::ZeroValue, CellBox, Data, false);
+	const TSharedRef<const FSurfaceNavCell, ESPMode::ThreadSafe> Sorted = FSurfaceNavCell::Build(FIntVector::ZeroValue, CellBox, Data, true);
+
+	// Mean distance between centers of consecutive nodes, small if nodes close in space are close in memory
+	auto GetMeanStep = [](const FSurfaceNavCell& Cell)
+	{
+		const int32 CellNodesNum = Cell.GetNodesNum();
+		float Sum = 0;
+		for (int32 Node = 1; Node < CellNodesNum; Node++)
+		{
+			Sum += FVector::Dist(Cell.GetNodeCenter(Node - 1), Cell.GetNodeCenter(Node));
+		}
+		return CellNodesNum > 1 ? Sum / (CellNodesNum - 1) : 0.f;
+	};
+
+	const float UnsortedStep = GetMeanStep(*Unsorted);
+	const float SortedStep = GetMeanStep(*Sorted);
+	AddInfo(FString::Printf(TEXT("Nodes: %d, mean step between consecutive nodes: %.1f -> %.1f"), NodesNum, UnsortedStep, SortedStep));
+
+	TestEqual(TEXT("Sorting keeps nodes"), Sorted->Triangles.Num(), Unsorted->Triangles.Num());
+	TestEqual(TEXT("Sorting keeps links"), Sorted->Neighbours.Num(), Unsorted->Neighbours.Num());
+	TestTrue(TEXT("Morton order puts nodes close in space next to each other"), SortedStep * 4 < UnsortedStep);
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSurfaceNavCellCompactVerticesTest, "Library.SurfaceNavigation.Cell.CompactVertices", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FSurfaceNavCellCompactVerticesTest::RunTest(const FString& Parameters)
+{
+	using namespace SurfaceNavCellTest;
+
+	FCellCreationData Data;
+	BuildSphereMesh(Data.CellVertices, Data.CellTriangles, Data.OuterVertices);
+	if (!TestTrue(TEXT("Cell has surface"), Data.CellTriangles.Num() > 0)) return false;
+
+	const TSharedRef<const FSurfaceNavCell, ESPMode::ThreadSafe> Full = FSurfaceNavCell::Build(FIntVector::ZeroValue, CellBox, Data, true);
+	const TSharedRef<const FSurfaceNavCell, ESPMode::ThreadSafe> Compact = FSurfaceNavCell::Build(FIntVector::ZeroValue, CellBox, Data, true, true);
+
+	TestTrue(TEXT("Compact cell keeps only compact vertices"), Compact->IsCompact() && Compact->Vertices.Num() == 0);
+	TestEqual(TEXT("Same vertices num"), Compact->GetVerticesNum(), Full->GetVerticesNum());
+	TestTrue(TEXT("Same graph"), Compact->Triangles == Full->Triangles && Compact->Neighbours == Full->Neighbours);
+	TestEqual(TEXT("Same face edges, keys are built from full precision vertices"), Compact->FaceEdges.Num(), Full->FaceEdges.Num());
+
+	// One quantization step of 1.5 cell size box, rounding error is half of it
+	const float MaxError = 1.5f * CellBox.GetSize().GetMax() / 65535 * 0.5f;
+	float Error = 0;
+	for (int32 Vertex = 0; Vertex < Full->GetVerticesNum(); Vertex++)
+	{
+		Error = FMath::Max(Error, (Compact->GetVertex(Vertex) - Full->GetVertex(Vertex)).GetAbsMax());
+	}
+	TestTrue(FString::Printf(TEXT("Decoded vertices are within precision, error %f"), Error), Error <= MaxError * 1.01f);
+
+	AddInfo(FString::Printf(TEXT("Vertices: %d, cell memory: %d -> %d bytes"), Full->GetVerticesNum(), (int32)Full->GetAllocatedSize(), (int32)Compact->GetAllocatedSize()));
+	TestTrue(TEXT("Compact cell uses less memory"), Compact->GetAllocatedSize() < Full->GetAllocatedSize());
+
+	return true;
+}
+
+#endif //WITH_DEV_AUTOMATION_TESTS
@@ -0,0 +1,189 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "OccupancyMask.h"
+
+
+
+/**
+ * Non owning view of densities sampled on regular grid.
+ * Points are stored X first, then Y, then Z. Position of point is not stored, it is computed from grid coordinates.
+ * Only one of Densities, ByteDensities or OccupancyWords is expected to be set, bytes are mapped to [0, 1], bits to 0 or 1
+ */
+struct FDensityGridView
+{
+	FVector Origin = FVector::ZeroVector;
+
+	FVector VoxelSize = FVector(1.f);
+
+	FIntVector Dimensions = FIntVector::ZeroValue;
+
+	const float* Densities = nullptr;
+
+	const uint8* ByteDensities = nullptr;
+
+	// 1 bit per point in FOccupancyMask layout
+	const uint64* OccupancyWords = nullptr;
+
+	// Number of elements in density array, number of points for occupancy
+	int32 DensitiesNum = 0;
+
+
+	bool IsValid() const
+	{
+		return (Densities != nullptr || ByteDensities != nullptr || OccupancyWords != nullptr) && Dimensions.GetMin() > 0 && DensitiesNum >= GetPointsNum();
+	}
+
+	int32 GetPointsNum() const { return Dimensions.X * Dimensions.Y * Dimensions.Z; }
+
+	FORCEINLINE int32 GetPointIndex(int32 X, int32 Y, int32 Z) const
+	{
+		return X + Dimensions.X * Y + Dimensions.X * Dimensions.Y * Z;
+	}
+
+	FORCEINLINE float GetDensity(int32 Index) const
+	{
+		if (Densities) return Densities[Index];
+		if (ByteDensities) return ByteDensities[Index] * (1.f / 255.f);
+
+		const int32 X = Index % Dimensions.X;
+		const int32 Row = Index / Dimensions.X;
+		return FOccupancyMask::GetBit(OccupancyWords + Row * FOccupancyMask::GetWordsPerRow(Dimensions.X), X) ? 1.f : 0.f;
+	}
+
+	FORCEINLINE FVector GetPosition(int32 X, int32 Y, int32 Z) const
+	{
+		return Origin + FVector(X, Y, Z) * VoxelSize;
+	}
+
+	/** XYZ - position, W - density */
+	FORCEINLINE FVector4 GetPoint(int32 X, int32 Y, int32 Z) const
+	{
+		return FVector4(GetPosition(X, Y, Z), GetDensity(GetPointIndex(X, Y, Z)));
+	}
+
+	/** Box of outer points, invalid for empty grid */
+	FBox GetBounds() const
+	{
+		if (Dimensions.GetMin() <= 0) return FBox(ForceInit);
+		return FBox(Origin, GetPosition(Dimensions.X - 1, Dimensions.Y - 1, Dimensions.Z - 1));
+	}
+};
+
+
+
+/** Densities sampled on regular grid. Owns density array */
+struct LIBRARY_API FDensityGrid
+{
+	FVector Origin = FVector::ZeroVector;
+
+	FVector VoxelSize = FVector(1.f);
+
+	FIntVector Dimensions = FIntVector::ZeroValue;
+
+	// Full precision densities. Empty if grid is quantized
+	TArray<float> Densities;
+
+	// Densities quantized to 8 bits. Empty if grid is not quantized
+	TArray<uint8> ByteDensities;
+
+	// Occupancy only, 1 bit per point. Empty if grid has densities
+	TArray<uint64> OccupancyWords;
+
+public:
+	FDensityGridView GetView() const
+	{
+		FDensityGridView View;
+		View.Origin = Origin;
+		View.VoxelSize = VoxelSize;
+		View.Dimensions = Dimensions;
+		if (OccupancyWords.Num() > 0)
+		{
+			View.OccupancyWords = OccupancyWords.GetData();
+			View.DensitiesNum = OccupancyWords.Num() == FOccupancyMask::GetWordsNum(Dimensions) ? Dimensions.X * Dimensions.Y * Dimensions.Z : 0;
+		}
+		else if (ByteDensities.Num() > 0)
+		{
+			View.ByteDensities = ByteDensities.GetData();
+			View.DensitiesNum = ByteDensities.Num();
+		}
+		else
+		{
+			View.Densities = Densities.GetData();
+			View.DensitiesNum = Densities.Num();
+		}
+		return View;
+	}
+
+	bool IsQuantized() const { return ByteDensities.Num() > 0; }
+
+	bool IsOccupancy() const { return OccupancyWords.Num() > 0; }
+
+	/** Convert densities to 8 bits, values are clamped to [0, 1] */
+	void Quantize();
+
+	/**
+	 * Build grid from points with XYZ position and W density.
+	 * Origin and voxel size are taken from first point and its neighbours, positions of other points are ignored
+	 * @return false if there is not enough points for dimensions
+	 */
+	static bool FromPoints(const TArray<FVector4>& Points, const FIntVector& Dimensions, FDensityGrid& OutGrid);
+
+	/**
+	 * Build coarser level of detail from every Stride-th point of source grid. Densities are copied, not filtered,
+	 * so surface of coarse grid passes exactly through same face points as neighbouring grids of any level.
+	 * @return false if Dimensions - 1 of source is not divisible by Stride, border points would not be kept
+	 */
+	static bool Downsample(const FDensityGridView& Source, int32 Stride, FDensityGrid& OutGrid);
+};
+
+
+
+/**
+ * Min and max density of blocks of BlockSize^3 cubes, with coarser levels merging 2x2x2 blocks of previous level.
+ * Depends only on densities, so it can be reused for any surface level.
+ */
+struct LIBRARY_API FDensityBlockPyramid
+{
+	static constexpr int32 BlockSize = 8;
+
+	struct FLevel
+	{
+		FIntVector Dimensions;
+
+		TArray<float> Min;
+
+		TArray<float> Max;
+
+		FORCEINLINE int32 GetIndex(int32 X, int32 Y, int32 Z) const
+		{
+			return X + Dimensions.X * Y + Dimensions.X * Dimensions.Y * Z;
+		}
+	};
+
+	// First level is finest
+	TArray<FLevel> Levels;
+
+public:
+	void Build(const FDensityGridView& Grid);
+
+	bool IsBuilt() const { return Levels.Num() > 0; }
+
+	/** Number of blocks of finest level */
+	FIntVector GetBlocksNum() const { return IsBuilt() ? Levels[0].Dimensions : FIntVector::ZeroValue; }
+
+	/**
+	 * Find blocks of finest level that contain surface. Coarse levels are checked first, children of blocks without surface are skipped
+	 * @param	OutActive	Flag per block of finest level, indexed as FLevel::GetIndex
+	 * @return	Number of active blocks
+	 */
+	int32 GetActiveBlocks(float SurfaceLevel, TArray<uint8>& OutActive) const;
+
+	/** Block contains surface if it has points on both sides. Inside points are strictly above surface level */
+	static FORCEINLINE bool ContainsSurface(float Min, float Max, float SurfaceLevel)
+	{
+		return Min <= SurfaceLevel && Max > SurfaceLevel;
+	}
+};
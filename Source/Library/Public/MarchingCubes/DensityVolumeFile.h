@@ -0,0 +1,105 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "DensityGrid.h"
+
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+
+/**
+ * Header of density volume file. Payload of raw densities, X first then Y then Z, follows header at PayloadOffset.
+ * Volume can be split into chunks of ChunkSlices Z slices, chunks are stored one after another so whole volume stays contiguous.
+ */
+struct FDensityVolumeHeader
+{
+	static constexpr uint32 FileMagic = 0x4C4F5644; // 'DVOL'
+	static constexpr uint32 FileVersion = 1;
+
+	uint32 Magic = FileMagic;
+
+	uint32 Version = FileVersion;
+
+	int32 Dimensions[3] = { 0, 0, 0 };
+
+	float Origin[3] = { 0.f, 0.f, 0.f };
+
+	float VoxelSize[3] = { 1.f, 1.f, 1.f };
+
+	// 0 - float densities, 1 - byte densities
+	uint32 Quantized = 0;
+
+	// Z slices per chunk, 0 if volume is not split
+	int32 ChunkSlices = 0;
+
+	// Header is padded, so payload is aligned for vector loads
+	uint32 PayloadOffset = 64;
+
+	uint32 Reserved[2] = { 0, 0 };
+
+	int64 GetPayloadSize() const 
+	{ 
+		return (int64)Dimensions[0] * Dimensions[1] * Dimensions[2] * (Quantized ? sizeof(uint8) : sizeof(float)); 
+	}
+};
+static_assert(sizeof(FDensityVolumeHeader) == 64, "Header must match PayloadOffset");
+
+
+
+class LIBRARY_API FDensityVolumeWriter
+{
+public:
+	/** 
+	 * Write grid to file, replaces existing file
+	 * @param	ChunkSlices		Z slices per chunk, 0 to keep volume as single chunk
+	 */
+	static bool Write(const FString& Filename, const FDensityGridView& Grid, int32 ChunkSlices = 0);
+};
+
+
+
+/**
+ * Memory mapped density volume. Views point directly into mapped file and are valid while reader is alive.
+ * Falls back to loading file to memory if platform does not support mapping.
+ */
+class LIBRARY_API FDensityVolumeReader
+{
+private:
+	FDensityVolumeHeader Header;
+
+	TUniquePtr<IMappedFileHandle> MappedHandle;
+
+	TUniquePtr<IMappedFileRegion> MappedRegion;
+
+	// Used if file could not be mapped
+	TArray<uint8> LoadedData;
+
+	const uint8* Payload = nullptr;
+
+public:
+	FDensityVolumeReader();
+	~FDensityVolumeReader();
+
+	bool Open(const FString& Filename);
+
+	void Close();
+
+	bool IsOpen() const { return Payload != nullptr; }
+
+	bool IsMapped() const { return MappedRegion.IsValid(); }
+
+	const FDensityVolumeHeader& GetHeader() const { return Header; }
+
+	/** Zero copy view of whole volume */
+	FDensityGridView GetView() const;
+
+	int32 GetChunksNum() const;
+
+	/** 
+	 * Zero copy view of chunk. Chunk includes first slice of next chunk, 
+	 * so meshes of neighbouring chunks meet each other. Empty view if ChunkIndex is out of range
+	 */
+	FDensityGridView GetChunkView(int32 ChunkIndex) const;
+};
@@ -3,6 +3,8 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "DensityGrid.h"
+#include "QuantizedVector.h"
 
 
 DECLARE_LOG_CATEGORY_EXTERN(MarchingCubesBuilder, Log, All);
@@ -36,29 +38,165 @@ FORCEINLINE uint32 GetTypeHash(const FIndexEdge& Edge)
 }
 
 
+
+/**
+ * Dense vertex cache for edges of two neighbouring Z layers of points.
+ * Every point owns 3 edges (X, Y and Z directed), so each slab is sized X*Y*3.
+ * Cubes of layer Z only reference edges owned by points of layers Z and Z+1,
+ * which allows to reuse slab of layer Z-1 for layer Z+1 when sweep moves up.
+ */
+struct FMarchingCubesEdgeSlabs
+{
+private:
+	TArray<int32> Slabs[2];
+
+	int32 SizeX = 0;
+
+	int32 FirstLayer = 0;
+
+public:
+	/** @param	FirstCubeLayer	First layer of cubes that will be polygonized */
+	void Init(const FIntVector& Dimensions, int32 FirstCubeLayer = 0)
+	{
+		SizeX = Dimensions.X;
+		FirstLayer = FirstCubeLayer;
+		Slabs[0].Init(INDEX_NONE, Dimensions.X * Dimensions.Y * 3);
+		Slabs[1].Init(INDEX_NONE, Dimensions.X * Dimensions.Y * 3);
+	}
+
+	/** Prepare slabs for polygonization of cubes layer. Must be called in increasing order of layers */
+	void BeginLayer(int32 CubeLayerZ)
+	{
+		if (CubeLayerZ > FirstLayer)
+		{
+			// Slab of layer Z-1 is not referenced anymore, reuse it for layer Z+1
+			TArray<int32>& FreeSlab = Slabs[(CubeLayerZ + 1) & 1];
+			FMemory::Memset(FreeSlab.GetData(), 0xFF, FreeSlab.Num() * sizeof(int32));
+		}
+	}
+
+	FORCEINLINE int32 GetSlotIndex(const FIntVector& OwnerPoint, int32 EdgeAxis) const
+	{
+		return (OwnerPoint.X + OwnerPoint.Y * SizeX) * 3 + EdgeAxis;
+	}
+
+	/** Vertex index of edge, INDEX_NONE if vertex was not created yet */
+	FORCEINLINE int32& GetEdgeVertex(const FIntVector& OwnerPoint, int32 EdgeAxis)
+	{
+		return Slabs[OwnerPoint.Z & 1][GetSlotIndex(OwnerPoint, EdgeAxis)];
+	}
+
+	/** Slab of points layer. Valid only for two last layers */
+	const TArray<int32>& GetSlab(int32 PointLayerZ) const
+	{
+		return Slabs[PointLayerZ & 1];
+	}
+
+	void Empty()
+	{
+		Slabs[0].Empty();
+		Slabs[1].Empty();
+	}
+};
+
+
+
+/** Triangulation of one cube configuration. Edges of triangles are packed 4 bits each, first edge in lowest bits */
+struct alignas(16) FMarchingCubesCase
+{
+	uint64 PackedEdges = 0;
+
+	uint8 TriangleNum = 0;
+
+	FORCEINLINE int32 GetEdge(int32 Index) const { return static_cast<int32>((PackedEdges >> (Index * 4)) & 0xF); }
+};
+
+struct FMarchingCubesCaseTable
+{
+	FMarchingCubesCase Cases[256];
+};
+
+
+
+/** Cube that intersects surface, found by classification pass */
+struct FMarchingCubesActiveCube
+{
+	FIntVector Coords;
+
+	/** Index into EdgeTable/TriTable. Bit N is set if corner N is inside of the surface */
+	uint8 CubeIndex;
+
+	FMarchingCubesActiveCube(const FIntVector& Coords, uint8 CubeIndex) : Coords(Coords), CubeIndex(CubeIndex) {}
+};
+
+
+
+/** Mesh polygonized from range of cube layers */
+struct FMarchingCubesChunk
+{
+	int32 FirstLayer = 0;
+
+	// Exclusive
+	int32 EndLayer = 0;
+
+	TArray<FVector> Vertices;
+
+	/**
+	 * Indices of triangles. Chunks that do not start at first layer reference vertices on their bottom plane
+	 * with negative values (see EncodeSharedEdge), these are resolved to previous chunk vertices on merge
+	 */
+	TArray<int32> Indices;
+
+	// Global edge index of every vertex. Filled only if incremental data is recorded
+	TArray<int32> VertexEdges;
+
+	// Point index of cube that produced triangle
+	TArray<int32> TriangleCubes;
+
+	FMarchingCubesEdgeSlabs EdgeSlabs;
+
+	/** Placeholder for vertex created by previous chunk. Never equals INDEX_NONE */
+	static FORCEINLINE int32 EncodeSharedEdge(int32 SlotIndex) { return -2 - SlotIndex; }
+	static FORCEINLINE int32 DecodeSharedEdge(int32 Index) { return -2 - Index; }
+};
+
+
+
 class FMarchingCubesBuilder
 {
 public:
 	//Bitmask of edges intersected by isosurface
-	static const uint16 EdgeTable[256];
+	static const uint16 (&EdgeTable)[256];
 
 	//Triangles for configuration
-	static const int8 TriTable[256][16];
+	static const int8 (&TriTable)[256][16];
+
+	// TriTable packed with triangle count, generated at compile time. Used by triangulation loops instead of walking to -1
+	static const FMarchingCubesCase (&CaseTable)[256];
 
 	// index of both vertices of edge in cell
-	static const int8 Edges[12][2];
+	static const int8 (&Edges)[12][2];
 
 	// Each cube 'owns' only edges connected to first vertex. Other edges owned by neighboring cubes
 	// This table converts local edge index to cube coordinate offset pointing to owner of edge
 	static const FIntVector EdgeToCubeOffset[12];
 
+	// Offset of cube corner from first corner, bit order of cube index
+	static const FIntVector CubeCorners[8];
+
 private:
 
 	// Offset for storing edges, 0*StorageOffset offset for X edges, 1*StorageOffset Offset for Y edges, 2*StorageOffset Offsets for Z edges
 	int32 StorageOffset;
 
+	// Difference of global edge index and point index of cube, per local edge
+	int32 EdgeGlobalOffsets[12];
 
-	const TArray<FVector4>& Points;
+
+	FDensityGridView Grid;
+
+	// Storage for grid converted from points
+	FDensityGrid PointsGrid;
 
 	const FIntVector Dimensions;
 
@@ -68,6 +206,57 @@ private:
 	TArray<FVector> Vertices;
 
 	TArray<int32> Indices;
+
+	/** One bit per point, set if point is inside of the surface. Every row of X points starts at new word */
+	TArray<uint64> InsideMask;
+
+	int32 MaskWordsPerRow = 0;
+
+	// External pyramid, see SetBlockPyramid
+	const FDensityBlockPyramid* BlockPyramid = nullptr;
+
+	// Pyramid built by this builder if there is no external one. Rebuilt by every Build
+	FDensityBlockPyramid OwnedBlockPyramid;
+
+	/** Flag per block of finest pyramid level, set if block contains surface. Valid during build if SkipEmptyBlocks enabled */
+	TArray<uint8> ActiveBlocks;
+
+	FIntVector BlocksNum = FIntVector::ZeroValue;
+
+	//~ Begin incremental update data
+	/** Global edge index of every vertex, INDEX_NONE for retired vertex */
+	TArray<int32> VertexEdges;
+
+	/** Point index of cube that produced triangle, INDEX_NONE for retired triangle */
+	TArray<int32> TriangleCubes;
+
+	/** Number of triangles referencing vertex */
+	TArray<int32> VertexUseCount;
+
+	TArray<int32> FreeVertices;
+
+	TArray<int32> FreeTriangles;
+
+	/** Triangles of every block of FDensityBlockPyramid::BlockSize^3 cubes, so update visits only triangles near dirty region */
+	TArray<TArray<int32>> BlockTriangles;
+
+	FIntVector TriangleBlocksNum = FIntVector::ZeroValue;
+
+	/** Position of every edge in BoundaryEdges and InnerEdges, built by first update after edges are calculated */
+	TMap<FIndexEdge, int32> BoundaryEdgeSlots;
+
+	TMap<FIndexEdge, int32> InnerEdgeSlots;
+
+	bool EdgeSlotsValid = false;
+
+	bool IncrementalDataValid = false;
+
+	bool HasDirtyRegion = false;
+
+	FIntVector DirtyMin;
+
+	FIntVector DirtyMax;
+	//~ End incremental update data
 	
 	TArray<FIndexEdge> BoundaryEdges;
 	TArray<FIndexEdge> InnerEdges;
@@ -84,19 +273,70 @@ public:
 	// Disabling this option will result in duplicate vertices on triangle connections
 	bool RemoveDuplicateVertices = true;
 
+	// Keep vertices of only two layers of edges in dense arrays instead of map of all edges. Memory O(X*Y), no hashing
+	// Produces same vertices and indices as map. Requires RemoveDuplicateVertices enabled
+	bool UseSlabEdgeCache = true;
+
 	// Requires RemoveDuplicateVertices enabled
 	bool FindBoundaryEdges = false;
 
+	// Split grid into Z slabs and polygonize them on task graph. Result is identical to single threaded build
+	// Vertices deduplicated with slab cache regardless of UseSlabEdgeCache
+	bool BuildInParallel = false;
+
+	// Minimal number of cube layers processed by one parallel task
+	int32 MinLayersPerTask = 4;
+
+	// Classify cubes with vectorized pass over whole rows and polygonize only cubes that intersect surface
+	bool ClassifyCubes = true;
+
+	// Skip blocks of 8^3 cubes that have no surface using min/max density pyramid
+	// Own pyramid is rebuilt by every Build. To reuse one pyramid between builds of unchanged densities pass it to SetBlockPyramid
+	bool SkipEmptyBlocks = false;
+
+	// Keep edge of every vertex and cube of every triangle to allow UpdateDirtyRegion. Requires RemoveDuplicateVertices enabled
+	bool AllowIncrementalUpdate = false;
+
+	// Reorder triangles and vertices from Z slab sweep into X, Y, Z cube order of original builder
+	// Costs extra pass and temporary arrays. Disable when order of triangles does not matter, e.g. for navigation graph
+	bool RestoreLegacyOrder = true;
+
+	// Level of detail stride of neighbouring grid relative to this one, per face: -X, +X, -Y, +Y, -Z, +Z
+	// Approximate seam snapping: vertices on face with stride above 1 are moved onto surface outline of coarser neighbour,
+	// which closes cracks of smooth surfaces between LODs. No transition triangles are emitted, so fine vertices between coarse ones
+	// remain T-junctions of the coarse mesh. Features smaller than coarse square and outlines leaving the face may still leave gaps
+	// Coarse grids are made with FDensityGrid::Downsample
+	int32 NeighbourLODStride[6] = { 1, 1, 1, 1, 1, 1 };
+
 
 public:
+	FMarchingCubesBuilder(const FDensityGridView& Grid)
+		: StorageOffset(Grid.GetPointsNum())
+		, Grid(Grid)
+		, Dimensions(Grid.Dimensions)
+	{
+		InitEdgeGlobalOffsets();
+		ValidateInput();
+	}
+
+	/** Points are converted to density grid. XYZ of points are expected to form regular grid, W - density */
 	FMarchingCubesBuilder(const TArray<FVector4>& Points, const FIntVector Dimensions)
 		: StorageOffset(Dimensions.X*Dimensions.Y*Dimensions.Z)
-		, Points(Points)
 		, Dimensions(Dimensions)
 	{
+		FDensityGrid::FromPoints(Points, Dimensions, PointsGrid);
+		Grid = PointsGrid.GetView();
+		Grid.Dimensions = Dimensions;
+		InitEdgeGlobalOffsets();
 		ValidateInput();
 	}
 
+	/** 
+	 * Use pyramid built for same grid instead of building own one. Allows to share pyramid between builders
+	 * Pyramid must outlive builder. Does not enable SkipEmptyBlocks
+	 */
+	void SetBlockPyramid(const FDensityBlockPyramid* Pyramid) { BlockPyramid = Pyramid; }
+
 	void Build()
 	{
 		if (!IsValid()) return;
@@ -105,18 +345,43 @@ public:
 		Vertices.Empty();
 		Indices.Empty();
 		BoundaryEdgesCalculated = false;
+		HasDirtyRegion = false;
 
-		for (int X = 0; X < Dimensions.X - 1; X++)
+		ActiveBlocks.Empty();
+		if (SkipEmptyBlocks)
 		{
-			for (int Y = 0; Y < Dimensions.Y - 1; Y++)
-			{
-				for (int Z = 0; Z < Dimensions.Z - 1; Z++)
-				{
-					PoligonizeCube(FIntVector(X, Y, Z));
-				}
-			}
+			FindActiveBlocks();
 		}
 
+		if (ClassifyCubes)
+		{
+			ClassifyPoints();
+		}
+
+		if (BuildInParallel)
+		{
+			BuildChunksParallel();
+		}
+		else
+		{
+			FMarchingCubesChunk Chunk;
+			Chunk.FirstLayer = 0;
+			Chunk.EndLayer = Dimensions.Z - 1;
+			PoligonizeChunk(Chunk, RemoveDuplicateVertices && UseSlabEdgeCache);
+
+			Vertices = MoveTemp(Chunk.Vertices);
+			Indices = MoveTemp(Chunk.Indices);
+			VertexEdges = MoveTemp(Chunk.VertexEdges);
+			TriangleCubes = MoveTemp(Chunk.TriangleCubes);
+		}
+
+		if (RestoreLegacyOrder)
+		{
+			RestoreSweepOrder();
+		}
+
+		InitIncrementalData();
+
 		if (RemoveDuplicateVertices == false)
 		{
 			Indices.Init(0, Vertices.Num());
@@ -126,6 +391,11 @@ public:
 			}
 		}
 
+		InsideMask.Empty();
+		ActiveBlocks.Empty();
+
+		ConformTransitionFaces();
+
 		if (FindBoundaryEdges && RemoveDuplicateVertices)
 		{
 			CalcOuterEdges();
@@ -134,22 +404,135 @@ public:
 		UE_LOG(MarchingCubesBuilder, Log, TEXT("Built mesh. Vertices: %d, Triangles: %d"), Vertices.Num(), Indices.Num() / 3);
 	}
 
+	/** 
+	 * Mark points in box [MinPoint, MaxPoint] as changed. Boxes are accumulated until UpdateDirtyRegion
+	 * Densities are read from grid view during update, so this is only meaningful for builder constructed from grid view
+	 */
+	void MarkDirty(const FIntVector& MinPoint, const FIntVector& MaxPoint);
+
+	/** 
+	 * Polygonize again only cubes touching dirty points. Vertex and index buffers are patched in place,
+	 * retired slots are reused by following updates. Only triangles of blocks around dirty region are visited,
+	 * boundary and inner edges are updated locally. Retired slots are skipped by GetData and TakeData.
+	 * Falls back to full Build if mesh was built without AllowIncrementalUpdate
+	 */
+	void UpdateDirtyRegion();
+
+	bool IsDirty() const { return HasDirtyRegion; }
+
 protected:
-	void PoligonizeCube(FIntVector CubeCoords)
+	void PoligonizeChunk(FMarchingCubesChunk& Chunk, bool bUseSlabs)
 	{
-		const FVector4 Verts[8] =
+		if (bUseSlabs)
 		{
-			GetPoint(CubeCoords + FIntVector(0, 0, 0)),
-			GetPoint(CubeCoords + FIntVector(1, 0, 0)),
-			GetPoint(CubeCoords + FIntVector(1, 1, 0)),
-			GetPoint(CubeCoords + FIntVector(0, 1, 0)),
-
-			GetPoint(CubeCoords + FIntVector(0, 0, 1)),
-			GetPoint(CubeCoords + FIntVector(1, 0, 1)),
-			GetPoint(CubeCoords + FIntVector(1, 1, 1)),
-			GetPoint(CubeCoords + FIntVector(0, 1, 1))
-		};
+			Chunk.EdgeSlabs.Init(Dimensions, Chunk.FirstLayer);
+		}
+
+		if (ClassifyCubes)
+		{
+			TArray<FMarchingCubesActiveCube> ActiveCubes;
+			GatherActiveCubes(Chunk.FirstLayer, Chunk.EndLayer, ActiveCubes);
+
+			// Active cubes are ordered same as sweep below, but layers without surface are skipped
+			int32 CurrentLayer = Chunk.FirstLayer - 1;
+			for (const FMarchingCubesActiveCube& Cube : ActiveCubes)
+			{
+				while (bUseSlabs && CurrentLayer < Cube.Coords.Z)
+				{
+					Chunk.EdgeSlabs.BeginLayer(++CurrentLayer);
+				}
+				TriangulateCube(Cube.Coords, Cube.CubeIndex, Chunk, bUseSlabs);
+			}
+			return;
+		}
+
+		// Sweep in memory order of points, slab cache relies on Z being the outer loop
+		for (int Z = Chunk.FirstLayer; Z < Chunk.EndLayer; Z++)
+		{
+			if (bUseSlabs)
+			{
+				Chunk.EdgeSlabs.BeginLayer(Z);
+			}
+
+			for (int Y = 0; Y < Dimensions.Y - 1; Y++)
+			{
+				for (int X = 0; X < Dimensions.X - 1; X++)
+				{
+					if (!IsBlockActive(X, Y, Z))
+					{
+						// Jump to last cube of block
+						X += FDensityBlockPyramid::BlockSize - 1 - X % FDensityBlockPyramid::BlockSize;
+						continue;
+					}
+					PoligonizeCube(FIntVector(X, Y, Z), Chunk, bUseSlabs);
+				}
+			}
+		}
+	}
+
+	/** Polygonize Z slabs on task graph and merge them in order */
+	void BuildChunksParallel();
+
+	/** 
+	 * Cubes are polygonized in Z, Y, X order. Reorder triangles to X, Y, Z order of cubes and number vertices by first use,
+	 * so output has same vertices and indices as sweep with X as outer loop
+	 */
+	void RestoreSweepOrder();
+
+	/** Count vertex uses, reset free lists and sort triangles into blocks after full build */
+	void InitIncrementalData();
+
+	FORCEINLINE int32 GetTriangleBlock(int32 CubePointIndex) const
+	{
+		const int32 BlockSize = FDensityBlockPyramid::BlockSize;
+		const int32 X = CubePointIndex % Dimensions.X;
+		const int32 Y = (CubePointIndex / Dimensions.X) % Dimensions.Y;
+		const int32 Z = CubePointIndex / (Dimensions.X * Dimensions.Y);
+		return X / BlockSize + TriangleBlocksNum.X * (Y / BlockSize + TriangleBlocksNum.Y * (Z / BlockSize));
+	}
+
+	/** Index of every vertex in output without vertices retired by incremental update. Empty if no vertex is retired */
+	void GetCompactVertexRemap(TArray<int32>& OutRemap) const;
+
+	/** Indices of triangles that are not retired, remapped if VertexRemap is not empty */
+	void CopyLiveIndices(const TArray<int32>& VertexRemap, TArray<int32>& OutIndices) const;
+
+	static void RemapEdges(const TArray<int32>& VertexRemap, TArray<FIndexEdge>& Edges);
+
+	/** Polygonize cube of incremental update. Vertices of known edges are updated in place, new ones go to free slots */
+	void RepoligonizeCube(const FIntVector& CubeCoords, TMap<int32, int32>& EdgeToVertex, TArray<int32>& OutNewTriangles);
+
+	FORCEINLINE bool IsRecordingIncrementalData() const { return AllowIncrementalUpdate && RemoveDuplicateVertices; }
 
+	/** 
+	 * Approximate seam snapping of faces with coarser neighbour, see NeighbourLODStride.
+	 * Vertex on crossed side of coarse square takes exact crossing of that side, other vertices move to closest point of square's outline.
+	 * Vertices in coarse square without outline snap to outline of neighbouring squares or collapse to center of fine outline in the square.
+	 * Mesh is not retriangulated, so borders meet geometrically but with T-junctions
+	 * @param VertexIndices - Vertices to conform, all vertices if null
+	 */
+	void ConformTransitionFaces(const TArray<int32>* VertexIndices = nullptr);
+
+	/** Fill ActiveBlocks from pyramid, builds own pyramid if needed */
+	void FindActiveBlocks();
+
+	/** @return	true if block containing cube may have surface */
+	FORCEINLINE bool IsBlockActive(int32 CubeX, int32 CubeY, int32 CubeZ) const
+	{
+		if (ActiveBlocks.Num() == 0) return true;
+
+		const int32 BlockSize = FDensityBlockPyramid::BlockSize;
+		return ActiveBlocks[CubeX / BlockSize + BlocksNum.X * (CubeY / BlockSize) + BlocksNum.X * BlocksNum.Y * (CubeZ / BlockSize)] != 0;
+	}
+
+	/** Fill InsideMask using vector compares on grid densities. Points of blocks without surface are not classified */
+	void ClassifyPoints();
+
+	/** Collect cubes of layers [FirstLayer, EndLayer) that intersect surface, in Z, Y, X order */
+	void GatherActiveCubes(int32 FirstLayer, int32 EndLayer, TArray<FMarchingCubesActiveCube>& OutCubes) const;
+
+	void PoligonizeCube(FIntVector CubeCoords, FMarchingCubesChunk& Chunk, bool bUseSlabs)
+	{
 		/*
 		  Determine the index into the edge table which
 		  tells us which vertices are inside of the surface
@@ -157,7 +540,7 @@ protected:
 		uint8 cubeindex = 0;
 		for (int Index = 0; Index < 8; Index++)
 		{
-			if (Verts[Index].W > SurfaceLevel)
+			if (GetDensity(CubeCoords + CubeCorners[Index]) > SurfaceLevel)
 			{
 				cubeindex |= 1 << Index;
 			}
@@ -165,15 +548,58 @@ protected:
 		/* Cube is entirely in/out of the surface */
 		if (EdgeTable[cubeindex] == 0) return;
 
-		
+		TriangulateCube(CubeCoords, cubeindex, Chunk, bUseSlabs);
+	}
+
+	void TriangulateCube(const FIntVector& CubeCoords, uint8 cubeindex, FMarchingCubesChunk& Chunk, bool bUseSlabs)
+	{
+		const FVector4 Verts[8] =
+		{
+			GetPoint(CubeCoords + CubeCorners[0]),
+			GetPoint(CubeCoords + CubeCorners[1]),
+			GetPoint(CubeCoords + CubeCorners[2]),
+			GetPoint(CubeCoords + CubeCorners[3]),
+
+			GetPoint(CubeCoords + CubeCorners[4]),
+			GetPoint(CubeCoords + CubeCorners[5]),
+			GetPoint(CubeCoords + CubeCorners[6]),
+			GetPoint(CubeCoords + CubeCorners[7])
+		};
+
 		/* Create the triangle */
-		for (int i = 0; TriTable[cubeindex][i] != -1; i++)
+		const FMarchingCubesCase& Case = CaseTable[cubeindex];
+		const int32 EdgesNum = Case.TriangleNum * 3;
+		for (int i = 0; i < EdgesNum; i++)
 		{
-			int LocalEdgeIndex = TriTable[cubeindex][i];
+			int LocalEdgeIndex = Case.GetEdge(i);
 			int a = Edges[LocalEdgeIndex][0];
 			int b = Edges[LocalEdgeIndex][1];
 
-			if (RemoveDuplicateVertices)
+			if (RemoveDuplicateVertices && bUseSlabs)
+			{
+				const FIntVector OwnerPoint = CubeCoords + EdgeToCubeOffset[LocalEdgeIndex];
+				const int32 EdgeAxis = GetEdgeAxis(LocalEdgeIndex);
+
+				int32& UniqueVerticeIndex = Chunk.EdgeSlabs.GetEdgeVertex(OwnerPoint, EdgeAxis);
+				if (UniqueVerticeIndex == INDEX_NONE)
+				{
+					if (OwnerPoint.Z == Chunk.FirstLayer && Chunk.FirstLayer > 0 && EdgeAxis != 2)
+					{
+						// Edge lies on bottom plane, vertex is owned by previous chunk
+						UniqueVerticeIndex = FMarchingCubesChunk::EncodeSharedEdge(Chunk.EdgeSlabs.GetSlotIndex(OwnerPoint, EdgeAxis));
+					}
+					else
+					{
+						UniqueVerticeIndex = Chunk.Vertices.Add(VertexLerp(SurfaceLevel, Verts[a], Verts[b]));
+						if (IsRecordingIncrementalData())
+						{
+							Chunk.VertexEdges.Add(GetEdgeIndexGlobal(CubeCoords, LocalEdgeIndex));
+						}
+					}
+				}
+				Chunk.Indices.Add(UniqueVerticeIndex);
+			}
+			else if (RemoveDuplicateVertices)
 			{
 				uint32 GlobalEdgeIndex = GetEdgeIndexGlobal(CubeCoords, LocalEdgeIndex);
 				int32 UniqueVerticeIndex;
@@ -183,13 +609,27 @@ protected:
 				}
 				else
 				{
-					UniqueVerticeIndex = GlobalIndexToVertice.Add(GlobalEdgeIndex, Vertices.Add(VertexLerp(SurfaceLevel, Verts[a], Verts[b])));
+					UniqueVerticeIndex = GlobalIndexToVertice.Add(GlobalEdgeIndex, Chunk.Vertices.Add(VertexLerp(SurfaceLevel, Verts[a], Verts[b])));
+					if (IsRecordingIncrementalData())
+					{
+						Chunk.VertexEdges.Add(GlobalEdgeIndex);
+					}
 				}
-				Indices.Add(UniqueVerticeIndex);
+				Chunk.Indices.Add(UniqueVerticeIndex);
 			}
 			else
 			{
-				Vertices.Add(VertexLerp(SurfaceLevel, Verts[a], Verts[b]));
+				Chunk.Vertices.Add(VertexLerp(SurfaceLevel, Verts[a], Verts[b]));
+			}
+		}
+
+		// Needed by RestoreSweepOrder and incremental update
+		if (RestoreLegacyOrder || IsRecordingIncrementalData())
+		{
+			const int32 CubePointIndex = Grid.GetPointIndex(CubeCoords.X, CubeCoords.Y, CubeCoords.Z);
+			for (int i = 0; i < Case.TriangleNum; i++)
+			{
+				Chunk.TriangleCubes.Add(CubePointIndex);
 			}
 		}
 	}	
@@ -197,7 +637,7 @@ protected:
 	void ValidateInput()
 	{
 		InputIsValid = true;
-		if (Dimensions.X * Dimensions.Y * Dimensions.Z > Points.Num())
+		if (Dimensions.X * Dimensions.Y * Dimensions.Z > Grid.DensitiesNum)
 		{
 			UE_LOG(MarchingCubesBuilder, Error, TEXT("Dimension mismatch. Not enough Points to match Dimetsions"));
 			InputIsValid = false;
@@ -209,26 +649,39 @@ protected:
 		}
 	}
 
-	const FVector4& GetPoint(const FIntVector& Coords) const
+	FORCEINLINE FVector4 GetPoint(const FIntVector& Coords) const
 	{
-		return GetPoint(Coords.X, Coords.Y, Coords.Z);
+		return Grid.GetPoint(Coords.X, Coords.Y, Coords.Z);
 	}
-	const FVector4& GetPoint(int32 X, int32 Y, int32 Z) const
+
+	FORCEINLINE float GetDensity(const FIntVector& Coords) const
 	{
-		return Points[X + Dimensions.X * Y + Dimensions.X*Dimensions.Y * Z];
+		return Grid.GetDensity(Grid.GetPointIndex(Coords.X, Coords.Y, Coords.Z));
 	}
 
 	FORCEINLINE int32 GetEdgeIndexGlobal(const FIntVector& CubeCoordinate, int EdgeIndexLocal) const
 	{
-		FIntVector OwningCubeCoord = CubeCoordinate + EdgeToCubeOffset[EdgeIndexLocal];
-		int Index = OwningCubeCoord.X + OwningCubeCoord.Y*(Dimensions.X) + OwningCubeCoord.Z*(Dimensions.X*Dimensions.Y);
+		return CubeCoordinate.X + CubeCoordinate.Y * Dimensions.X + CubeCoordinate.Z * (Dimensions.X * Dimensions.Y) + EdgeGlobalOffsets[EdgeIndexLocal];
+	}
 
-		if (EdgeIndexLocal == 3 || EdgeIndexLocal == 1 || EdgeIndexLocal == 5 || EdgeIndexLocal == 7) Index += StorageOffset;
-		if (EdgeIndexLocal >= 8) Index += 2 * StorageOffset;
-		return Index;
+	/** Offsets of owner point and edge axis storage do not depend on cube, computed once per grid */
+	void InitEdgeGlobalOffsets()
+	{
+		for (int32 Edge = 0; Edge < 12; Edge++)
+		{
+			const FIntVector& Offset = EdgeToCubeOffset[Edge];
+			EdgeGlobalOffsets[Edge] = Offset.X + Offset.Y * Dimensions.X + Offset.Z * (Dimensions.X * Dimensions.Y) + GetEdgeAxis(Edge) * StorageOffset;
+		}
 	}
 
 public:
+	/** 0 for X directed edges, 1 for Y, 2 for Z */
+	static FORCEINLINE int32 GetEdgeAxis(int EdgeIndexLocal)
+	{
+		if (EdgeIndexLocal >= 8) return 2;
+		return (EdgeIndexLocal & 1);
+	}
+
 	/** Lerp between XYZ points using W component and SurfaceLevel */
 	static FORCEINLINE FVector VertexLerp(float SurfaceLevel, FVector4 P1, FVector4 P2)
 	{
@@ -249,13 +702,25 @@ public:
 
 	bool IsValid() const { return InputIsValid; }
 
-	void GetData(TArray<FVector>& OutVertices, TArray<int32>& OutIndices) const
-	{
-		OutIndices = Indices;
-		OutVertices = Vertices;
-	}	
+	/** 
+	 * Triangles and vertices retired by incremental update are skipped, following vertices move down.
+	 * Outer vertices and edges are returned with same numbering
+	 */
+	void GetData(TArray<FVector>& OutVertices, TArray<int32>& OutIndices) const;
 	
 
+	/** 
+	 * Vertices as 16 bit fixed point inside of grid bounds, half the size of FVector. Decode with OutQuantizer
+	 * Error is below grid size / 131070 per axis
+	 */
+	void GetQuantizedData(TArray<FQuantizedVector>& OutVertices, TArray<int32>& OutIndices, FVectorQuantizer& OutQuantizer) const;
+
+	/** 
+	 * Move mesh out of builder without copying. Retired triangles are compacted in place
+	 * Builder is left without mesh, boundary and inner edges stay until taken, incremental update requires new Build
+	 */
+	void TakeData(TArray<FVector>& OutVertices, TArray<int32>& OutIndices);
+
 	/** @returns	true	if boundary edges were calculated. */
 	bool GetOuterVertices(TArray<int32>& OutIndices) const;
 
@@ -265,6 +730,9 @@ public:
 	/** @returns	true	if inner edges were calculated. */
 	bool GetInnerEdges(TArray<FIndexEdge>& OutEdges) const;
 
+	/** Move edges out of builder, both are cleared. @returns	true	if edges were calculated. */
+	bool TakeEdges(TArray<FIndexEdge>& OutBoundaryEdges, TArray<FIndexEdge>& OutInnerEdges);
+
 	bool IsBoundaryCalculated() const { return BoundaryEdgesCalculated; }
 
 	/** Force recalculate boundary and inner edges. 
@@ -273,10 +741,41 @@ public:
 	 */
 	void CalcOuterEdges();
 
+	/** Order independent key of edge, min index in high half */
+	FORCEINLINE static uint64 MakeEdgeKey(int32 A, int32 B)
+	{
+		return A < B ? (static_cast<uint64>(A) << 32) | static_cast<uint32>(B) : (static_cast<uint64>(B) << 32) | static_cast<uint32>(A);
+	}
+
+	/** LSD radix sort of packed edge keys, only bytes that can be non zero for given vertex count are processed */
+	static void RadixSortEdgeKeys(TArray<uint64>& Keys, int32 VerticesNum);
 
+	/** Split triangle edges into boundary (one triangle) and inner (shared) edges. Triangles starting with INDEX_NONE are skipped */
+	static void ClassifyEdges(const TArray<int32>& TriangleIndices, int32 VerticesNum, TArray<FIndexEdge>& OutBoundaryEdges, TArray<FIndexEdge>& OutInnerEdges);
 
+	/** Sorted unique vertices of edges */
+	static void GetEdgeVertices(const TArray<FIndexEdge>& Edges, TArray<int32>& OutIndices);
+
+	/** 
+	 * Quadric error edge collapse. Stops when mesh has TargetTriangleNum triangles or quadric error of next collapse exceeds MaxError^2
+	 * Quadric error is sum of squared distances to planes of all merged triangles, so MaxError is a threshold, not a distance bound
+	 * TargetTriangleNum <= 0 means only error limits simplification. Collapses failing link condition are skipped, mesh stays manifold
+	 * Boundary vertices are locked so cells still stitch. Result is compacted, incremental update is not possible afterwards
+	 */
+	void SimplifyMesh(int32 TargetTriangleNum, float MaxError);
+
+	/** Collapse edges of flat regions only */
 	void CollapseCoplanarTriangles();
 
+	/** 
+	 * Reorder triangles for post-transform vertex cache (Tipsify) and renumber vertices in first use order
+	 * Shape of mesh is not changed, incremental update is not possible afterwards
+	 */
+	void OptimizeVertexCache(int32 CacheSize = 16);
+
+	/** Average cache miss per triangle of FIFO vertex cache. 0.5 is optimal for large meshes, 3 is worst */
+	static float CalcACMR(const TArray<int32>& TriangleIndices, int32 VerticesNum, int32 CacheSize = 16);
+
 	
 };
 
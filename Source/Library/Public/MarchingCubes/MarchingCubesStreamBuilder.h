@@ -0,0 +1,97 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "MarchingCubesBuilder.h"
+
+
+/**
+ * Marching cubes over Z slices of densities that arrive in order. Only two slices and two edge slabs are resident,
+ * triangles of every cube layer are passed to consumer as soon as its top slice is added.
+ * Slices can be pushed with AddSlice as sampler produces them, or pulled from producer with Build.
+ * Cubes are visited in Z, Y, X order. Produces same vertices and indices as FMarchingCubesBuilder with RemoveDuplicateVertices enabled
+ * and RestoreLegacyOrder disabled. With legacy order enabled the builder has same triangles in different order.
+ */
+class FMarchingCubesStreamBuilder
+{
+public:
+	/** 
+	 * Fill densities of Z slice, X first then Y. 
+	 * @return false to stop build 
+	 */
+	typedef TFunction<bool(int32 SliceZ, TArray<float>& OutDensities)> FSliceProducer;
+
+	/** 
+	 * Vertices created by one layer of cubes and triangles of the layer. 
+	 * Vertices continue numbering of previous layers, indices may reference vertices of previous layer
+	 */
+	typedef TFunction<void(int32 CubeLayerZ, const TArray<FVector>& NewVertices, const TArray<int32>& NewIndices)> FMeshConsumer;
+
+private:
+	const FIntVector Dimensions;
+
+	const FVector Origin;
+
+	const FVector VoxelSize;
+
+	TArray<float> Slices[2];
+
+	FMarchingCubesEdgeSlabs EdgeSlabs;
+
+	// Slices added so far
+	int32 SlicesNum = 0;
+
+	int32 VerticesNum = 0;
+
+	int32 TrianglesNum = 0;
+
+	TArray<FVector> LayerVertices;
+
+	TArray<int32> LayerIndices;
+
+	FMeshConsumer Consumer;
+
+public:
+	float SurfaceLevel = 0.5f;
+
+public:
+	FMarchingCubesStreamBuilder(const FIntVector& Dimensions, const FVector& Origin, const FVector& VoxelSize)
+		: Dimensions(Dimensions)
+		, Origin(Origin)
+		, VoxelSize(VoxelSize)
+	{}
+
+	bool IsValid() const { return Dimensions.GetMin() > 1; }
+
+	/** Start new mesh, output of every cube layer goes to consumer */
+	void Begin(const FMeshConsumer& InConsumer);
+
+	/** 
+	 * Add next Z slice of X * Y densities. Polygonizes layer of cubes below slice
+	 * @return false if slice has wrong size or all slices were already added
+	 */
+	bool AddSlice(const float* Densities, int32 DensitiesNum);
+
+	bool IsFinished() const { return SlicesNum >= Dimensions.Z; }
+
+	/** Pull all slices from producer. @return true if every slice was polygonized */
+	bool Build(const FSliceProducer& Producer, const FMeshConsumer& InConsumer);
+
+	int32 GetVerticesNum() const { return VerticesNum; }
+
+	int32 GetTrianglesNum() const { return TrianglesNum; }
+
+protected:
+	void PoligonizeLayer(int32 CubeLayerZ);
+
+	FORCEINLINE float GetDensity(const FIntVector& Point) const
+	{
+		return Slices[Point.Z & 1][Point.X + Point.Y * Dimensions.X];
+	}
+
+	FORCEINLINE FVector4 GetPoint(const FIntVector& Point) const
+	{
+		return FVector4(Origin + FVector(Point.X, Point.Y, Point.Z) * VoxelSize, GetDensity(Point));
+	}
+};
@@ -0,0 +1,98 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+
+
+/**
+ * Word parallel helpers for occupancy bits, 1 bit per point.
+ * Each X row of points starts at new 64 bit word, so rows can be combined word by word.
+ * Bit X of row (Y, Z) is bit X % 64 of word (Y + Z * DimensionY) * WordsPerRow + X / 64
+ */
+struct LIBRARY_API FOccupancyMask
+{
+	static FORCEINLINE int32 GetWordsPerRow(int32 DimensionX) { return (DimensionX + 63) / 64; }
+
+	static FORCEINLINE int32 GetWordsNum(const FIntVector& Dimensions) { return GetWordsPerRow(Dimensions.X) * Dimensions.Y * Dimensions.Z; }
+
+	static FORCEINLINE bool GetBit(const uint64* Row, int32 X) { return (Row[X / 64] >> (X % 64)) & 1; }
+
+	static FORCEINLINE void SetBit(uint64* Row, int32 X) { Row[X / 64] |= uint64(1) << (X % 64); }
+
+	/** Bits of neighbours at X+1, bit X of result is bit X+1 of row */
+	static FORCEINLINE uint64 ShiftNext(uint64 Word, uint64 NextWord) { return (Word >> 1) | (NextWord << 63); }
+
+	/** Number of set bits in words */
+	static int32 CountBits(const uint64* Words, int32 WordsNum);
+
+	/** Whether any point in [Min, Max) is set, false for empty block */
+	static bool AnySetInBlock(const uint64* Words, const FIntVector& Dimensions, const FIntVector& Min, const FIntVector& Max);
+
+	/**
+	 * Cubes of word that have both set and unset corners.
+	 * Rows are 4 rows of cube edges parallel to X: (Y,Z), (Y+1,Z), (Y,Z+1), (Y+1,Z+1)
+	 */
+	static FORCEINLINE uint64 GetMixedCubes(const uint64* const Rows[4], int32 Word, int32 WordsPerRow)
+	{
+		const bool bHasNext = Word + 1 < WordsPerRow;
+
+		// Bit X is set if any/all of 4 points at X are set
+		const uint64 Any = Rows[0][Word] | Rows[1][Word] | Rows[2][Word] | Rows[3][Word];
+		const uint64 All = Rows[0][Word] & Rows[1][Word] & Rows[2][Word] & Rows[3][Word];
+		const uint64 AnyNext = bHasNext ? (Rows[0][Word + 1] | Rows[1][Word + 1] | Rows[2][Word + 1] | Rows[3][Word + 1]) : 0;
+		const uint64 AllNext = bHasNext ? (Rows[0][Word + 1] & Rows[1][Word + 1] & Rows[2][Word + 1] & Rows[3][Word + 1]) : 0;
+
+		return (Any | ShiftNext(Any, AnyNext)) & ~(All & ShiftNext(All, AllNext));
+	}
+
+	/** 
+	 * Corners of 64 cubes of word, ordered as FMarchingCubesBuilder::CubeCorners. Bit X of OutCorners[N] is corner N of cube X
+	 * Rows are same as in GetMixedCubes
+	 */
+	static FORCEINLINE void GetCubeCorners(const uint64* const Rows[4], int32 Word, int32 WordsPerRow, uint64 OutCorners[8])
+	{
+		const bool bHasNext = Word + 1 < WordsPerRow;
+		for (int32 Row = 0; Row < 4; Row++)
+		{
+			const uint64 Current = Rows[Row][Word];
+			const uint64 Next = ShiftNext(Current, bHasNext ? Rows[Row][Word + 1] : 0);
+
+			// Rows 0 and 2 hold corners X, X+1, rows 1 and 3 hold corners X+1, X
+			const int32 FirstCorner = (Row / 2) * 4;
+			OutCorners[FirstCorner + (Row & 1) * 2 + 0] = (Row & 1) ? Next : Current;
+			OutCorners[FirstCorner + (Row & 1) * 2 + 1] = (Row & 1) ? Current : Next;
+		}
+	}
+
+	/** 
+	 * Marching cubes indices of 8 cubes from Byte * 8, byte I of result is index of cube Byte * 8 + I
+	 * Bytes of 8 corner words form 8x8 bit matrix, its transpose holds corners of every cube in one byte
+	 */
+	static FORCEINLINE uint64 GetCubeIndices8(const uint64 Corners[8], int32 Byte)
+	{
+		uint64 Matrix = 0;
+		for (int32 Corner = 0; Corner < 8; Corner++)
+		{
+			Matrix |= ((Corners[Corner] >> (Byte * 8)) & 0xFF) << (Corner * 8);
+		}
+
+		uint64 Temp;
+		Temp = (Matrix ^ (Matrix >> 7)) & 0x00AA00AA00AA00AAull;
+		Matrix = Matrix ^ Temp ^ (Temp << 7);
+		Temp = (Matrix ^ (Matrix >> 14)) & 0x0000CCCC0000CCCCull;
+		Matrix = Matrix ^ Temp ^ (Temp << 14);
+		Temp = (Matrix ^ (Matrix >> 28)) & 0x00000000F0F0F0F0ull;
+		Matrix = Matrix ^ Temp ^ (Temp << 28);
+		return Matrix;
+	}
+
+	/** Marching cubes index of single cube at X, corners are ordered as FMarchingCubesBuilder::CubeCorners */
+	static FORCEINLINE uint8 GetCubeIndex(const uint64* const Rows[4], int32 X)
+	{
+		return
+			(GetBit(Rows[0], X) << 0) | (GetBit(Rows[0], X + 1) << 1) | (GetBit(Rows[1], X + 1) << 2) | (GetBit(Rows[1], X) << 3) |
+			(GetBit(Rows[2], X) << 4) | (GetBit(Rows[2], X + 1) << 5) | (GetBit(Rows[3], X + 1) << 6) | (GetBit(Rows[3], X) << 7);
+	}
+};
@@ -0,0 +1,131 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "DensityGrid.h"
+#include "MarchingCubesBuilder.h"
+
+
+/**
+ * Surface nets extractor with same input and output as FMarchingCubesBuilder.
+ * One vertex per cube intersected by surface, placed at mean of edge crossings, and one quad per intersected edge.
+ * Produces about half of marching cubes vertices and no sliver triangles.
+ * Cubes outside of grid are replaced by vertices on border planes, so mesh reaches grid border like marching cubes mesh
+ * and cells sharing border plane get same border vertices.
+ */
+class FSurfaceNetsBuilder
+{
+private:
+	FDensityGridView Grid;
+
+	// Storage for grid converted from points
+	FDensityGrid PointsGrid;
+
+	const FIntVector Dimensions;
+
+	TArray<FVector> Vertices;
+
+	TArray<int32> Indices;
+
+	/** Vertex of every cube, INDEX_NONE if cube has no surface */
+	TArray<int32> CubeVertices;
+
+	/** Vertices on border planes, see GetBorderFaceVertex and GetBorderEdgeVertex */
+	TMap<int64, int32> BorderVertices;
+
+	TArray<FIndexEdge> BoundaryEdges;
+	TArray<FIndexEdge> InnerEdges;
+
+	bool BoundaryEdgesCalculated = false;
+
+	bool InputIsValid = true;
+
+public:
+
+	float SurfaceLevel = 0.5f;
+
+	bool FindBoundaryEdges = false;
+
+	// Split quads by shorter diagonal instead of fixed one
+	bool SplitByShorterDiagonal = true;
+
+public:
+	FSurfaceNetsBuilder(const FDensityGridView& Grid)
+		: Grid(Grid)
+		, Dimensions(Grid.Dimensions)
+	{
+		ValidateInput();
+	}
+
+	/** Points are converted to density grid. XYZ of points are expected to form regular grid, W - density */
+	FSurfaceNetsBuilder(const TArray<FVector4>& Points, const FIntVector Dimensions)
+		: Dimensions(Dimensions)
+	{
+		FDensityGrid::FromPoints(Points, Dimensions, PointsGrid);
+		Grid = PointsGrid.GetView();
+		ValidateInput();
+	}
+
+	void Build();
+
+	bool IsValid() const { return InputIsValid; }
+
+	void GetData(TArray<FVector>& OutVertices, TArray<int32>& OutIndices) const
+	{
+		OutVertices = Vertices;
+		OutIndices = Indices;
+	}
+
+	/** Move mesh out of builder without copying. Boundary and inner edges stay until taken */
+	void TakeData(TArray<FVector>& OutVertices, TArray<int32>& OutIndices)
+	{
+		OutVertices = MoveTemp(Vertices);
+		OutIndices = MoveTemp(Indices);
+		Vertices.Reset();
+		Indices.Reset();
+	}
+
+	/** @returns	true	if boundary edges were calculated. */
+	bool GetOuterVertices(TArray<int32>& OutIndices) const;
+
+	/** @returns	true	if boundary edges were calculated. */
+	bool GetBoundaryEdges(TArray<FIndexEdge>& OutEdges) const;
+
+	/** @returns	true	if inner edges were calculated. */
+	bool GetInnerEdges(TArray<FIndexEdge>& OutEdges) const;
+
+	/** Move edges out of builder, both are cleared. @returns	true	if edges were calculated. */
+	bool TakeEdges(TArray<FIndexEdge>& OutBoundaryEdges, TArray<FIndexEdge>& OutInnerEdges);
+
+	bool IsBoundaryCalculated() const { return BoundaryEdgesCalculated; }
+
+	void CalcOuterEdges();
+
+protected:
+	void ValidateInput()
+	{
+		InputIsValid = Grid.IsValid() && Dimensions.GetMin() > 1;
+		if (!InputIsValid)
+		{
+			UE_LOG(MarchingCubesBuilder, Warning, TEXT("Surface nets input is not valid grid of cubes"));
+		}
+	}
+
+	FORCEINLINE int32 GetCubeIndex(int32 X, int32 Y, int32 Z) const
+	{
+		return X + (Dimensions.X - 1) * Y + (Dimensions.X - 1) * (Dimensions.Y - 1) * Z;
+	}
+
+	/** Place vertex of cube if it is intersected by surface */
+	void PlaceCubeVertex(const FIntVector& CubeCoords);
+
+	/** Quad of four cubes around intersected edge starting at point. Cubes outside of grid are replaced by border vertices */
+	void AddEdgeQuad(const FIntVector& PointCoords, int32 Axis);
+
+	/** Mean of crossings of grid square on border plane, square starts at point and is perpendicular to NormalAxis */
+	int32 GetBorderFaceVertex(const FIntVector& PointCoords, int32 NormalAxis);
+
+	/** Crossing of edge on border line of grid */
+	int32 GetBorderEdgeVertex(const FIntVector& PointCoords, int32 Axis);
+};
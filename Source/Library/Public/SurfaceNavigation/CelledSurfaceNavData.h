@@ -3,7 +3,7 @@
 #pragma once
 
 #include "CoreMinimal.h"
-#include "StaticIndexArray.h"
+#include "SurfaceNavCell.h"
 
 
 
@@ -19,6 +19,9 @@ struct FCellCreationData
 
 	TArray<int32> OuterVertices;
 
+	// Box of outer sample points, faces shared with neighbouring cells lie on its sides. Cell box is used if invalid
+	FBox GridBox = FBox(ForceInit);
+
 	FCellCreationData() {}
 
 	FCellCreationData(const TArray<FVector>& CellVertices, const TArray<int32>& CellTriangles, const TArray<int32>& OuterVertices)
@@ -26,114 +29,36 @@ struct FCellCreationData
 		, CellTriangles(CellTriangles)
 		, OuterVertices(OuterVertices)
 	{}
+
+	FCellCreationData(TArray<FVector>&& CellVertices, TArray<int32>&& CellTriangles, TArray<int32>&& OuterVertices)
+		: CellVertices(MoveTemp(CellVertices))
+		, CellTriangles(MoveTemp(CellTriangles))
+		, OuterVertices(MoveTemp(OuterVertices))
+	{}
 };
 
 
 
 
+DECLARE_DELEGATE_OneParam(FCellPublishedDelegate, const FIntVector&);
+
+
 /**
- * 
+ * Cells are built into immutable FSurfaceNavCell, either on calling thread or in background, and published on game thread
+ * by swapping snapshot pointer. Cells published during a frame are batched into one new snapshot at the end of the frame.
+ * Readers on any thread work on snapshot from GetSnapshot and never see partially updated cells.
+ * Built cells are the only copy of graph, pathfinding and debug drawing read them from snapshot
  */
 class LIBRARY_API FCelledSurfaceNavData
 {
-	// Graph
-	typedef int32 GraphNodeRef;
-	typedef int32 VerticeRef;
-
-	struct FGraphNode
-	{
-		VerticeRef Triangle[3] = { -1, -1, -1 };
-
-		TArray<GraphNodeRef> Neighbours;
-
-		FGraphNode() {}
-
-		FGraphNode(VerticeRef V1, VerticeRef V2, VerticeRef V3)
-		{
-			Triangle[0] = V1;
-			Triangle[1] = V2;
-			Triangle[2] = V3;
-		}
-
-		void Invalidate()
-		{
-			Triangle[0] = -1;
-			Triangle[1] = -1;
-			Triangle[2] = -1;
-		}
-
-		bool IsValid() const
-		{
-			return Triangle[0] >= 0 && Triangle[1] >= 0 && Triangle[2] >= 0;
-		}
-		
-		bool IsCollapsed() const
-		{
-			return Triangle[0] == Triangle[1] && Triangle[1] == Triangle[2];
-		}
-
-		bool HasVertice(VerticeRef OtherVertice) const
-		{
-			if (OtherVertice < 0) return false;
-			return OtherVertice == Triangle[0] || OtherVertice == Triangle[1] || OtherVertice == Triangle[2];
-		}
-
-		bool IsConnectedTo(const FGraphNode& Other)
-		{
-			int SharedVerticesNum = 0;
-			SharedVerticesNum += Other.HasVertice(Triangle[0]);
-			SharedVerticesNum += Other.HasVertice(Triangle[1]);
-			SharedVerticesNum += Other.HasVertice(Triangle[2]);
-			return SharedVerticesNum >= 2;
-		}
-	};
-
-
-	struct FGraphValidator
-	{
-		static bool IsValid(const FGraphNode& Element)
-		{
-			return Element.IsValid();
-		}
-		static void Invalidate(FGraphNode& Element)
-		{
-			Element = FGraphNode();
-		}
-
-
-		static bool IsValid(const FVector& Vector)
-		{
-			return FMath::Abs(Vector.X) < MAX_FLT && FMath::Abs(Vector.Y) < MAX_FLT && FMath::Abs(Vector.Z) < MAX_FLT;
-		}
-		static void Invalidate(FVector& Element)
-		{
-			Element = FVector(MAX_FLT);
-		}
-	};
-
-
-	struct FCellData
-	{
-		TArray<VerticeRef> VerticesInside;
-
-		TArray<GraphNodeRef> NodesInside;
-
-		TArray<GraphNodeRef> BoundaryNodes;
-
-		FCellData()
-		{
-		}
-
-		bool IsEmpty() const { return VerticesInside.Num() <= 0; }
-	};
-
-
-
 public:
 	FVector Center;
 
 	float CellSize = 100;
 
+	// Add graph nodes of cell in Morton order of triangle centers, so nodes close in space are close in memory
+	bool SortNodesSpatially = true;
+
 public:
 	FCelledSurfaceNavData()
 		: Center(FVector(0))
@@ -142,59 +67,83 @@ public:
 	FCelledSurfaceNavData(FVector Center)
 	: Center(Center)
 	{}
-	~FCelledSurfaceNavData(){}
+	~FCelledSurfaceNavData();
 
-	// Vertice data
+	/** Called on game thread after cell is published, snapshot is updated on next FlushSnapshot */
+	FCellPublishedDelegate OnCellPublished;
+
+	// Published cells
 private:
-	TStaticIndexArray<FVector, FGraphValidator> Vertices;
+	TSharedPtr<const FSurfaceNavSnapshot, ESPMode::ThreadSafe> Snapshot;
 
-	TStaticIndexArray<FGraphNode, FGraphValidator> Nodes;
+	// Guards only copy and swap of Snapshot pointer
+	mutable FCriticalSection SnapshotLock;
 
-protected:
-	FVector GetNodeCenter(GraphNodeRef NodeRef) const;
+	// Background builds of older version or epoch are dropped when finished
+	TMap<FIntVector, int32> CellBuildVersions;
 
-	FVector GetNodeVertex(GraphNodeRef NodeRef, int8 VertexIndexFrom0to2) const;
+	int32 BuildEpoch = 0;
 
-	GraphNodeRef GetNodeCloseToLocation(const FVector& WorldLocation) const;
+	/** Pinned by finished background builds, reset when nav data is destroyed */
+	struct FAsyncBuildToken
+	{
+		FCelledSurfaceNavData* Owner;
+	};
+	TSharedPtr<FAsyncBuildToken, ESPMode::ThreadSafe> AsyncToken;
 
-	// Cell data
-private:
-	TMap<FIntVector, FCellData> Cells;
+	void FinishAsyncBuild(const FIntVector& CellCoordinate, int32 Version, int32 Epoch, const TSharedRef<const FSurfaceNavCell, ESPMode::ThreadSafe>& Cell);
 
-protected:
-	bool HasCellData(const FIntVector& CellCoordinate) const;
-	bool IsCellEmpty(const FIntVector& CellCoordinate) const;
+	// Cells waiting for next snapshot, null removes cell
+	TMap<FIntVector, TSharedPtr<const FSurfaceNavCell, ESPMode::ThreadSafe>> PendingSnapshotCells;
+
+	// Ticker flushing pending cells at end of frame, registered while any cell is pending
+	FDelegateHandle FlushTickerHandle;
+
+	/** Replace cell in next snapshot, removes cell if null. Game thread only */
+	void QueueSnapshotCell(const FIntVector& CellCoordinate, const TSharedPtr<const FSurfaceNavCell, ESPMode::ThreadSafe>& Cell);
 
-	/** Find or add cell and return reference */
-	FCellData& GetOrAddCellData(const FIntVector& CellCoordinate);
+public:
+	/** Current snapshot, safe to call from any thread. Keep returned pointer for as long as consistent view is needed */
+	TSharedPtr<const FSurfaceNavSnapshot, ESPMode::ThreadSafe> GetSnapshot() const;
+
+	/** 
+	 * Publish all cells updated or cleared since last flush in one new snapshot. Game thread only
+	 * Called once per frame, call it directly to see result of UpdateCell or ClearCell in GetSnapshot right away
+	 */
+	void FlushSnapshot();
 
+	// Vertice data
+private:
+	bool UseCompactVertices = false;
 
-	/** Find cell data without adding.
-	 *  @return		true	if has cell.
+public:
+	/** 
+	 * Store vertices of cells built from now on as 16 bit fixed point relative to their cell, decoded on access. Precision is 1.5 * CellSize / 65535
+	 * Cells built before keep their vertices until they are rebuilt
 	 */
-	bool GetCellData(const FIntVector& CellCoordinate, FCellData& OutCellData) const;
+	void SetUseCompactVertices(bool NewUseCompactVertices);
 
-	
+	bool IsUsingCompactVertices() const { return UseCompactVertices; }
 
 public:
 
 	void UpdateCell(const FIntVector& CellCoordinate, const FCellCreationData& Data);	
 
+	/** Vertices of data are moved into cell instead of copied */
+	void UpdateCell(const FIntVector& CellCoordinate, FCellCreationData&& Data);
+
+	/** Build cell graph on worker thread and publish it on game thread. Newer update or clear of cell drops result */
+	void UpdateCellAsync(const FIntVector& CellCoordinate, FCellCreationData&& Data);
+
 	void ClearCell(const FIntVector& CellCoordinate);
 	void ClearAllCells();
 
-	// Graph building/stitching
 protected:
-	static FIntVector CellNeighbourOffsets[6];
-	
-	void AttachToNeighbouringCells(const FIntVector& CellCoordinate);
-
-	void DetachFromNeighbouringCells(const FIntVector& CellCoordinate);
+	/** Put built cell in next snapshot */
+	void PublishCell(const TSharedRef<const FSurfaceNavCell, ESPMode::ThreadSafe>& Cell);
 
-	//#todo
-	void StitchCells(FCellData& A, FCellData& B);
-	void RipCells(FCellData& A, FCellData& B);
-	void BuildGraphInCell(FCellData& Cell);
+	/** Latest version of cell on game thread, from cells pending for next snapshot or from current snapshot. Null if there is no cell */
+	TSharedPtr<const FSurfaceNavCell, ESPMode::ThreadSafe> FindLatestCell(const FIntVector& CellCoordinate) const;
 
 public:
 	// Utility
@@ -0,0 +1,79 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "DensitySource.generated.h"
+
+
+/**
+ * Backend that evaluates densities at arbitrary positions without world queries.
+ * Densities are in [0, 1], surface is at 0.5, inside is above it
+ */
+struct LIBRARY_API FDensitySource
+{
+	virtual ~FDensitySource() {}
+
+	/** Evaluate densities of Num positions */
+	virtual void SampleBatch(const FVector* Positions, int32 Num, float* OutDensities) const = 0;
+};
+
+
+UENUM(BlueprintType)
+enum class EAnalyticShapeType : uint8
+{
+	Box,
+	Sphere,
+	Capsule,
+	/** Half space below local XY plane */
+	Plane
+};
+
+
+USTRUCT(BlueprintType)
+struct FAnalyticShape
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere)
+	EAnalyticShapeType Type = EAnalyticShapeType::Box;
+
+	/** Scale is applied to shape. Non uniform scale gives distances of smallest axis, surface is exact but falloff is narrower */
+	UPROPERTY(EditAnywhere)
+	FTransform Transform;
+
+	/** Box: half size, Sphere: X is radius, Capsule: X is radius and Z is half height of segment, Plane: unused */
+	UPROPERTY(EditAnywhere)
+	FVector Extent = FVector(50.f);
+
+	/** Remove shape from shapes before it instead of adding to them */
+	UPROPERTY(EditAnywhere)
+	bool Subtract = false;
+};
+
+
+/**
+ * Signed distance field of primitives combined in order with union or subtraction.
+ * Distance is mapped to density with linear falloff, so densities interpolate smoothly around surface
+ */
+class LIBRARY_API FAnalyticDensitySource : public FDensitySource
+{
+public:
+	TArray<FAnalyticShape> Shapes;
+
+	// Distance at which density reaches 0 or 1, usually voxel size
+	float Falloff = 25.f;
+
+	static constexpr int32 BatchSize = 64;
+
+public:
+	virtual void SampleBatch(const FVector* Positions, int32 Num, float* OutDensities) const override;
+
+	/** Signed distance of Num positions, negative inside */
+	void SampleDistances(const FVector* Positions, int32 Num, float* OutDistances) const;
+
+private:
+	/** Shape distances for at most BatchSize positions in local space of shape, stored as separate components */
+	static void ShapeDistances(const FAnalyticShape& Shape, const float* X, const float* Y, const float* Z, int32 Num, float* OutDistances);
+};
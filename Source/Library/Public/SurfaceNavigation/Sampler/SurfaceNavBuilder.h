@@ -38,8 +38,14 @@ public:
 public:
 	FSurfaceNavBuilder() : SurfaceValue(.5f) {}
 
+	bool BuildGraph(const FDensityGridView& Grid, FSurfaceNavLocalData& SaveTarget);
+
+	bool BuildGraph(const FDensityGridView& Grid, TArray<FEdgeData>& OutGraph);
+
+	/** Points are converted to density grid. XYZ of points are expected to form regular grid, W - density */
 	bool BuildGraph(const TArray<FVector4>& Points, const FIntVector& Dimensions, FSurfaceNavLocalData& SaveTarget);
 
+	/** Points are converted to density grid. XYZ of points are expected to form regular grid, W - density */
 	bool BuildGraph(const TArray<FVector4>& Points, const FIntVector& Dimensions, TArray<FEdgeData>& OutGraph);
 
 
@@ -47,7 +53,7 @@ protected:
 
 	void CleanUp();
 
-	bool BuildGraph_Internal(const TArray<FVector4>& Points, const FIntVector& Dimensions, float SurfaceValue, TArray<FEdgeData>& OutEdges);
+	bool BuildGraph_Internal(const FDensityGridView& Grid, float SurfaceValue, TArray<FEdgeData>& OutEdges);
 
 
 	struct FCell
@@ -4,7 +4,12 @@
 
 #include "CoreMinimal.h"
 #include "SurfaceNavigation.h"
+#include "DensityGrid.h"
+#include "DensitySource.h"
 #include "UObject/NoExportTypes.h"
+#include "Tickable.h"
+#include "CollisionQueryParams.h"
+#include "Async/Future.h"
 
 #include "SurfaceSampler.generated.h"
 
@@ -14,19 +19,74 @@ class USurfaceSamplerBase;
 struct FSamplingTask;
 struct FSamplerResult;
 
-DECLARE_DELEGATE_OneParam(FSampleFinishedDelegate, FSamplerResult);
-
-DECLARE_DELEGATE_OneParam(FSamplingTaskStateChangedSignature, FSamplingTask*);
+DECLARE_DELEGATE_OneParam(FSampleFinishedDelegate, const FSamplerResult&);
 
 struct FSamplerResult
 {
-	TArray<FVector4> Points;
+	/** Sampled densities, 1 byte per point for overlap sampling, floats for density source, 1 bit per point for occupancy only */
+	FDensityGrid Grid;
 
 	FIntVector Dimensions;
 
 	FBox Box;
 
+	/** Overlap queries issued */
+	int32 TestsDone = 0;
+
+	/** Queries needed for one query per point */
+	int32 WorstCaseTestsDone = 0;
+
 	FSamplerResult(){}
+
+	/** Clear data but keep allocated buffers */
+	void Reset()
+	{
+		Grid.Densities.Reset();
+		Grid.ByteDensities.Reset();
+		Grid.OccupancyWords.Reset();
+		Grid.Dimensions = FIntVector::ZeroValue;
+		Dimensions = FIntVector::ZeroValue;
+		Box = FBox(ForceInit);
+		TestsDone = 0;
+		WorstCaseTestsDone = 0;
+	}
+
+	SIZE_T GetAllocatedSize() const { return Grid.Densities.GetAllocatedSize() + Grid.ByteDensities.GetAllocatedSize() + Grid.OccupancyWords.GetAllocatedSize(); }
+};
+
+
+/** Sampled results are reusable for same box, voxel size and output format */
+struct FSampleCacheKey
+{
+	FBox Box;
+
+	float VoxelSize;
+
+	bool bOccupancyOnly;
+
+	bool operator==(const FSampleCacheKey& Other) const 
+	{ 
+		return Box == Other.Box && VoxelSize == Other.VoxelSize && bOccupancyOnly == Other.bOccupancyOnly; 
+	}
+
+	friend uint32 GetTypeHash(const FSampleCacheKey& Key)
+	{
+		return HashCombine(HashCombine(GetTypeHash(Key.Box.Min), GetTypeHash(Key.Box.Max)), HashCombine(GetTypeHash(Key.VoxelSize), Key.bOccupancyOnly ? 1 : 0));
+	}
+};
+
+
+/** Addresses task slot of sampler. Handle becomes stale when task is finished and slot is reused */
+struct FSamplingTaskHandle
+{
+	int32 Index = INDEX_NONE;
+
+	uint32 Generation = 0;
+
+	bool IsValid() const { return Index != INDEX_NONE; }
+
+	bool operator==(const FSamplingTaskHandle& Other) const { return Index == Other.Index && Generation == Other.Generation; }
+	bool operator!=(const FSamplingTaskHandle& Other) const { return !(*this == Other); }
 };
 
 
@@ -37,11 +97,22 @@ struct SamplingTaskParameters
 	bool bDrawDebug;
 
 	bool bSaveInWorldSpace;
+
+	/** Test large boxes first and split only those that overlap, instead of one query per point */
+	bool bHierarchical;
+
+	/** Store only whether point is inside, 1 bit per point */
+	bool bOccupancyOnly;
+
+	/** Evaluate densities with source instead of world overlaps */
+	TSharedPtr<const FDensitySource, ESPMode::ThreadSafe> Source;
 	
 	SamplingTaskParameters() 
 		: VoxelSize(25)
 		, bDrawDebug(false)
 		, bSaveInWorldSpace(true)
+		, bHierarchical(true)
+		, bOccupancyOnly(false)
 	{}	
 };
 
@@ -51,18 +122,32 @@ struct FSamplingTask
 private:
 	FSamplerResult Result;
 
+	/** Result shared with sample cache, used instead of Result if set */
+	TSharedPtr<const FSamplerResult, ESPMode::ThreadSafe> SharedResult;
+
 protected:
 	const UWorld* World;
 
-	const SamplingTaskParameters Parameters;
+	SamplingTaskParameters Parameters;
 
-	const FBox SampleBox;
+	FBox SampleBox;
 
 public:
+	/** Lower is sampled and delivered first */
+	float Priority;
+
+	/** Hash of collision in box at start time, result is cached on delivery if set */
+	TOptional<uint32> CollisionHash;
+
+	/** Cache is looked up once, right before task is started */
+	bool bCacheChecked;
+
 	FSamplingTask(const UWorld* World, const FBox& SampleBox, const SamplingTaskParameters Params = SamplingTaskParameters())
 		: World(World)
 		, Parameters(Params)
 		, SampleBox(SampleBox)
+		, Priority(0)
+		, bCacheChecked(false)
 		, State(TaskState::Waiting)
 		
 	{ }
@@ -70,20 +155,24 @@ public:
 		OnFinish.Unbind();
 	}
 
-	void Sample()
-	{
-		SetState(TaskState::InProgress);
-		Result = FSamplerResult();
-		SampleData(Result);
+	/** Prepare finished task for reuse, result buffers are kept */
+	void Reset(const UWorld* InWorld, const FBox& InSampleBox, const SamplingTaskParameters& Params);
 
-		Finish(); //
-	}
+	/** Sample on calling thread, result is kept until Deliver */
+	void Sample();
 
-	/** Sneak peek at result without freeing the task */
-	const FSamplerResult& GetResult() const { return Result; }
+	/** Pass result to delegate and free data. Game thread only */
+	void Deliver();
+
+	/** Drop task, active task stops at next batch. Result will not be delivered */
+	void Cancel();
 
-	/** Grab data and free the task */
+	bool IsCancelled() const { return bCancelled; }
+
+	/** Sneak peek at result without freeing the task */
+	const FSamplerResult& GetResult() const { return SharedResult.IsValid() ? *SharedResult : Result; }
 
+	const FBox& GetSampleBox() const { return SampleBox; }
 
 	bool IsWaiting() const { return State == TaskState::Waiting; }
 
@@ -97,23 +186,47 @@ protected:
 
 	virtual void SampleData(FSamplerResult& OutResult);
 
-	void Finish()
-	{
-		SetState(TaskState::DataReady);
-		OnFinish.ExecuteIfBound(Result);
-		SetState(TaskState::DataExtracted);
-	}
+	struct FHierarchicalSampling;
+
+	/** Fill float densities from Parameters.Source, row by row */
+	void SampleSource(FSamplerResult& OutResult);
+
+	/** Sample task that is already InProgress, may run on any thread */
+	void ExecuteSampling();
+
+	/** Z slices per parallel batch */
+	static int32 GetBatchSlices(int32 SlicesNum);
+
+public:
+	/** Object types tested by overlap sampling */
+	static FCollisionObjectQueryParams GetObjectQueryParameters();
 
 
 	//~ Start State
 public:
 	enum TaskState { Waiting, InProgress, DataReady, DataExtracted };
 private:
-	TaskState State;
+	// Written by worker thread when task is sampled asynchronously
+	TAtomic<TaskState> State;
+
+	FThreadSafeBool bCancelled;
 
-	FSamplingTaskStateChangedSignature OnStateChanged;
+	TFuture<void> Future;
 
-	void SetState(TaskState NewState) { State = NewState; OnStateChanged.ExecuteIfBound(this); }
+	/** Take result without sampling, task becomes ready for delivery */
+	void SetCachedResult(const TSharedRef<const FSamplerResult, ESPMode::ThreadSafe>& CachedResult) { SharedResult = CachedResult; SetState(TaskState::DataReady); }
+
+	/** Move result to shared storage, so cache keeps it without copy. Slot allocates new buffers for next task */
+	TSharedRef<const FSamplerResult, ESPMode::ThreadSafe> ShareResult()
+	{
+		if (!SharedResult.IsValid())
+		{
+			SharedResult = MakeShared<FSamplerResult, ESPMode::ThreadSafe>(MoveTemp(Result));
+		}
+		return SharedResult.ToSharedRef();
+	}
+
+	void SetState(TaskState NewState) { State = NewState; }
 	TaskState GetState() const { return State; }
 	//~ End State
 
@@ -145,12 +258,49 @@ private:
  * 
  */
 UCLASS(collapseCategories, autoExpandCategories=("Dimensions"))
-class LIBRARY_API USurfaceSamplerBase : public UObject
+class LIBRARY_API USurfaceSamplerBase : public UObject, public FTickableGameObject
 {
 	GENERATED_BODY()
 
 protected:
-	TArray<FSamplingTask> Tasks;
+	struct FTaskSlot
+	{
+		// Tasks are not moved when slots grow, workers hold raw pointers
+		TUniquePtr<FSamplingTask> Task;
+
+		uint32 Generation = 0;
+
+		bool InUse = false;
+	};
+
+	/** Slab of tasks, finished slots are reused with their result buffers */
+	TArray<FTaskSlot> TaskSlots;
+
+	TArray<int32> FreeSlots;
+
+	int32 UsedSlotsNum = 0;
+
+	// Order of scheduling, used as priority when there is no focus location
+	int32 ScheduledNum = 0;
+
+	struct FSampleCacheEntry
+	{
+		uint32 CollisionHash = 0;
+
+		uint64 LastUsed = 0;
+
+		// Shared with tasks that deliver it
+		TSharedPtr<const FSamplerResult, ESPMode::ThreadSafe> Result;
+	};
+
+	TMap<FSampleCacheKey, FSampleCacheEntry> SampleCache;
+
+	SIZE_T SampleCacheSize = 0;
+
+	uint64 CacheUseCounter = 0;
+
+	// Owner calls ProcessTasks with its own budget instead of sampler tick
+	bool bTickedExternally = false;
 
 
 public:
@@ -160,76 +310,191 @@ public:
 	UPROPERTY(EditAnywhere)
 		float VoxelSize = 25;
 
+	/** Skip empty regions with single query instead of testing every point */
+	UPROPERTY(EditAnywhere)
+		bool bHierarchical = true;
+
+	/** Output 1 bit per point instead of densities. Surface is placed midway between points */
+	UPROPERTY(EditAnywhere)
+		bool bOccupancyOnly = false;
+
+	/** Reuse results of boxes whose overlapping collision has not changed */
+	UPROPERTY(EditAnywhere, Category = "Cache")
+		bool bUseCache = true;
+
+	/** Least recently used results are dropped when cache grows over budget */
+	UPROPERTY(EditAnywhere, Category = "Cache", meta = (EditCondition = "bUseCache", ClampMin = "0"))
+		float CacheBudgetMB = 64.f;
+
+	/** Sample on worker threads and deliver results on tick, otherwise tasks are sampled and delivered on schedule */
+	UPROPERTY(EditAnywhere, Category = "Scheduler")
+		bool bAsync = true;
+
+	/** Tasks sampled at the same time, each task also splits its box in parallel batches */
+	UPROPERTY(EditAnywhere, Category = "Scheduler", meta = (EditCondition = "bAsync", ClampMin = "1"))
+		int32 MaxActiveTasks = 2;
+
+	/** Time per tick for result delivery, at least one result is delivered each tick */
+	UPROPERTY(EditAnywhere, Category = "Scheduler", meta = (EditCondition = "bAsync", ClampMin = "0"))
+		float DeliveryBudgetMs = 2.f;
+
 public:
 	USurfaceSamplerBase() {	}
 
 	virtual ~USurfaceSamplerBase() {}
 
+	virtual void BeginDestroy() override;
+
 	
 	/**
 	 * Schedule task
-	 * Result should be consumed on delegate call. ID will be invalid with next task scheduled
+	 * Result should be consumed on delegate call. Task for the same box scheduled earlier is cancelled
 	 */
 	template<class UserClass>
-	void ScheduleSampleTask(const FBox& SampleBox, UserClass* Object, typename FSampleFinishedDelegate::TUObjectMethodDelegate<UserClass>::FMethodPtr Func)
+	FSamplingTaskHandle ScheduleSampleTask(const FBox& SampleBox, UserClass* Object, typename FSampleFinishedDelegate::TUObjectMethodDelegate<UserClass>::FMethodPtr Func)
 	{
-		FSamplingTask& Task = SetupTask(SampleBox);
+		const FSamplingTaskHandle Handle = SetupTask(SampleBox);
+		FSamplingTask& Task = *TaskSlots[Handle.Index].Task;
 		Task.BindDelegate(Object, Func);
 		ScheduleTask(Task);
+		return Handle;
 	}
 
 	/** 
 	 * Schedule task with payload
-	 * Result should be consumed on delegate call. ID will be invalid with next task scheduled
+	 * Result should be consumed on delegate call. Task for the same box scheduled earlier is cancelled
 	 * Template FunctionDelegate - delegate with target method signature
 	 */
 	template<class FunctionDelegate, class UserClass, typename... VarTypes>
-	void ScheduleSampleTask(const FBox& SampleBox, UserClass* Object, typename FunctionDelegate::template TUObjectMethodDelegate<UserClass>::FMethodPtr Func, VarTypes... Vars)
+	FSamplingTaskHandle ScheduleSampleTask(const FBox& SampleBox, UserClass* Object, typename FunctionDelegate::template TUObjectMethodDelegate<UserClass>::FMethodPtr Func, VarTypes... Vars)
 	{
-		FSamplingTask& Task = SetupTask(SampleBox);
+		const FSamplingTaskHandle Handle = SetupTask(SampleBox);
+		FSamplingTask& Task = *TaskSlots[Handle.Index].Task;
 		Task.BindDelegate<FunctionDelegate>(Object, Func, Vars...);
 		ScheduleTask(Task);
+		return Handle;
 	}
 
-protected:
-	inline const FSamplingTask& GetTask(int32 TaskID) const { return Tasks[TaskID]; }
-	inline FSamplingTask& GetTask(int32 TaskID) { return Tasks[TaskID]; }
+	/** Task of handle, null if handle is stale */
+	const FSamplingTask* FindTask(const FSamplingTaskHandle& Handle) const;
 
-	virtual void ScheduleTask(FSamplingTask& Task)
-	{		
-		Task.Sample();
-		UE_LOG(SurfaceNavigation, Warning, TEXT("Scheduled new task. Task queue size: %d"), Tasks.Num());
+	/** Cancel task of handle, does nothing if handle is stale */
+	void CancelTask(const FSamplingTaskHandle& Handle);
 
-		ClearFinishedTasks();		
-	}
+	/** Cancel unfinished tasks of box */
+	void CancelTasks(const FBox& SampleBox);
 
-	virtual FSamplingTask& SetupTask(const FBox& SampleBox)
-	{
-		SamplingTaskParameters Params = SamplingTaskParameters();
-		Params.bDrawDebug = bDrawDebug;
-		Params.VoxelSize = VoxelSize;				
-		
-		FSamplingTask& Task = Tasks.Add_GetRef(FSamplingTask(GetWorld(), SampleBox, Params));
-		Task.OnStateChanged.BindUObject(this, &USurfaceSamplerBase::TaskStateChanged);
-		return Task;
-	}
+	/** Cancel all tasks and wait for active ones to stop */
+	void CancelAllTasks();
 
-	void TaskStateChanged(FSamplingTask* Task)
-	{
-		if (Task == nullptr) return;	
+	int32 GetPendingTasksNum() const { return UsedSlotsNum; }
+
+	void ClearCache();
+
+	/** Start waiting tasks and deliver ready results until EndTime in FPlatformTime::Seconds. Tasks scheduled asynchronously are started here */
+	void ProcessTasks(double EndTime);
+
+	/** Stop ticking on its own, owner is responsible for calling ProcessTasks */
+	void SetTickedExternally(bool bExternal) { bTickedExternally = bExternal; }
+
+	SIZE_T GetCacheSize() const { return SampleCacheSize; }
+
+	/** Free result buffers kept by unused slots */
+	void TrimPool();
+
+	/** Memory held by result buffers of all slots */
+	SIZE_T GetPooledMemory() const;
+
+	//~ Begin FTickableGameObject Interface
+	virtual void Tick(float DeltaTime) override;
+	virtual bool IsTickable() const override;
+	virtual bool IsTickableInEditor() const override { return true; }
+	virtual TStatId GetStatId() const override { RETURN_QUICK_DECLARE_CYCLE_STAT(USurfaceSamplerBase, STATGROUP_Tickables); }
+	//~ End FTickableGameObject Interface
+
+protected:
+	inline const FSamplingTask& GetTask(int32 TaskID) const { return *TaskSlots[TaskID].Task; }
+	inline FSamplingTask& GetTask(int32 TaskID) { return *TaskSlots[TaskID].Task; }
+
+	virtual void ScheduleTask(FSamplingTask& Task);
+
+	/** Take free slot or add new one, task in slot is ready for binding */
+	virtual FSamplingTaskHandle SetupTask(const FBox& SampleBox);
 
-		if (Task->IsDataExtracted())
+	/** Next task in used slots with lowest priority that passes Predicate */
+	template<typename PredicateType>
+	FSamplingTask* FindNextTask(PredicateType Predicate) const
+	{
+		FSamplingTask* Next = nullptr;
+		for (const FTaskSlot& Slot : TaskSlots)
 		{
-			int32 Num = Tasks.RemoveAll([Task](const FSamplingTask& Entry) { return &Entry == Task; });
+			if (Slot.InUse && Predicate(*Slot.Task) && (Next == nullptr || Slot.Task->Priority < Next->Priority))
+			{
+				Next = Slot.Task.Get();
+			}
 		}
+		return Next;
 	}
-	void ClearFinishedTasks()
-	{
-		Tasks.RemoveAllSwap([](const FSamplingTask& Task) { return Task.IsDataExtracted(); });
-	}
+
+	/** Source used by new tasks, world overlaps are used if null */
+	virtual TSharedPtr<const FDensitySource, ESPMode::ThreadSafe> GetDensitySource() const { return nullptr; }
+
+	/** Location tasks are sorted by distance to, player camera by default */
+	virtual bool GetFocusLocation(FVector& OutLocation) const;
+
+	/** 
+	 * Start waiting tasks with lowest priority until MaxActiveTasks are active.
+	 * Cache lookups run on game thread until EndTime, at least one per call
+	 */
+	void StartTasks(double EndTime);
+
+	/** Deliver ready tasks in priority order until EndTime, at least one is delivered */
+	void DeliverResults(double EndTime);
+
+	/** Cache result of task if it was sampled from world, then pass it to delegate */
+	void DeliverTask(FSamplingTask& Task);
+
+	/** 
+	 * Hash collision of task box and take cached result if collision has not changed.
+	 * @return true if task got cached result and is ready for delivery
+	 */
+	bool LookUpCache(FSamplingTask& Task);
+
+	/** 
+	 * Hash of collision primitives overlapping box, their ids, transforms and bounds.
+	 * @return false if results of box can not be cached
+	 */
+	virtual bool GetCollisionHash(const FBox& SampleBox, uint32& OutHash) const;
+
+	FSampleCacheKey MakeCacheKey(const FBox& SampleBox) const;
+
+	void AddToCache(const FSampleCacheKey& Key, uint32 CollisionHash, const TSharedRef<const FSamplerResult, ESPMode::ThreadSafe>& Result);
+
+	/** Return slots of extracted tasks that are not referenced by workers */
+	void ClearFinishedTasks();
 
 
 };
 
 
 
+
+
+
+/**
+ * Samples analytic signed distance field instead of world collision.
+ * Needs no loaded world and gives continuous densities
+ */
+UCLASS()
+class LIBRARY_API UAnalyticSurfaceSampler : public USurfaceSamplerBase
+{
+	GENERATED_BODY()
+
+public:
+	/** Shapes are combined in order */
+	UPROPERTY(EditAnywhere)
+	TArray<FAnalyticShape> Shapes;
+
+protected:
+	virtual TSharedPtr<const FDensitySource, ESPMode::ThreadSafe> GetDensitySource() const override;
+};
@@ -0,0 +1,175 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "QuantizedVector.h"
+
+struct FCellCreationData;
+
+
+
+/** Edge with both vertices on face of cell box. Vertices are quantized, so cells sharing the face produce equal keys for same edge */
+struct LIBRARY_API FSurfaceNavEdgeKey
+{
+	FIntVector A = FIntVector::ZeroValue;
+
+	FIntVector B = FIntVector::ZeroValue;
+
+	FSurfaceNavEdgeKey() {}
+
+	FSurfaceNavEdgeKey(const FIntVector& V1, const FIntVector& V2)
+	{
+		// Order of vertices differs between triangles of neighbouring cells
+		const bool Swap = V1.X != V2.X ? V1.X > V2.X : (V1.Y != V2.Y ? V1.Y > V2.Y : V1.Z > V2.Z);
+		A = Swap ? V2 : V1;
+		B = Swap ? V1 : V2;
+	}
+
+	bool operator==(const FSurfaceNavEdgeKey& Other) const
+	{
+		return A == Other.A && B == Other.B;
+	}
+
+	friend uint32 GetTypeHash(const FSurfaceNavEdgeKey& Key)
+	{
+		return HashCombine(GetTypeHash(Key.A), GetTypeHash(Key.B));
+	}
+};
+
+
+
+/**
+ * Graph of one nav cell. Immutable once built, so it can be built on any thread and shared by snapshots.
+ * Node is triangle of cell vertices, neighbours are nodes sharing an edge
+ */
+struct LIBRARY_API FSurfaceNavCell
+{
+	FIntVector Coordinate;
+
+	// Empty if cell is compact, use GetVertex
+	TArray<FVector> Vertices;
+
+	// Vertices as 16 bit fixed point inside of Quantizer box, used instead of Vertices if cell is compact. 6 bytes per vertex instead of 12
+	TArray<FQuantizedVector> CompactVertices;
+
+	FVectorQuantizer Quantizer;
+
+	// 3 vertices per node
+	TArray<int32> Triangles;
+
+	// Neighbours of node N are Neighbours[NeighbourOffsets[N]] up to Neighbours[NeighbourOffsets[N + 1]]
+	TArray<int32> NeighbourOffsets;
+
+	TArray<int32> Neighbours;
+
+	// Nodes touching outer vertices of cell
+	TArray<int32> BoundaryNodes;
+
+	struct FFaceEdge
+	{
+		FSurfaceNavEdgeKey Key;
+
+		int32 Node;
+
+		// Index to FaceOffsets
+		int32 Face;
+	};
+
+	// Edges of boundary nodes lying on faces of cell box, sorted by node
+	TArray<FFaceEdge> FaceEdges;
+
+	// Nodes owning each of FaceEdges, used to find nodes of this cell from neighbouring cell. Quantized keys of close edges can collide
+	TMultiMap<FSurfaceNavEdgeKey, int32> FaceEdgeNodes;
+
+	// Quantization step of face edge keys is size of cell divided by this
+	static const int32 EdgeKeyResolution = 1024;
+
+	/** Offsets to neighbouring cells, opposite face of Face is Face ^ 1 */
+	static const FIntVector FaceOffsets[6];
+
+public:
+	int32 GetNodesNum() const { return Triangles.Num() / 3; }
+
+	int32 GetVerticesNum() const { return IsCompact() ? CompactVertices.Num() : Vertices.Num(); }
+
+	bool IsCompact() const { return CompactVertices.Num() > 0; }
+
+	FORCEINLINE FVector GetVertex(int32 Vertex) const
+	{
+		return IsCompact() ? Quantizer.Decode(CompactVertices[Vertex]) : Vertices[Vertex];
+	}
+
+	FVector GetNodeCenter(int32 Node) const
+	{
+		return (GetVertex(Triangles[Node * 3]) + GetVertex(Triangles[Node * 3 + 1]) + GetVertex(Triangles[Node * 3 + 2])) / 3;
+	}
+
+	TArrayView<const int32> GetNeighbours(int32 Node) const
+	{
+		return TArrayView<const int32>(Neighbours.GetData() + NeighbourOffsets[Node], NeighbourOffsets[Node + 1] - NeighbourOffsets[Node]);
+	}
+
+	/** Face edges of node, empty for nodes not on boundary */
+	TArrayView<const FFaceEdge> GetFaceEdges(int32 Node) const;
+
+	/** Node with plane closest to location, INDEX_NONE if cell is empty */
+	int32 FindClosestNode(const FVector& Location) const;
+
+	/**
+	 * Build cell graph from mesh data
+	 * @param	SortSpatially	Order nodes by Morton code of their centers inside of CellBox
+	 * @param	Compact			Store vertices as 16 bit fixed point relative to CellBox. Precision is 1.5 * cell size / 65535
+	 */
+	static TSharedRef<const FSurfaceNavCell, ESPMode::ThreadSafe> Build(const FIntVector& Coordinate, const FBox& CellBox, const FCellCreationData& Data, bool SortSpatially, bool Compact = false);
+
+	/** Vertices of data are moved into cell */
+	static TSharedRef<const FSurfaceNavCell, ESPMode::ThreadSafe> Build(const FIntVector& Coordinate, const FBox& CellBox, FCellCreationData&& Data, bool SortSpatially, bool Compact = false);
+
+	/** Memory used by arrays of cell */
+	SIZE_T GetAllocatedSize() const;
+
+private:
+	/** Replace Vertices by CompactVertices, face edges must be built before, their keys need full precision */
+	void CompactVertexData(const FBox& CellBox);
+
+	void BuildGraph(const FBox& CellBox, const TArray<int32>& SourceTriangles, const TArray<int32>& OuterVertices, bool SortSpatially);
+
+	/** Edges of boundary nodes on sides of FaceBox, keys are quantized with step of CellBox */
+	void BuildFaceEdges(const FBox& CellBox, const FBox& FaceBox);
+};
+
+
+
+/** 
+ * Consistent view of all published cells. Snapshot is never modified after it is published, 
+ * readers keep it alive and cells it references stay valid while they use it
+ */
+struct LIBRARY_API FSurfaceNavSnapshot
+{
+	FVector Center = FVector::ZeroVector;
+
+	float CellSize = 100;
+
+	TMap<FIntVector, TSharedPtr<const FSurfaceNavCell, ESPMode::ThreadSafe>> Cells;
+
+public:
+	FIntVector GetCellCoordinate(const FVector& WorldLocation) const
+	{
+		return FIntVector((WorldLocation - Center).GridSnap(CellSize) / CellSize);
+	}
+
+	const FSurfaceNavCell* FindCell(const FIntVector& Coordinate) const
+	{
+		const TSharedPtr<const FSurfaceNavCell, ESPMode::ThreadSafe>* Cell = Cells.Find(Coordinate);
+		return Cell ? Cell->Get() : nullptr;
+	}
+
+	bool ProjectPointToNavigation(const FVector& WorldLocation, FVector& OutLocation) const;
+
+	/** 
+	 * A* over node centers, paths cross cells through face edges shared by neighbouring cells
+	 * @return	false if there is no node near one of locations or nodes are not connected
+	 */
+	bool FindPath(const FVector& From, const FVector& To, TArray<FVector>& OutPath) const;
+};
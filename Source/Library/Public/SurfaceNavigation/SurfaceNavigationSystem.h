@@ -6,8 +6,10 @@
 
 #include "CoreMinimal.h"
 #include "UObject/NoExportTypes.h"
+#include "Tickable.h"
 #include "SurfaceNavLocalData.h"
 #include "CelledSurfaceNavData.h"
+#include "SurfaceSampler.h"
 #include "SurfaceNavigationSystem.generated.h"
 
 class ASurfaceNavigationVolume;
@@ -50,6 +52,13 @@ public:
 		, IsPartial(Result.IsPartial())		
 		, PathLocal(NavData.ToLocations(Result.Path, Center))
 	{}
+
+	/** Successful path of world locations */
+	FSurfacePathfindingResult(TArray<FVector>&& Path)
+		: IsSuccess(true)
+		, IsPartial(false)
+		, PathLocal(MoveTemp(Path))
+	{}
 };
 
 
@@ -105,7 +114,7 @@ struct FVolumeUpdateRequest
  * 
  */
 UCLASS(collapseCategories)
-class LIBRARY_API USurfaceNavigationSystem : public UObject
+class LIBRARY_API USurfaceNavigationSystem : public UObject, public FTickableGameObject
 {
 	GENERATED_BODY()
 
@@ -128,6 +137,18 @@ class LIBRARY_API USurfaceNavigationSystem : public UObject
 	UPROPERTY(EditInstanceOnly, meta = (AllowPrivateAccess))
 	bool ShowGraph;
 
+	// Build cell meshes with surface nets instead of marching cubes. Fewer and better shaped graph nodes
+	UPROPERTY(EditInstanceOnly, meta = (AllowPrivateAccess))
+	bool UseSurfaceNets;
+
+	// Store nav vertices as 16 bit fixed point relative to their cell
+	UPROPERTY(EditInstanceOnly, meta = (AllowPrivateAccess))
+	bool CompactNavVertices;
+
+	// Time per frame for scheduling, meshing and updating cells. Work left is resumed next frame
+	UPROPERTY(EditInstanceOnly, meta = (AllowPrivateAccess, ClampMin = "0"))
+	float RebuildBudgetMs;
+
 
 	FCelledSurfaceNavData CelledData;
 
@@ -152,6 +173,18 @@ public:
 
 	void ClearGraph();
 
+	bool IsRebuilding() const { return RebuildCellsNum > 0; }
+
+	/** Percentage of cells rebuilt since rebuild started */
+	float GetRebuildProgress() const;
+
+	//~ Begin FTickableGameObject Interface
+	virtual void Tick(float DeltaTime) override;
+	virtual bool IsTickable() const override;
+	virtual bool IsTickableInEditor() const override { return true; }
+	virtual TStatId GetStatId() const override { RETURN_QUICK_DECLARE_CYCLE_STAT(USurfaceNavigationSystem, STATGROUP_Tickables); }
+	//~ End FTickableGameObject Interface
+
 private:
 	typedef uint32 NavBoxID;
 
@@ -164,8 +197,38 @@ private:
 	void VolumeUpdateRequest(FVolumeUpdateRequest Request);
 	void BoxChanged(NavBoxID BoxID);
 
-	DECLARE_DELEGATE_TwoParams(FSamplerFinishedCell, FSamplerResult, FIntVector);
-	void SamplerFinished(FSamplerResult Result, FIntVector CellCoordinate);
+	// Cells waiting to be scheduled for sampling
+	TArray<FIntVector> PendingCells;
+	TSet<FIntVector> PendingCellsSet;
+
+	// Cells scheduled and waiting for sample result, with task of the last request
+	TMap<FIntVector, FSamplingTaskHandle> SamplingCells;
+
+	// Cells sampled and waiting for their graph to be published
+	TSet<FIntVector> BuildingCells;
+
+	// Cells queued since last time rebuild was finished
+	int32 RebuildCellsNum = 0;
+
+	void QueueCell(const FIntVector& Coord);
+
+	bool IsCellQueued(const FIntVector& Coord) const;
+
+	/** Stop rebuilding cell, its pending request and sampling task are dropped */
+	void DropCell(const FIntVector& Coord);
+
+	/** Remove cells whose tasks were cancelled or dropped by sampler, they would never finish */
+	void DropStaleSamplingCells();
+
+	/** Dropped cell is not counted in rebuild unless it is still queued */
+	void UncountCell(const FIntVector& Coord);
+
+	void UpdateRebuildInfo();
+
+	DECLARE_DELEGATE_TwoParams(FSamplerFinishedCell, const FSamplerResult&, FIntVector);
+	void SamplerFinished(const FSamplerResult& Result, FIntVector CellCoordinate);
+
+	void CellPublished(const FIntVector& CellCoordinate);
 
 protected:
 	const FSurfaceNavigationBox* FindBox(const FVector& Location) const;
@@ -25,6 +25,21 @@ public:
 	UPROPERTY(EditAnywhere)
 	UMaterialInterface* Material;
 
+	UPROPERTY(EditAnywhere)
+	bool UseSurfaceNets = false;
+
+	// Log build time and mesh size of marching cubes and surface nets on every sampled grid
+	UPROPERTY(EditAnywhere)
+	bool CompareExtractors = false;
+
+	// Builds of each extractor averaged by comparison
+	UPROPERTY(EditAnywhere, meta = (EditCondition = "CompareExtractors", ClampMin = 1))
+	int32 CompareIterations = 10;
+
+	// Log ACMR and graph traversal time before and after vertex cache optimization on every sampled grid
+	UPROPERTY(EditAnywhere)
+	bool MeasureVertexCache = false;
+
 
 	// Sets default values for this actor's properties
 	AMeshToGraphTest();
@@ -37,7 +52,11 @@ public:
 	void SheduleSample();
 protected:
 	
-	void SampleFinished(FSamplerResult Result);
+	void SampleFinished(const FSamplerResult& Result);
+
+	void RunExtractorComparison(const FDensityGridView& Grid) const;
+
+	void RunVertexCacheMeasure(const FDensityGridView& Grid) const;
 
 
 
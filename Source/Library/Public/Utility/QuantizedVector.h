@@ -0,0 +1,54 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+
+/** Position stored as 16 bit fixed point inside of box, see FVectorQuantizer */
+struct FQuantizedVector
+{
+	uint16 X = 0;
+	uint16 Y = 0;
+	uint16 Z = 0;
+
+	FQuantizedVector() {}
+	FQuantizedVector(uint16 X, uint16 Y, uint16 Z) : X(X), Y(Y), Z(Z) {}
+
+	bool operator==(const FQuantizedVector& Other) const { return X == Other.X && Y == Other.Y && Z == Other.Z; }
+};
+
+/**
+ * Maps positions of box to 16 bit fixed point and back. 
+ * Precision is box size / 65535 per axis, positions outside of box are clamped
+ */
+struct FVectorQuantizer
+{
+	static constexpr float MaxValue = 65535.f;
+
+	FVector Origin = FVector::ZeroVector;
+
+	// Size of one quantization step
+	FVector Step = FVector(1.f);
+
+	FVectorQuantizer() {}
+
+	explicit FVectorQuantizer(const FBox& Box)
+		: Origin(Box.Min)
+		, Step((Box.Max - Box.Min).ComponentMax(FVector(SMALL_NUMBER)) / MaxValue)
+	{}
+
+	FORCEINLINE FQuantizedVector Encode(const FVector& Position) const
+	{
+		const FVector Local = (Position - Origin) / Step;
+		return FQuantizedVector(
+			(uint16)FMath::Clamp(FMath::RoundToInt(Local.X), 0, 65535),
+			(uint16)FMath::Clamp(FMath::RoundToInt(Local.Y), 0, 65535),
+			(uint16)FMath::Clamp(FMath::RoundToInt(Local.Z), 0, 65535));
+	}
+
+	FORCEINLINE FVector Decode(const FQuantizedVector& Quantized) const
+	{
+		return Origin + FVector(Quantized.X, Quantized.Y, Quantized.Z) * Step;
+	}
+};